@@ -0,0 +1,121 @@
+// gst-plugin/compute-budget.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "./compute-budget.h"
+
+namespace kaldi {
+
+// the innermost ComputeSlot of the thread
+static GPrivate current_slot = G_PRIVATE_INIT(NULL);
+
+ComputeBudget &ComputeBudget::Instance() {
+  // never destroyed, elements may still decode at exit
+  static ComputeBudget *instance = new ComputeBudget();
+  return *instance;
+}
+
+ComputeBudget::ComputeBudget() : max_threads_(0), next_ticket_(0), next_admitted_(0) {
+  g_mutex_init(&lock_);
+  g_cond_init(&cond_);
+  const char *max_threads = getenv("GST_KALDI_MAX_COMPUTE_THREADS");
+  if (max_threads != NULL) {
+    max_threads_ = std::max(0, atoi(max_threads));
+  }
+  if (max_threads_ > 0) {
+    KALDI_LOG << "At most " << max_threads_ << " decoding steps run at a time";
+  }
+  stats_.max_threads = max_threads_;
+  stats_.num_active = 0;
+  stats_.num_waiting = 0;
+  stats_.num_steps = 0;
+  stats_.wait_secs = 0.0;
+}
+
+double ComputeBudget::Acquire() {
+  g_mutex_lock(&lock_);
+  stats_.num_steps++;
+  if (max_threads_ == 0) {
+    stats_.num_active++;
+    g_mutex_unlock(&lock_);
+    return 0.0;
+  }
+  uint64 ticket = next_ticket_++;
+  double wait_secs = 0.0;
+  if (ticket != next_admitted_ || stats_.num_active >= max_threads_) {
+    gint64 start_time = g_get_monotonic_time();
+    stats_.num_waiting++;
+    while (ticket != next_admitted_ || stats_.num_active >= max_threads_) {
+      g_cond_wait(&cond_, &lock_);
+    }
+    stats_.num_waiting--;
+    wait_secs = (g_get_monotonic_time() - start_time) / 1e6;
+    stats_.wait_secs += wait_secs;
+  }
+  next_admitted_++;
+  stats_.num_active++;
+  // the next ticket may fit too
+  g_cond_broadcast(&cond_);
+  g_mutex_unlock(&lock_);
+  return wait_secs;
+}
+
+void ComputeBudget::Release() {
+  g_mutex_lock(&lock_);
+  stats_.num_active--;
+  if (max_threads_ > 0) {
+    g_cond_broadcast(&cond_);
+  }
+  g_mutex_unlock(&lock_);
+}
+
+ComputeBudget::Stats ComputeBudget::GetStats() {
+  g_mutex_lock(&lock_);
+  Stats stats = stats_;
+  g_mutex_unlock(&lock_);
+  return stats;
+}
+
+ComputeSlot::ComputeSlot(double *wait_secs) :
+    wait_secs_(wait_secs),
+    outer_(static_cast<ComputeSlot*>(g_private_get(&current_slot))) {
+  *wait_secs_ += ComputeBudget::Instance().Acquire();
+  g_private_set(&current_slot, this);
+}
+
+ComputeSlot::~ComputeSlot() {
+  g_private_set(&current_slot, outer_);
+  ComputeBudget::Instance().Release();
+}
+
+ComputeSlotRelease::ComputeSlotRelease() :
+    slot_(static_cast<ComputeSlot*>(g_private_get(&current_slot))) {
+  if (slot_ != NULL) {
+    ComputeBudget::Instance().Release();
+  }
+}
+
+ComputeSlotRelease::~ComputeSlotRelease() {
+  if (slot_ != NULL) {
+    *(slot_->wait_secs_) += ComputeBudget::Instance().Acquire();
+  }
+}
+
+}  // namespace kaldi
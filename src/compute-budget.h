@@ -0,0 +1,101 @@
+// gst-plugin/compute-budget.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_COMPUTE_BUDGET_H_
+#define KALDI_SRC_COMPUTE_BUDGET_H_
+
+#include <glib.h>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+// Process-wide limit on the number of decoding steps (the decoding of a
+// chunk of audio) that run at the same time, over all decoder elements.
+// Steps that are over the limit wait in the order they arrived, so a stream
+// that decodes chunk after chunk can't starve the others. The limit is read
+// once from the environment variable GST_KALDI_MAX_COMPUTE_THREADS; without
+// it (or with 0) there is no limit. All methods are thread-safe.
+class ComputeBudget {
+ public:
+  struct Stats {
+    int32 max_threads;    // 0 if unlimited
+    int32 num_active;     // steps running now
+    int32 num_waiting;    // steps waiting for a slot now
+    int64 num_steps;      // steps started
+    double wait_secs;     // total time that steps have waited for a slot
+  };
+
+  static ComputeBudget &Instance();
+
+  // Waits for a free slot and takes it. Returns the seconds waited.
+  double Acquire();
+
+  void Release();
+
+  int32 MaxThreads() const { return max_threads_; }
+
+  Stats GetStats();
+
+ private:
+  ComputeBudget();
+
+  int32 max_threads_;
+  GMutex lock_;
+  GCond cond_;
+  // steps are let in in the order of their tickets
+  uint64 next_ticket_;
+  uint64 next_admitted_;
+  Stats stats_;
+};
+
+// Holds a slot of the compute budget while in scope, adding the time it
+// waited for it to *wait_secs
+class ComputeSlot {
+ public:
+  explicit ComputeSlot(double *wait_secs);
+  ~ComputeSlot();
+
+ private:
+  friend class ComputeSlotRelease;
+
+  double *wait_secs_;
+  // the slot that the thread held before this one
+  ComputeSlot *outer_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ComputeSlot);
+};
+
+// Gives the slot that the current thread holds back while in scope, so a
+// step that waits for another thread, e.g. for the batch scorer, doesn't
+// keep others from running. The slot is taken again at the end of the
+// scope, the wait is added to the step's. Does nothing if the thread holds
+// no slot.
+class ComputeSlotRelease {
+ public:
+  ComputeSlotRelease();
+  ~ComputeSlotRelease();
+
+ private:
+  ComputeSlot *slot_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ComputeSlotRelease);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_COMPUTE_BUDGET_H_
@@ -0,0 +1,148 @@
+// gst-plugin/cpu-affinity.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "./cpu-affinity.h"
+
+namespace kaldi {
+
+// Parses "0-3,8,10-11" into the sorted, distinct numbers
+static bool ParseCpuList(const std::string &list, std::vector<int32> *cpus) {
+  std::vector<int32> result;
+  std::istringstream is(list);
+  std::string range;
+  while (std::getline(is, range, ',')) {
+    // sysfs lists end with a newline
+    range.erase(range.find_last_not_of(" \n") + 1);
+    if (range.empty()) {
+      continue;
+    }
+    char *end;
+    long first = strtol(range.c_str(), &end, 10);
+    long last = first;
+    if (*end == '-') {
+      last = strtol(end + 1, &end, 10);
+    }
+    if (*end != '\0' || end == range.c_str() || first < 0 || last < first) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      result.push_back(static_cast<int32>(cpu));
+    }
+  }
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  cpus->swap(result);
+  return true;
+}
+
+bool CpuAffinity::Parse(const std::string &cpus) {
+  return ParseCpuList(cpus, &cpus_);
+}
+
+std::string CpuAffinity::NumaNodes() const {
+  std::ostringstream nodes;
+  for (int32 node = 0; ; node++) {
+    std::ostringstream filename;
+    filename << "/sys/devices/system/node/node" << node << "/cpulist";
+    std::ifstream is(filename.str().c_str());
+    if (!is.good()) {
+      break;
+    }
+    std::string list;
+    std::getline(is, list);
+    std::vector<int32> node_cpus;
+    if (!ParseCpuList(list, &node_cpus)) {
+      continue;
+    }
+    for (size_t i = 0; i < cpus_.size(); i++) {
+      if (std::binary_search(node_cpus.begin(), node_cpus.end(), cpus_[i])) {
+        if (nodes.tellp() > 0) {
+          nodes << ",";
+        }
+        nodes << node;
+        break;
+      }
+    }
+  }
+  return nodes.str();
+}
+
+#ifdef __linux__
+
+bool CpuAffinity::Apply() const {
+  if (cpus_.empty()) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < cpus_.size(); i++) {
+    if (cpus_[i] < CPU_SETSIZE) {
+      CPU_SET(cpus_[i], &set);
+    }
+  }
+  // 0 is the calling thread
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+CpuAffinity CpuAffinity::OfCurrentThread() {
+  CpuAffinity affinity;
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int32 cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+        affinity.cpus_.push_back(cpu);
+      }
+    }
+  }
+  return affinity;
+}
+
+#else
+
+bool CpuAffinity::Apply() const {
+  return false;
+}
+
+CpuAffinity CpuAffinity::OfCurrentThread() {
+  return CpuAffinity();
+}
+
+#endif
+
+ScopedCpuAffinity::ScopedCpuAffinity(const CpuAffinity &affinity) : applied_(false) {
+  if (!affinity.Empty()) {
+    saved_ = CpuAffinity::OfCurrentThread();
+    applied_ = !saved_.Empty() && affinity.Apply();
+  }
+}
+
+ScopedCpuAffinity::~ScopedCpuAffinity() {
+  if (applied_) {
+    saved_.Apply();
+  }
+}
+
+}  // namespace kaldi
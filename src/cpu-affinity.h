@@ -0,0 +1,73 @@
+// gst-plugin/cpu-affinity.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_CPU_AFFINITY_H_
+#define KALDI_SRC_CPU_AFFINITY_H_
+
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+// A set of CPUs that threads can be pinned to. On NUMA hosts, memory is
+// allocated on the node of the CPU that first writes to it, so models that
+// are loaded by a pinned thread end up next to the decoders that use them.
+// Pinning is only supported on Linux; elsewhere Apply() fails.
+class CpuAffinity {
+ public:
+  // Parses a list of CPUs like "0-7,16-23". An empty list pins nothing.
+  bool Parse(const std::string &cpus);
+
+  bool Empty() const { return cpus_.empty(); }
+
+  // The NUMA nodes of the CPUs, like "0" or "0,1"; empty if the host
+  // doesn't tell
+  std::string NumaNodes() const;
+
+  // Pins the calling thread, and the threads it starts from now on, to the
+  // CPUs
+  bool Apply() const;
+
+  // The CPUs the calling thread may run on
+  static CpuAffinity OfCurrentThread();
+
+ private:
+  std::vector<int32> cpus_;
+};
+
+// Pins the calling thread to a set of CPUs while in scope, e.g. while
+// loading a model. Does nothing if the set is empty.
+class ScopedCpuAffinity {
+ public:
+  explicit ScopedCpuAffinity(const CpuAffinity &affinity);
+  ~ScopedCpuAffinity();
+
+  // Whether the thread was pinned, and is unpinned again at the end
+  bool Applied() const { return applied_; }
+
+ private:
+  CpuAffinity saved_;
+  bool applied_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ScopedCpuAffinity);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_CPU_AFFINITY_H_
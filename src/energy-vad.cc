@@ -0,0 +1,105 @@
+// gst-plugin/energy-vad.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+
+#include "./energy-vad.h"
+
+namespace kaldi {
+
+EnergyVad::EnergyVad(BaseFloat sample_rate, BaseFloat energy_threshold_db,
+                     BaseFloat hangover_secs) :
+  in_silence_(true),
+  num_trailing_silence_(0) {
+  frame_length_ = std::max(1, static_cast<int32>(sample_rate * 0.01));
+  // at least one frame, so that a silence ends a segment only after a whole
+  // silent frame, and some context is kept before speech
+  hangover_length_ = std::max(frame_length_,
+                              static_cast<int32>(sample_rate * hangover_secs));
+  energy_threshold_ = pow(10.0, energy_threshold_db / 10.0);
+}
+
+int32 EnergyVad::TrimHeldBack() {
+  int32 num_dropped = static_cast<int32>(held_back_.size()) - hangover_length_;
+  if (num_dropped <= 0) {
+    return 0;
+  }
+  held_back_.erase(held_back_.begin(), held_back_.begin() + num_dropped);
+  return num_dropped;
+}
+
+int32 EnergyVad::Process(const VectorBase<BaseFloat> &input,
+                         Vector<BaseFloat> *output) {
+  int32 dim = input.Dim();
+  const BaseFloat *in = input.Data();
+  // worst case: all held back audio is released together with the input
+  output->Resize(held_back_.size() + dim, kUndefined);
+  BaseFloat *out = output->Data();
+  int32 num_output = 0;
+  int32 num_dropped = 0;
+
+  for (int32 start = 0; start < dim; start += frame_length_) {
+    int32 length = std::min(frame_length_, dim - start);
+    const BaseFloat *frame = in + start;
+    double sum_squares = 0.0;
+    for (int32 i = 0; i < length; i++) {
+      sum_squares += frame[i] * frame[i];
+    }
+    bool is_speech = (sum_squares / length > energy_threshold_);
+
+    if (in_silence_) {
+      if (is_speech) {
+        // release the silence just before the speech, then the speech itself
+        num_dropped += TrimHeldBack();
+        std::copy(held_back_.begin(), held_back_.end(), out + num_output);
+        num_output += held_back_.size();
+        held_back_.clear();
+        std::copy(frame, frame + length, out + num_output);
+        num_output += length;
+        in_silence_ = false;
+        num_trailing_silence_ = 0;
+      } else {
+        held_back_.insert(held_back_.end(), frame, frame + length);
+      }
+    } else {
+      std::copy(frame, frame + length, out + num_output);
+      num_output += length;
+      if (is_speech) {
+        num_trailing_silence_ = 0;
+      } else {
+        num_trailing_silence_ += length;
+        if (num_trailing_silence_ >= hangover_length_) {
+          in_silence_ = true;
+        }
+      }
+    }
+  }
+  num_dropped += TrimHeldBack();
+  output->Resize(num_output, kCopyData);
+  return num_dropped;
+}
+
+int32 EnergyVad::Flush() {
+  int32 num_dropped = held_back_.size();
+  held_back_.clear();
+  in_silence_ = true;
+  num_trailing_silence_ = 0;
+  return num_dropped;
+}
+
+}  // namespace kaldi
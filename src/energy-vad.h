@@ -0,0 +1,73 @@
+// gst-plugin/energy-vad.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_ENERGY_VAD_H_
+#define KALDI_SRC_ENERGY_VAD_H_
+
+#include <vector>
+
+#include <matrix/kaldi-vector.h>
+
+namespace kaldi {
+
+// Streaming energy-based voice activity gate that sits between the audio
+// source and the feature pipeline. Audio is classified in 10 ms frames.
+// Speech, and up to 'hangover_secs' of silence before and after it, is
+// passed through; the rest of a long silence is dropped so that no
+// features or nnet outputs are computed for it. The hangover is at least
+// one frame.
+class EnergyVad {
+ public:
+  // energy_threshold_db is the frame energy (10 * log10 of the mean squared
+  // sample, on the 16-bit sample scale) above which a frame is speech
+  EnergyVad(BaseFloat sample_rate, BaseFloat energy_threshold_db,
+            BaseFloat hangover_secs);
+
+  // Writes the audio that should be decoded to 'output' and returns the
+  // number of samples that were dropped as silence. Silence is held back
+  // until it is known whether speech follows within the hangover, so the
+  // output may lag the input by up to the hangover.
+  int32 Process(const VectorBase<BaseFloat> &input, Vector<BaseFloat> *output);
+
+  // Call at the end of the input: drops the silence that is still held
+  // back, since no speech follows it, and returns the number of samples
+  int32 Flush();
+
+  // True when the current silence has lasted longer than the hangover,
+  // i.e. audio is being dropped
+  bool InSilence() const { return in_silence_; }
+
+ private:
+  // Drops the oldest held back samples so that at most the hangover
+  // remains, returns the number of dropped samples
+  int32 TrimHeldBack();
+
+  int32 frame_length_;
+  int32 hangover_length_;
+  // threshold on the mean squared sample value
+  BaseFloat energy_threshold_;
+
+  bool in_silence_;
+  // samples of silence since the last speech frame
+  int32 num_trailing_silence_;
+  // silence held back while in_silence_
+  std::vector<BaseFloat> held_back_;
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_ENERGY_VAD_H_
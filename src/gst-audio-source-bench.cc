@@ -0,0 +1,302 @@
+// gst-plugin/gst-audio-source-bench.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares reading queued GstBuffers into sample vectors the way the plugin
+// used to do it (gst_buffer_extract() into a temporary array that is
+// allocated for every read) with GstBufferSource, which converts the samples
+// from the mapped buffers. Reports the time, the bytes copied before
+// conversion and the heap allocations per second of audio. No decoder is
+// involved. Not part of the plugin, build it with "make gst-audio-source-bench".
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#include <gst/gst.h>
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "util/parse-options.h"
+
+#include "./gst-audio-source.h"
+#include "./sample-convert.h"
+
+// Heap allocations made with operator new, i.e. by the C++ code
+static size_t num_allocations = 0;
+
+void* operator new(size_t size) {
+  num_allocations++;
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+namespace kaldi {
+
+// 'num_samples' samples of noise in 'format', cut into buffers of
+// 'buffer_size' bytes. The size needn't be a multiple of the sample width.
+static void MakeBuffers(SampleFormat format, int32 num_samples,
+                        int32 buffer_size, std::vector<GstBuffer*> *buffers) {
+  gsize width = SampleWidth(format);
+  std::vector<guint8> bytes(num_samples * width);
+  for (int32 i = 0; i < num_samples; i++) {
+    BaseFloat value = RandGauss() * 3000.0;
+    guint8 *dst = &bytes[i * width];
+    if (format == kSampleFormatS16LE) {
+      int16 sample = static_cast<int16>(value);
+      memcpy(dst, &sample, width);
+    } else if (format == kSampleFormatS32LE) {
+      int32 sample = static_cast<int32>(value * 65536.0);
+      memcpy(dst, &sample, width);
+    } else {
+      float sample = value / 32768.0;
+      memcpy(dst, &sample, width);
+    }
+  }
+  for (size_t pos = 0; pos < bytes.size(); pos += buffer_size) {
+    gsize size = std::min(static_cast<gsize>(buffer_size), bytes.size() - pos);
+    GstBuffer *buf = gst_buffer_new_allocate(NULL, size, NULL);
+    gst_buffer_fill(buf, 0, &bytes[pos], size);
+    buffers->push_back(buf);
+  }
+}
+
+// The old way: every read allocates a temporary array, extracts the bytes
+// from the buffers into it and converts it. The samples are converted with
+// ConvertSamples() like in GstBufferSource, so that only the reading differs.
+class ExtractingReader {
+ public:
+  ExtractingReader(const std::vector<GstBuffer*> &buffers, SampleFormat format) :
+      buffers_(buffers), format_(format), current_(0), pos_in_current_buf_(0),
+      bytes_copied_(0) {}
+
+  bool Read(Vector<BaseFloat> *data) {
+    gsize width = SampleWidth(format_);
+    gsize nbytes_req = data->Dim() * width;
+    guint8 *buf = new guint8[nbytes_req];
+    gsize nbytes_transferred = 0;
+    while (nbytes_transferred < nbytes_req && current_ < buffers_.size()) {
+      GstBuffer *current_buffer = buffers_[current_];
+      gsize nbytes_from_current =
+          std::min(nbytes_req - nbytes_transferred,
+                   gst_buffer_get_size(current_buffer) - pos_in_current_buf_);
+      gsize nbytes_extracted =
+          gst_buffer_extract(current_buffer, pos_in_current_buf_,
+                             buf + nbytes_transferred, nbytes_from_current);
+      KALDI_ASSERT(nbytes_extracted == nbytes_from_current);
+      nbytes_transferred += nbytes_from_current;
+      pos_in_current_buf_ += nbytes_from_current;
+      if (pos_in_current_buf_ == gst_buffer_get_size(current_buffer)) {
+        current_++;
+        pos_in_current_buf_ = 0;
+      }
+    }
+    bytes_copied_ += nbytes_transferred;
+    int32 nsamples_received = nbytes_transferred / width;
+    ConvertSamples(format_, buf, nsamples_received, data->Data());
+    delete[] buf;
+    if (nsamples_received < data->Dim()) {
+      data->Resize(nsamples_received, kCopyData);
+    }
+    return current_ < buffers_.size();
+  }
+
+  size_t BytesCopied() const { return bytes_copied_; }
+
+ private:
+  const std::vector<GstBuffer*> &buffers_;
+  SampleFormat format_;
+  size_t current_;
+  gsize pos_in_current_buf_;
+  size_t bytes_copied_;
+};
+
+// Bytes that GstBufferSource copies into its scratch area: the samples that
+// are split between two buffers
+static size_t SplitSampleBytes(const std::vector<GstBuffer*> &buffers,
+                               SampleFormat format) {
+  gsize width = SampleWidth(format);
+  size_t result = 0;
+  gsize pos = 0;
+  for (size_t i = 0; i + 1 < buffers.size(); i++) {
+    pos += gst_buffer_get_size(buffers[i]);
+    if (pos % width != 0) {
+      result += width;
+    }
+  }
+  return result;
+}
+
+// Totals of one read of all of the buffers, averaged over the repeats
+struct ReadStats {
+  double secs;
+  double num_allocations;
+  // reserved before the reading starts, so that collecting the samples
+  // doesn't allocate
+  std::vector<BaseFloat> samples;
+};
+
+static void ReadExtracting(const std::vector<GstBuffer*> &buffers,
+                           SampleFormat format, int32 chunk_size,
+                           int32 num_repeats, ReadStats *stats,
+                           size_t *bytes_copied) {
+  Vector<BaseFloat> data(chunk_size);
+  stats->secs = 0.0;
+  stats->num_allocations = 0.0;
+  for (int32 r = 0; r < num_repeats; r++) {
+    ExtractingReader reader(buffers, format);
+    stats->samples.clear();
+    size_t allocations_before = num_allocations;
+    Timer timer;
+    bool more_data = true;
+    while (more_data) {
+      data.Resize(chunk_size, kUndefined);
+      more_data = reader.Read(&data);
+      stats->samples.insert(stats->samples.end(), data.Data(), data.Data() + data.Dim());
+    }
+    stats->secs += timer.Elapsed() / num_repeats;
+    stats->num_allocations +=
+        static_cast<double>(num_allocations - allocations_before) / num_repeats;
+    *bytes_copied = reader.BytesCopied();
+  }
+}
+
+// Pushes all of the buffers first, so that only the reading is measured
+static void ReadMapped(const std::vector<GstBuffer*> &buffers,
+                       SampleFormat format, int32 chunk_size,
+                       int32 num_repeats, ReadStats *stats) {
+  Vector<BaseFloat> data(chunk_size);
+  stats->secs = 0.0;
+  stats->num_allocations = 0.0;
+  for (int32 r = 0; r < num_repeats; r++) {
+    GstBufferSource source;
+    source.SetSampleFormat(format);
+    for (size_t i = 0; i < buffers.size(); i++) {
+      source.PushBuffer(buffers[i]);
+    }
+    source.SetEnded(true);
+    stats->samples.clear();
+    size_t allocations_before = num_allocations;
+    Timer timer;
+    bool more_data = true;
+    while (more_data) {
+      data.Resize(chunk_size, kUndefined);
+      more_data = source.Read(&data);
+      stats->samples.insert(stats->samples.end(), data.Data(), data.Data() + data.Dim());
+    }
+    stats->secs += timer.Elapsed() / num_repeats;
+    stats->num_allocations +=
+        static_cast<double>(num_allocations - allocations_before) / num_repeats;
+  }
+}
+
+}  // namespace kaldi
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+    const char *usage =
+        "Times reading queued Gst buffers into sample vectors in each sample format:\n"
+        "gst_buffer_extract() into a temporary array vs. GstBufferSource, which converts\n"
+        "from the mapped buffers. Times, bytes copied and allocations are per second of audio.\n"
+        "\n"
+        "Usage: gst-audio-source-bench [options]\n";
+    ParseOptions po(usage);
+    int32 sample_rate = 16000;
+    BaseFloat audio_secs = 60.0;
+    BaseFloat chunk_length_in_secs = 0.05;
+    int32 buffer_size = 3201;
+    int32 num_repeats = 10;
+    int32 seed = 0;
+    po.Register("sample-rate", &sample_rate, "Sample rate of the audio");
+    po.Register("audio-secs", &audio_secs, "Length of the audio that is read");
+    po.Register("chunk-length", &chunk_length_in_secs,
+                "Length of the audio in one read, in seconds");
+    po.Register("buffer-size", &buffer_size,
+                "Size of the Gst buffers in bytes; if it is not a multiple of the "
+                "sample width, samples are split between buffers");
+    po.Register("num-repeats", &num_repeats, "Number of times the audio is read");
+    po.Register("seed", &seed, "Seed of the random audio");
+    po.Read(argc, argv);
+    if (po.NumArgs() != 0 || buffer_size <= 0 || num_repeats <= 0) {
+      po.PrintUsage();
+      return 1;
+    }
+    srand(seed);
+    gst_init(NULL, NULL);
+
+    int32 num_samples = static_cast<int32>(sample_rate * audio_secs);
+    int32 chunk_size = std::max(1, static_cast<int32>(sample_rate * chunk_length_in_secs));
+    const SampleFormat formats[] = { kSampleFormatS16LE, kSampleFormatS32LE,
+                                     kSampleFormatF32LE };
+    const char *format_names[] = { "S16LE", "S32LE", "F32LE" };
+    std::cout << std::setw(7) << "format"
+              << std::setw(14) << "extract ms/s" << std::setw(13) << "mapped ms/s"
+              << std::setw(17) << "extract bytes/s" << std::setw(16) << "mapped bytes/s"
+              << std::setw(18) << "extract allocs/s" << std::setw(17) << "mapped allocs/s"
+              << "  same samples" << std::endl;
+    bool all_same = true;
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+      std::vector<GstBuffer*> buffers;
+      MakeBuffers(formats[f], num_samples, buffer_size, &buffers);
+
+      ReadStats old_stats, new_stats;
+      old_stats.samples.reserve(num_samples);
+      new_stats.samples.reserve(num_samples);
+      size_t old_bytes_copied;
+      ReadExtracting(buffers, formats[f], chunk_size, num_repeats, &old_stats,
+                     &old_bytes_copied);
+      ReadMapped(buffers, formats[f], chunk_size, num_repeats, &new_stats);
+      size_t new_bytes_copied = SplitSampleBytes(buffers, formats[f]);
+
+      bool same = (old_stats.samples == new_stats.samples);
+      all_same = all_same && same;
+      std::cout << std::setw(7) << format_names[f]
+                << std::fixed << std::setprecision(3)
+                << std::setw(14) << old_stats.secs * 1000.0 / audio_secs
+                << std::setw(13) << new_stats.secs * 1000.0 / audio_secs
+                << std::setprecision(0)
+                << std::setw(17) << old_bytes_copied / audio_secs
+                << std::setw(16) << new_bytes_copied / audio_secs
+                << std::setprecision(1)
+                << std::setw(18) << old_stats.num_allocations / audio_secs
+                << std::setw(17) << new_stats.num_allocations / audio_secs
+                << "  " << (same ? "yes" : "NO") << std::endl;
+      for (size_t i = 0; i < buffers.size(); i++) {
+        gst_buffer_unref(buffers[i]);
+      }
+    }
+    return all_same ? 0 : 1;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -18,28 +18,161 @@
 // limitations under the License.
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 
 #include "./gst-audio-source.h"
 
 namespace kaldi {
 
 
+void GetResampleFilter(ResampleQuality quality, int32 input_rate,
+                       int32 output_rate, BaseFloat *filter_cutoff,
+                       int32 *num_zeros) {
+  // the cutoff is relative to the Nyquist frequency of the lower rate
+  BaseFloat relative_cutoff;
+  switch (quality) {
+    case kResampleQualityFast:
+      *num_zeros = 4;
+      relative_cutoff = 0.85;
+      break;
+    case kResampleQualityHigh:
+      *num_zeros = 16;
+      relative_cutoff = 0.97;
+      break;
+    default:
+      *num_zeros = 8;
+      relative_cutoff = 0.93;
+      break;
+  }
+  *filter_cutoff = relative_cutoff * 0.5 * std::min(input_rate, output_rate);
+}
+
+GstAudioSource::GstAudioSource() :
+  resample_changed_(false),
+  input_rate_(0),
+  output_rate_(0),
+  quality_(kResampleQualityMedium),
+  resampler_(NULL),
+  resample_ratio_(1.0),
+  resample_delay_(0),
+  input_ended_(false) {
+  g_mutex_init(&resample_lock_);
+}
+
+GstAudioSource::~GstAudioSource() {
+  delete resampler_;
+  g_mutex_clear(&resample_lock_);
+}
+
+void GstAudioSource::SetResampling(int32 input_rate, int32 output_rate,
+                                   ResampleQuality quality) {
+  g_mutex_lock(&resample_lock_);
+  input_rate_ = input_rate;
+  output_rate_ = output_rate;
+  quality_ = quality;
+  resample_changed_.store(true);
+  g_mutex_unlock(&resample_lock_);
+}
+
+void GstAudioSource::UpdateResampler() {
+  g_mutex_lock(&resample_lock_);
+  int32 input_rate = input_rate_;
+  int32 output_rate = output_rate_;
+  ResampleQuality quality = quality_;
+  resample_changed_.store(false);
+  g_mutex_unlock(&resample_lock_);
+
+  delete resampler_;
+  resampler_ = NULL;
+  if (input_rate <= 0 || output_rate <= 0 || input_rate == output_rate) {
+    return;
+  }
+  int32 num_zeros;
+  BaseFloat filter_cutoff;
+  GetResampleFilter(quality, input_rate, output_rate, &filter_cutoff, &num_zeros);
+  resample_ratio_ = static_cast<double>(input_rate) / output_rate;
+  KALDI_VLOG(1) << "Resampling audio from " << input_rate << " Hz to "
+                << output_rate << " Hz";
+  resampler_ = new LinearResample(input_rate, output_rate, filter_cutoff,
+                                  num_zeros);
+  resample_delay_ = static_cast<int32>(
+      ceil(num_zeros / (2.0 * filter_cutoff) * input_rate)) + 1;
+}
+
+bool GstAudioSource::Read(Vector<BaseFloat> *data) {
+  if (resample_changed_.load()) {
+    UpdateResampler();
+  }
+  if (resampler_ == NULL && resampled_.empty()) {
+    return ReadSamples(data);
+  }
+
+  int32 nsamples_req = data->Dim();
+  bool more_data = !input_ended_;
+  while (static_cast<int32>(resampled_.size()) < nsamples_req && more_data) {
+    int32 nsamples_missing = nsamples_req - resampled_.size();
+    if (resampler_ != NULL) {
+      // LinearResample keeps the filter history between calls, so the
+      // output of consecutive chunks is continuous
+      resample_input_.Resize(static_cast<int32>(
+          ceil(nsamples_missing * resample_ratio_)), kUndefined);
+      more_data = ReadSamples(&resample_input_);
+      resampler_->Resample(resample_input_, !more_data, &resample_output_);
+    } else {
+      // the rates were made equal while resampled audio was still left over
+      resample_output_.Resize(nsamples_missing, kUndefined);
+      more_data = ReadSamples(&resample_output_);
+    }
+    resampled_.insert(resampled_.end(), resample_output_.Data(),
+                      resample_output_.Data() + resample_output_.Dim());
+  }
+  input_ended_ = !more_data;
+
+  int32 nsamples_received = std::min(nsamples_req, static_cast<int32>(resampled_.size()));
+  data->Resize(nsamples_received, kUndefined);
+  std::copy(resampled_.begin(), resampled_.begin() + nsamples_received, data->Data());
+  resampled_.erase(resampled_.begin(), resampled_.begin() + nsamples_received);
+  return !(input_ended_ && resampled_.empty());
+}
+
+bool GstAudioSource::ReadWouldBlock(int32 num_samples) {
+  if (resample_changed_.load()) {
+    UpdateResampler();
+  }
+  if (input_ended_) {
+    return false;
+  }
+  int32 nsamples_missing = num_samples - static_cast<int32>(resampled_.size());
+  if (nsamples_missing <= 0) {
+    return false;
+  }
+  if (resampler_ == NULL) {
+    return !CanReadSamples(nsamples_missing);
+  }
+  return !CanReadSamples(static_cast<size_t>(
+      ceil(nsamples_missing * resample_ratio_)) + resample_delay_);
+}
+
 GstBufferSource::GstBufferSource() :
   ended_(false),
   flush_(false) {
   buf_queue_ = g_async_queue_new();
   current_buffer_ = NULL;
   pos_in_current_buf_ = 0;
-
-  // Monophone, 16-bit input hardcoded
-  KALDI_ASSERT(sizeof(SampleType) == 2 &&
-      "The current GstBufferSource code assumes 16-bit input");
+  num_partial_bytes_ = 0;
+  queued_bytes_ = 0;
+  max_queued_samples_ = 0;
+  overflow_policy_ = kQueueOverflowBlock;
+  sample_format_ = kSampleFormatS16LE;
   g_cond_init(&data_cond_);
+  g_cond_init(&space_cond_);
   g_mutex_init(&lock_);
 }
 
 GstBufferSource::~GstBufferSource() {
   g_cond_clear(&data_cond_);
+  g_cond_clear(&space_cond_);
   g_mutex_clear(&lock_);
   g_async_queue_unref(buf_queue_);
   if (current_buffer_) {
@@ -49,13 +182,72 @@ GstBufferSource::~GstBufferSource() {
 }
 
 void GstBufferSource::PushBuffer(GstBuffer *buf) {
+  gsize size = gst_buffer_get_size(buf);
   g_mutex_lock(&lock_);
+  gsize max_queued_bytes = max_queued_samples_ * SampleWidth(sample_format_);
+  if (max_queued_bytes > 0) {
+    switch (overflow_policy_) {
+      case kQueueOverflowBlock:
+        // A buffer larger than the limit is let through once the queue is empty
+        while ((queued_bytes_ > 0) && (queued_bytes_ + size > max_queued_bytes)
+            && !flush_) {
+          g_cond_wait(&space_cond_, &lock_);
+        }
+        break;
+      case kQueueOverflowDropNewest:
+        if (queued_bytes_ + size > max_queued_bytes) {
+          g_mutex_unlock(&lock_);
+          return;
+        }
+        break;
+      case kQueueOverflowDropOldest:
+        while ((queued_bytes_ > 0) && (queued_bytes_ + size > max_queued_bytes)) {
+          GstBuffer *oldest = reinterpret_cast<GstBuffer*>(g_async_queue_try_pop(buf_queue_));
+          if (oldest == NULL) {
+            break;
+          }
+          queued_bytes_ -= gst_buffer_get_size(oldest);
+          gst_buffer_unref(oldest);
+        }
+        break;
+    }
+  }
   gst_buffer_ref(buf);
   g_async_queue_push(buf_queue_, buf);
+  queued_bytes_ += size;
   g_cond_signal(&data_cond_);
   g_mutex_unlock(&lock_);
 }
 
+void GstBufferSource::SetQueueLimit(size_t max_queued_samples,
+                                    QueueOverflowPolicy policy) {
+  g_mutex_lock(&lock_);
+  max_queued_samples_ = max_queued_samples;
+  overflow_policy_ = policy;
+  g_cond_broadcast(&space_cond_);
+  g_mutex_unlock(&lock_);
+}
+
+size_t GstBufferSource::NumSamplesQueued() {
+  g_mutex_lock(&lock_);
+  size_t result = queued_bytes_ / SampleWidth(sample_format_);
+  g_mutex_unlock(&lock_);
+  return result;
+}
+
+bool GstBufferSource::CanReadSamples(size_t num_samples) {
+  g_mutex_lock(&lock_);
+  gsize nbytes = queued_bytes_ + num_partial_bytes_;
+  gsize width = SampleWidth(sample_format_);
+  bool ended = ended_ || flush_;
+  g_mutex_unlock(&lock_);
+  // the rest of the buffer that is being read is only used by the reader
+  if (current_buffer_ != NULL) {
+    nbytes += gst_buffer_get_size(current_buffer_) - pos_in_current_buf_;
+  }
+  return ended || nbytes >= num_samples * width;
+}
+
 void GstBufferSource::SetEnded(bool ended) {
   g_mutex_lock(&lock_);
   ended_ = ended;
@@ -67,66 +259,107 @@ void GstBufferSource::SetFlush(bool flush) {
   g_mutex_lock(&lock_);
   flush_ = flush;
   g_cond_signal(&data_cond_);
+  g_cond_broadcast(&space_cond_);
+  g_mutex_unlock(&lock_);
+}
+
+void GstBufferSource::SetSampleFormat(SampleFormat format) {
+  g_mutex_lock(&lock_);
+  sample_format_ = format;
   g_mutex_unlock(&lock_);
 }
 
 
-bool GstBufferSource::Read(Vector<BaseFloat> *data) {
-  uint32 nsamples_req = data->Dim();  // (16bit) samples requested
-  uint32 kDim = data->Dim();
-  int16 *buf = new int16[kDim];
-  uint32 nbytes_transferred = 0;
+bool GstBufferSource::ReadSamples(Vector<BaseFloat> *data) {
+  uint32 nsamples_req = data->Dim();  // samples requested
+  uint32 nsamples_received = 0;
+  SampleFormat format = kSampleFormatS16LE;
+  gsize width = 0;
 
-  while ((nbytes_transferred  < nsamples_req * sizeof(SampleType))) {
+  while (nsamples_received < nsamples_req) {
     g_mutex_lock(&lock_);
+    format = sample_format_;
+    width = SampleWidth(format);
     while ((current_buffer_ == NULL) &&
         !((g_async_queue_length(buf_queue_) == 0) && ended_)) {
       current_buffer_ = reinterpret_cast<GstBuffer*>(g_async_queue_try_pop(buf_queue_));
       if (current_buffer_ == NULL) {
         g_cond_wait(&data_cond_, &lock_);
+      } else {
+        queued_bytes_ -= gst_buffer_get_size(current_buffer_);
+        g_cond_signal(&space_cond_);
       }
     }
     g_mutex_unlock(&lock_);
     if (current_buffer_ == NULL) {
       break;
     }
-    if (flush_) {      
+    if (flush_) {
       gst_buffer_unref(current_buffer_);
       current_buffer_ = NULL;
       pos_in_current_buf_ = 0;
-      continue;     
+      num_partial_bytes_ = 0;
+      continue;
     }
-    uint32 nbytes_from_current =
-        std::min(nsamples_req * sizeof(SampleType) - nbytes_transferred,
-                 (gst_buffer_get_size(current_buffer_) - pos_in_current_buf_));
-    uint32 nbytes_extracted =
-        gst_buffer_extract(current_buffer_, pos_in_current_buf_,
-                           (reinterpret_cast<char *>(buf)) + nbytes_transferred,
-                           nbytes_from_current);
-    KALDI_ASSERT(nbytes_extracted == nbytes_from_current
-                 && "Unexpected number of bytes extracted from Gst buffer");
-
-    nbytes_transferred += nbytes_from_current;
-    pos_in_current_buf_ += nbytes_from_current;
-    if (pos_in_current_buf_ == gst_buffer_get_size(current_buffer_)) {
-      // we are done with the current buffer
+
+    // Convert directly from the mapped buffer memory, without
+    // extracting the samples into an intermediate array first
+    GstMapInfo map;
+    if (!gst_buffer_map(current_buffer_, &map, GST_MAP_READ)) {
+      KALDI_WARN << "Failed to map Gst buffer, dropping it";
       gst_buffer_unref(current_buffer_);
       current_buffer_ = NULL;
       pos_in_current_buf_ = 0;
+      continue;
     }
-  }
+    const guint8 *bytes = map.data + pos_in_current_buf_;
+    gsize nbytes_left = map.size - pos_in_current_buf_;
 
-  uint32 nsamples_received = nbytes_transferred / sizeof(SampleType);
-  for (int i = 0; i < nsamples_received ; ++i) {
-    (*data)(i) = static_cast<BaseFloat>(buf[i]);
-  }
+    // A sample split between two buffers is completed in the scratch area
+    if (num_partial_bytes_ > 0) {
+      gsize nbytes_from_current =
+          std::min(width - num_partial_bytes_, nbytes_left);
+      memcpy(partial_sample_ + num_partial_bytes_, bytes, nbytes_from_current);
+      num_partial_bytes_ += nbytes_from_current;
+      bytes += nbytes_from_current;
+      nbytes_left -= nbytes_from_current;
+      if (num_partial_bytes_ == width) {
+        ConvertSamples(format, partial_sample_, 1, data->Data() + nsamples_received);
+        nsamples_received++;
+        num_partial_bytes_ = 0;
+      }
+    }
+
+    uint32 nsamples_from_current =
+        std::min(static_cast<gsize>(nsamples_req - nsamples_received),
+                 nbytes_left / width);
+    ConvertSamples(format, bytes, nsamples_from_current,
+                   data->Data() + nsamples_received);
+    nsamples_received += nsamples_from_current;
+    bytes += nsamples_from_current * width;
+    nbytes_left -= nsamples_from_current * width;
 
-  delete[] buf;
+    // Keep the odd trailing byte(s) until the next buffer arrives
+    if (nsamples_received < nsamples_req && nbytes_left > 0) {
+      memcpy(partial_sample_, bytes, nbytes_left);
+      num_partial_bytes_ = nbytes_left;
+      nbytes_left = 0;
+    }
+
+    pos_in_current_buf_ = map.size - nbytes_left;
+    gst_buffer_unmap(current_buffer_, &map);
+    if (nbytes_left == 0) {
+      // we are done with the current buffer
+      gst_buffer_unref(current_buffer_);
+      current_buffer_ = NULL;
+      pos_in_current_buf_ = 0;
+    }
+  }
 
   if (nsamples_received < nsamples_req) {
     data->Resize(nsamples_received, kCopyData);
   }
-  return !((g_async_queue_length(buf_queue_) < sizeof(SampleType))
+  return !((g_async_queue_length(buf_queue_) == 0)
       && ended_
       && (current_buffer_ == NULL));
 }
@@ -20,39 +20,158 @@
 #ifndef KALDI_SRC_GST_AUDIO_SOURCE_H_
 #define KALDI_SRC_GST_AUDIO_SOURCE_H_
 
+#include <atomic>
+#include <vector>
+
 #include <matrix/kaldi-vector.h>
+#include <feat/resample.h>
 #include <gst/gst.h>
 
+#include "./sample-convert.h"
+
 namespace kaldi {
 
 
-// OnlineAudioSourceItf implementation using a queue of Gst Buffers
-class GstBufferSource {
- public:
-  typedef int16 SampleType;  // hardcoded 16-bit audio
+// What PushBuffer() does when the queue limit would be exceeded
+enum QueueOverflowPolicy {
+  kQueueOverflowBlock = 0,       // wait until the decoder has caught up
+  kQueueOverflowDropNewest = 1,  // discard the incoming buffer
+  kQueueOverflowDropOldest = 2   // discard the oldest queued audio
+};
 
-  GstBufferSource();
+// Speed/quality trade-off of the built-in resampler
+enum ResampleQuality {
+  kResampleQualityFast = 0,
+  kResampleQualityMedium = 1,
+  kResampleQualityHigh = 2
+};
+
+// Width of the windowed sinc filter (in zero crossings on each side) and its
+// cutoff frequency in Hz that the built-in resampler uses at 'quality'
+void GetResampleFilter(ResampleQuality quality, int32 input_rate,
+                       int32 output_rate, BaseFloat *filter_cutoff,
+                       int32 *num_zeros);
+
+// Base class of the audio sources that the decoding task reads its input
+// from. Buffers are pushed from the streaming thread, Read() is called from
+// the decoding task. If the input sample rate differs from the rate that the
+// decoder expects, Read() resamples the audio on the fly.
+class GstAudioSource {
+ public:
+  GstAudioSource();
 
-  // Implementation of the OnlineAudioSourceItf
+  // Blocks until data->Dim() samples (at the output rate) are available or
+  // the stream has ended, returns false when there is no more data to read
   bool Read(Vector<BaseFloat> *data);
 
+  // True if Read() of num_samples samples would wait for audio that hasn't
+  // been pushed yet. With resampling this is an estimate that leaves some
+  // room for the delay of the filter.
+  bool ReadWouldBlock(int32 num_samples);
+
+  // Sets the sample rate of the pushed audio and the rate that Read()
+  // should return. Takes effect at the next Read().
+  void SetResampling(int32 input_rate, int32 output_rate,
+                     ResampleQuality quality);
+
+  virtual void PushBuffer(GstBuffer *buf) = 0;
+
+  virtual void SetEnded(bool ended) = 0;
+
+  // While flushing, all queued and pushed audio is discarded
+  virtual void SetFlush(bool flush) = 0;
+
+  // Format of the buffers pushed from now on. Audio that is already queued
+  // is read in the new format too, so this should only change between
+  // streams, i.e. when the caps change.
+  virtual void SetSampleFormat(SampleFormat format) = 0;
+
+  // Limits the amount of queued audio, 0 means unlimited
+  virtual void SetQueueLimit(size_t max_queued_samples,
+                             QueueOverflowPolicy policy) = 0;
+
+  // Number of samples (at the input rate) pushed but not yet read by
+  // the decoder
+  virtual size_t NumSamplesQueued() = 0;
+
+  virtual ~GstAudioSource();
+
+ protected:
+  // Same as Read(), but at the input sample rate
+  virtual bool ReadSamples(Vector<BaseFloat> *data) = 0;
+
+  // True if ReadSamples() of num_samples samples would return without
+  // waiting
+  virtual bool CanReadSamples(size_t num_samples) = 0;
+
+ private:
+  void UpdateResampler();
+
+  // Requested configuration, set from the streaming thread
+  GMutex resample_lock_;
+  std::atomic<bool> resample_changed_;
+  int32 input_rate_;
+  int32 output_rate_;
+  ResampleQuality quality_;
+
+  // NULL when no resampling is needed
+  LinearResample *resampler_;
+  // input samples per output sample
+  double resample_ratio_;
+  // input samples that the filter needs beyond the output
+  int32 resample_delay_;
+  // Resampled audio that didn't fit into the previous Read(); a std::vector
+  // keeps its memory when it shrinks and grows again
+  std::vector<BaseFloat> resampled_;
+  // Scratch buffers of Read(), kept so that chunks of the same size don't
+  // allocate
+  Vector<BaseFloat> resample_input_;
+  Vector<BaseFloat> resample_output_;
+  bool input_ended_;
+};
+
+// OnlineAudioSourceItf implementation using a queue of Gst Buffers
+class GstBufferSource : public GstAudioSource {
+ public:
+  GstBufferSource();
+
   void PushBuffer(GstBuffer *buf);
 
   void SetEnded(bool ended);
 
   void SetFlush(bool flush);
 
+  void SetSampleFormat(SampleFormat format);
+
+  void SetQueueLimit(size_t max_queued_samples, QueueOverflowPolicy policy);
+
+  size_t NumSamplesQueued();
+
   ~GstBufferSource();
 
+ protected:
+  bool ReadSamples(Vector<BaseFloat> *data);
+
+  bool CanReadSamples(size_t num_samples);
+
  private:
 
   GAsyncQueue* buf_queue_;
   gint pos_in_current_buf_;
   GstBuffer *current_buffer_;
+  // scratch space for a sample that is split between two buffers
+  guint8 partial_sample_[kMaxSampleWidth];
+  gsize num_partial_bytes_;
   bool ended_;
   bool flush_;
+  // size of the buffers in buf_queue_
+  gsize queued_bytes_;
+  gsize max_queued_samples_;
+  QueueOverflowPolicy overflow_policy_;
+  SampleFormat sample_format_;
   GMutex lock_;
   GCond data_cond_;
+  GCond space_cond_;
   KALDI_DISALLOW_COPY_AND_ASSIGN(GstBufferSource);
 };
 
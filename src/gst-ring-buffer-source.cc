@@ -0,0 +1,293 @@
+// gst-plugin/gst-ring-buffer-source.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "./gst-ring-buffer-source.h"
+
+namespace kaldi {
+
+// Sleeps while *addr still holds the value 'expected'
+static void FutexWait(std::atomic<int32> *addr, int32 expected) {
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<int32*>(addr), FUTEX_WAIT_PRIVATE,
+          expected, NULL, NULL, 0);
+#else
+  if (addr->load() == expected) {
+    g_usleep(1000);
+  }
+#endif
+}
+
+static void FutexWake(std::atomic<int32> *addr) {
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<int32*>(addr), FUTEX_WAKE_PRIVATE,
+          1, NULL, NULL, 0);
+#endif
+}
+
+GstRingBufferSource::GstRingBufferSource(size_t min_capacity_in_bytes) :
+  write_pos_(0),
+  read_pos_(0),
+  skip_pos_(0),
+  max_queued_samples_(0),
+  overflow_policy_(kQueueOverflowBlock),
+  sample_format_(kSampleFormatS16LE),
+  consumer_target_(0),
+  producer_target_(0),
+  data_seq_(0),
+  space_seq_(0),
+  ended_(false),
+  flush_(false) {
+  capacity_ = kMaxSampleWidth;
+  while (capacity_ < min_capacity_in_bytes) {
+    capacity_ <<= 1;
+  }
+  mask_ = capacity_ - 1;
+  ring_ = new guint8[capacity_];
+}
+
+GstRingBufferSource::~GstRingBufferSource() {
+  delete[] ring_;
+}
+
+void GstRingBufferSource::WakeConsumer() {
+  data_seq_.fetch_add(1);
+  FutexWake(&data_seq_);
+}
+
+void GstRingBufferSource::WakeProducer() {
+  space_seq_.fetch_add(1);
+  FutexWake(&space_seq_);
+}
+
+void GstRingBufferSource::WaitForSpace(uint64 target, size_t max_queued_samples) {
+  int32 seq = space_seq_.load();
+  producer_target_.store(target);
+  // don't sleep if the queue limit was changed in the meantime
+  if (read_pos_.load() < target && !flush_.load()
+      && max_queued_samples_.load() == max_queued_samples) {
+    FutexWait(&space_seq_, seq);
+  }
+  producer_target_.store(0);
+}
+
+void GstRingBufferSource::PushBuffer(GstBuffer *buf) {
+  if (flush_.load()) {
+    return;
+  }
+  GstMapInfo map;
+  if (!gst_buffer_map(buf, &map, GST_MAP_READ)) {
+    KALDI_WARN << "Failed to map Gst buffer, dropping it";
+    return;
+  }
+  const guint8 *src = map.data;
+  size_t nbytes_left = map.size;
+  uint64 write_pos = write_pos_.load(std::memory_order_relaxed);
+
+  QueueOverflowPolicy policy =
+      static_cast<QueueOverflowPolicy>(overflow_policy_.load());
+  size_t width = SampleWidth(static_cast<SampleFormat>(sample_format_.load()));
+  size_t max_queued_samples = max_queued_samples_.load();
+  size_t max_queued_bytes = max_queued_samples * width;
+  if (max_queued_bytes > 0 && policy != kQueueOverflowBlock) {
+    // the ring can't hold more than its capacity, whatever the limit
+    max_queued_bytes = std::min(max_queued_bytes, capacity_);
+    uint64 nbytes_queued = write_pos - std::max(read_pos_.load(), skip_pos_.load());
+    if (nbytes_queued + nbytes_left > max_queued_bytes) {
+      if (policy == kQueueOverflowDropNewest) {
+        gst_buffer_unmap(buf, &map);
+        return;
+      }
+      // kQueueOverflowDropOldest: keep only the newest max_queued_bytes,
+      // aligned to the sample boundaries of the ring
+      uint64 skip_pos = write_pos + nbytes_left - max_queued_bytes;
+      skip_pos += (width - skip_pos % width) % width;
+      if (skip_pos > skip_pos_.load()) {
+        skip_pos_.store(skip_pos);
+        // the space before skip_pos_ is overwritten only after the consumer
+        // can see that it was dropped
+        std::atomic_thread_fence(std::memory_order_release);
+      }
+    }
+  }
+
+  while (nbytes_left > 0 && !flush_.load()) {
+    // The ring has to have room for the new samples. With the dropping
+    // policies, the audio before skip_pos_ is gone even if the decoder
+    // hasn't caught up yet, so its space is reused.
+    size_t limit = capacity_;
+    max_queued_samples = max_queued_samples_.load();
+    max_queued_bytes = max_queued_samples * width;
+    uint64 queue_start = read_pos_.load();
+    if (overflow_policy_.load() == kQueueOverflowBlock) {
+      if (max_queued_bytes > 0 && max_queued_bytes < capacity_) {
+        limit = max_queued_bytes;
+      }
+    } else {
+      queue_start = std::max(queue_start, skip_pos_.load());
+    }
+    if (write_pos >= queue_start + limit) {
+      // Sleep until the decoder has made room for the rest of this buffer
+      // (or for the whole queue, whichever is smaller)
+      WaitForSpace(write_pos - limit + std::min(nbytes_left, limit), max_queued_samples);
+      continue;
+    }
+
+    size_t nbytes = std::min(static_cast<uint64>(nbytes_left),
+                             queue_start + limit - write_pos);
+    size_t offset = write_pos & mask_;
+    size_t nbytes_until_wrap = std::min(nbytes, capacity_ - offset);
+    memcpy(ring_ + offset, src, nbytes_until_wrap);
+    memcpy(ring_, src + nbytes_until_wrap, nbytes - nbytes_until_wrap);
+    src += nbytes;
+    nbytes_left -= nbytes;
+    write_pos += nbytes;
+    write_pos_.store(write_pos);
+
+    uint64 target = consumer_target_.load();
+    if (target != 0 && write_pos >= target) {
+      WakeConsumer();
+    }
+  }
+  gst_buffer_unmap(buf, &map);
+}
+
+void GstRingBufferSource::SetQueueLimit(size_t max_queued_samples,
+                                        QueueOverflowPolicy policy) {
+  overflow_policy_.store(policy);
+  max_queued_samples_.store(max_queued_samples);
+  WakeProducer();
+}
+
+size_t GstRingBufferSource::NumSamplesQueued() {
+  uint64 read_pos = std::max(read_pos_.load(), skip_pos_.load());
+  uint64 write_pos = write_pos_.load();
+  size_t width = SampleWidth(static_cast<SampleFormat>(sample_format_.load()));
+  return write_pos > read_pos ? (write_pos - read_pos) / width : 0;
+}
+
+bool GstRingBufferSource::CanReadSamples(size_t num_samples) {
+  return ended_.load() || flush_.load() || NumSamplesQueued() >= num_samples;
+}
+
+void GstRingBufferSource::SetEnded(bool ended) {
+  ended_.store(ended);
+  WakeConsumer();
+}
+
+void GstRingBufferSource::SetFlush(bool flush) {
+  flush_.store(flush);
+  WakeConsumer();
+  WakeProducer();
+}
+
+void GstRingBufferSource::SetSampleFormat(SampleFormat format) {
+  sample_format_.store(format);
+}
+
+bool GstRingBufferSource::ReadSamples(Vector<BaseFloat> *data) {
+  SampleFormat format = static_cast<SampleFormat>(sample_format_.load());
+  size_t width = SampleWidth(format);
+  uint64 nbytes_req = data->Dim() * width;
+  uint64 read_pos = read_pos_.load(std::memory_order_relaxed);
+  uint32 nsamples_req = data->Dim();
+  uint32 nsamples_received;
+
+  while (true) {
+    uint64 nbytes_available;
+    while (true) {
+      if (flush_.load()) {
+        // discard everything that has been pushed so far
+        read_pos = write_pos_.load();
+        read_pos_.store(read_pos);
+        WakeProducer();
+      }
+      uint64 skip_pos = skip_pos_.load();
+      if (skip_pos > read_pos) {
+        // the producer has dropped the oldest audio
+        read_pos = std::min(skip_pos, write_pos_.load());
+        read_pos_.store(read_pos);
+        WakeProducer();
+      }
+      nbytes_available = write_pos_.load() - read_pos;
+      if (nbytes_available >= nbytes_req || ended_.load()) {
+        break;
+      }
+      int32 seq = data_seq_.load();
+      consumer_target_.store(read_pos + nbytes_req);
+      if (write_pos_.load() - read_pos < nbytes_req && !ended_.load()) {
+        FutexWait(&data_seq_, seq);
+      }
+      consumer_target_.store(0);
+    }
+
+    uint64 start_pos = read_pos;
+    nsamples_received = std::min(nbytes_available, nbytes_req) / width;
+    BaseFloat *out = data->Data();
+    uint32 i = 0;
+    while (i < nsamples_received) {
+      size_t offset = read_pos & mask_;
+      size_t nbytes_until_wrap = capacity_ - offset;
+      if (nbytes_until_wrap < width) {
+        // the sample is split between the end and the start of the ring
+        guint8 sample[kMaxSampleWidth];
+        for (size_t j = 0; j < width; j++) {
+          sample[j] = ring_[(read_pos + j) & mask_];
+        }
+        ConvertSamples(format, sample, 1, out + i);
+        i++;
+        read_pos += width;
+        continue;
+      }
+      uint32 nsamples = std::min(static_cast<size_t>(nsamples_received - i),
+                                 nbytes_until_wrap / width);
+      ConvertSamples(format, ring_ + offset, nsamples, out + i);
+      i += nsamples;
+      read_pos += nsamples * width;
+    }
+
+    // skip_pos_ decides what is still queued: if the producer dropped
+    // some of these samples while they were converted, their space may
+    // have been overwritten, so they are read again from skip_pos_ on
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (skip_pos_.load() <= start_pos) {
+      break;
+    }
+    read_pos = start_pos;
+  }
+  read_pos_.store(read_pos);
+
+  uint64 target = producer_target_.load();
+  if (target != 0 && read_pos >= target) {
+    WakeProducer();
+  }
+
+  if (nsamples_received < nsamples_req) {
+    data->Resize(nsamples_received, kCopyData);
+  }
+  return !(ended_.load()
+      && (write_pos_.load() - read_pos < width));
+}
+}
@@ -0,0 +1,102 @@
+// gst-plugin/gst-ring-buffer-source.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_GST_RING_BUFFER_SOURCE_H_
+#define KALDI_SRC_GST_RING_BUFFER_SOURCE_H_
+
+#include <atomic>
+
+#include "./gst-audio-source.h"
+
+namespace kaldi {
+
+
+// Audio source that keeps the samples in a lock-free single-producer/
+// single-consumer ring. The streaming thread (producer) copies the buffer
+// contents into the ring, the decoding task (consumer) converts directly from
+// the ring. Neither side takes a lock; a side only sleeps (on a futex) when it
+// cannot make progress, and is only woken when the other side has made enough
+// progress for it to continue. When the ring (or the queue limit) is full,
+// PushBuffer() blocks until the decoder has consumed enough audio, unless
+// a dropping overflow policy is set.
+class GstRingBufferSource : public GstAudioSource {
+ public:
+  // The capacity is rounded up to a power of two
+  explicit GstRingBufferSource(size_t min_capacity_in_bytes);
+
+  void PushBuffer(GstBuffer *buf);
+
+  void SetEnded(bool ended);
+
+  void SetFlush(bool flush);
+
+  void SetSampleFormat(SampleFormat format);
+
+  void SetQueueLimit(size_t max_queued_samples, QueueOverflowPolicy policy);
+
+  size_t NumSamplesQueued();
+
+  ~GstRingBufferSource();
+
+ protected:
+  bool ReadSamples(Vector<BaseFloat> *data);
+
+  bool CanReadSamples(size_t num_samples);
+
+ private:
+  void WakeConsumer();
+  void WakeProducer();
+
+  // Blocks the producer until read_pos_ has reached 'target'
+  void WaitForSpace(uint64 target, size_t max_queued_samples);
+
+  guint8 *ring_;
+  size_t capacity_;
+  size_t mask_;
+
+  // Monotonic byte counters, each one is only advanced by one side
+  std::atomic<uint64> write_pos_;
+  std::atomic<uint64> read_pos_;
+
+  // With kQueueOverflowDropOldest the producer cannot move read_pos_ itself,
+  // it asks the consumer to skip everything before skip_pos_ instead. The
+  // producer may then overwrite the space before skip_pos_, so the consumer
+  // drops whatever it was reading when skip_pos_ passes it
+  std::atomic<uint64> skip_pos_;
+
+  std::atomic<size_t> max_queued_samples_;
+  std::atomic<int32> overflow_policy_;
+  std::atomic<int32> sample_format_;
+
+  // Positions the sleeping side is waiting for (0 when not sleeping):
+  // the consumer waits until write_pos_ reaches consumer_target_, the
+  // producer until read_pos_ reaches producer_target_
+  std::atomic<uint64> consumer_target_;
+  std::atomic<uint64> producer_target_;
+
+  // Futex words, bumped before every wakeup
+  std::atomic<int32> data_seq_;
+  std::atomic<int32> space_seq_;
+
+  std::atomic<bool> ended_;
+  std::atomic<bool> flush_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(GstRingBufferSource);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_GST_RING_BUFFER_SOURCE_H_
@@ -49,6 +49,13 @@
 
 #include "./kaldimarshal.h"
 #include "./gstkaldinnet2onlinedecoder.h"
+#include "./gstkaldinnet2onlinedecodermulti.h"
+#include "./model-registry.h"
+#include "./compute-budget.h"
+#include "./result-writer.h"
+#include "./lattice-analysis.h"
+#include "./lattice-nbest.h"
+#include "./nnet3-int8.h"
 
 #include "fstext/fstext-lib.h"
 #include "lat/sausages.h"
@@ -58,17 +65,12 @@
 
 #include <fst/script/project.h>
 
+#include <algorithm>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <string>
 
-#include <jansson.h>
-
-/* JSON_REAL_PRECISION is a macro from libjansson 2.7. Ubuntu 12.04 only has 2.2.1-1 */
-#ifndef JSON_REAL_PRECISION
-#define JSON_REAL_PRECISION(n)  (((n) & 0x1F) << 11)
-#endif // JSON_REAL_PRECISION
-
 
 namespace kaldi {
 
@@ -80,6 +82,7 @@ enum {
   PARTIAL_RESULT_SIGNAL,
   FINAL_RESULT_SIGNAL,
   FULL_FINAL_RESULT_SIGNAL,
+  FULL_FINAL_RESULT_BYTES_SIGNAL,
   LAST_SIGNAL
 };
 
@@ -108,6 +111,27 @@ enum {
   PROP_ALIGN_LEXICON_FILE,
   PROP_MIN_WORDS_FOR_IVECTOR,
   PROP_RESCORE_SOCKET,
+  PROP_USE_LOCKFREE_AUDIO_SOURCE,
+  PROP_MAX_QUEUED_AUDIO_SECS,
+  PROP_QUEUE_OVERFLOW_POLICY,
+  PROP_QUEUED_AUDIO_SECS,
+  PROP_RESAMPLE_QUALITY,
+  PROP_USE_VAD,
+  PROP_VAD_ENERGY_THRESHOLD,
+  PROP_VAD_HANGOVER_SECS,
+  PROP_SHARE_MODELS,
+  PROP_MODEL_REGISTRY_STATS,
+  PROP_MMAP_FST,
+  PROP_ASYNC_MODEL_LOADING,
+  PROP_MAX_DECODER_LAG_FRAMES,
+  PROP_DECODER_LAG_FRAMES,
+  PROP_INCREMENTAL_LATTICE,
+  PROP_POSTPROCESS_IN_THREAD,
+  PROP_BATCH_SCORING,
+  PROP_USE_WORKER_POOL,
+  PROP_COMPUTE_BUDGET_STATS,
+  PROP_CPU_AFFINITY,
+  PROP_RESULT_FORMAT,
   PROP_LAST
 };
 
@@ -127,6 +151,24 @@ enum {
 #define DEFAULT_NUM_PHONE_ALIGNMENT 1
 #define DEFAULT_MIN_WORDS_FOR_IVECTOR 2
 #define DEFAULT_RESCORE_SOCKET ""
+#define DEFAULT_CPU_AFFINITY ""
+#define DEFAULT_RESULT_FORMAT kResultFormatJson
+#define DEFAULT_USE_LOCKFREE_AUDIO_SOURCE false
+#define LOCKFREE_AUDIO_SOURCE_LENGTH_IN_SECS 30
+#define DEFAULT_MAX_QUEUED_AUDIO_SECS 0.0
+#define DEFAULT_QUEUE_OVERFLOW_POLICY kQueueOverflowBlock
+#define DEFAULT_RESAMPLE_QUALITY kResampleQualityMedium
+#define DEFAULT_USE_VAD false
+#define DEFAULT_VAD_ENERGY_THRESHOLD 45.0
+#define DEFAULT_VAD_HANGOVER_SECS 0.5
+#define DEFAULT_SHARE_MODELS true
+#define DEFAULT_MMAP_FST false
+#define DEFAULT_ASYNC_MODEL_LOADING false
+#define DEFAULT_MAX_DECODER_LAG_FRAMES 100
+#define DEFAULT_INCREMENTAL_LATTICE false
+#define DEFAULT_POSTPROCESS_IN_THREAD false
+#define DEFAULT_BATCH_SCORING false
+#define DEFAULT_USE_WORKER_POOL false
 
 /**
  * Some structs used for storing recognition results
@@ -177,7 +219,7 @@ GST_STATIC_PAD_TEMPLATE("sink",
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS(
         "audio/x-raw, "
-        "format = (string) S16LE, "
+        "format = (string) { S16LE, S32LE, F32LE }, "
         "channels = (int) 1, "
         "rate = (int) [ 1, MAX ]"));
 
@@ -217,7 +259,21 @@ static void gst_kaldinnet2onlinedecoder_load_word_boundary_info(Gstkaldinnet2onl
 static void gst_kaldinnet2onlinedecoder_load_align_lexicon_info(Gstkaldinnet2onlinedecoder * filter,
                                                                 const GValue * value);
 
-static void gst_kaldinnet2onlinedecoder_reset_cmvn_state(Gstkaldinnet2onlinedecoder * filter);
+static OnlineCmvnState *gst_kaldinnet2onlinedecoder_initial_cmvn_state(
+    Gstkaldinnet2onlinedecoder * filter);
+
+static void gst_kaldinnet2onlinedecoder_release_models(const ModelSnapshot * models);
+
+static int gst_kaldinnet2onlinedecoder_input_rate(Gstkaldinnet2onlinedecoder * filter);
+
+static void gst_kaldinnet2onlinedecoder_set_queue_limit(Gstkaldinnet2onlinedecoder * filter);
+
+static void gst_kaldinnet2onlinedecoder_set_resampling(Gstkaldinnet2onlinedecoder * filter,
+                                                       GstAudioSource *audio_source);
+
+static bool gst_kaldinnet2onlinedecoder_postpone_load(Gstkaldinnet2onlinedecoder * filter,
+                                                      const gchar * name,
+                                                      const GValue * value);
 
 static void gst_kaldinnet2onlinedecoder_set_property(GObject * object,
                                                      guint prop_id,
@@ -419,7 +475,7 @@ static void gst_kaldinnet2onlinedecoder_class_init(
       PROP_USE_THREADED_DECODER,
       g_param_spec_boolean(
           "use-threaded-decoder",
-          "Use a decoder that does feature calculation and decoding in separate threads (NB! must be set before other properties)",
+          "Use a decoder that does feature calculation (and for nnet3, neural network evaluation) and decoding in separate threads (NB! must be set before other properties)",
           "Whether to use a threaded decoder (NB! must be set before other properties)",
           DEFAULT_USE_THREADED_DECODER,
           (GParamFlags) G_PARAM_READWRITE));
@@ -465,6 +521,255 @@ static void gst_kaldinnet2onlinedecoder_class_init(
                           DEFAULT_RESCORE_SOCKET,
                           (GParamFlags) G_PARAM_READWRITE));
 
+  g_object_class_install_property(
+      gobject_class,
+      PROP_USE_LOCKFREE_AUDIO_SOURCE,
+      g_param_spec_boolean(
+          "use-lockfree-audio-source",
+          "Use a lock-free ring buffer for passing audio to the decoding task",
+          "Whether to pass audio from the streaming thread to the decoding task through a lock-free "
+          "single-producer/single-consumer ring buffer instead of a locked buffer queue. "
+          "Takes effect when the element goes to the READY state",
+          DEFAULT_USE_LOCKFREE_AUDIO_SOURCE,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_MAX_QUEUED_AUDIO_SECS,
+      g_param_spec_float(
+          "max-queued-audio-secs", "Maximum amount of audio waiting to be decoded",
+          "Maximum amount of audio (in seconds) that is queued for decoding, "
+          "0 means unlimited. What happens when the queue is full is determined by queue-overflow-policy",
+          0.0,
+          G_MAXFLOAT,
+          DEFAULT_MAX_QUEUED_AUDIO_SECS,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_QUEUE_OVERFLOW_POLICY,
+      g_param_spec_uint(
+          "queue-overflow-policy", "What to do when the audio queue is full",
+          "0: block the streaming thread until the decoder catches up (backpressure, for file sources), "
+          "1: drop the incoming audio, 2: drop the oldest queued audio (for live sources)",
+          kQueueOverflowBlock,
+          kQueueOverflowDropOldest,
+          DEFAULT_QUEUE_OVERFLOW_POLICY,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_QUEUED_AUDIO_SECS,
+      g_param_spec_float(
+          "queued-audio-secs", "Amount of audio waiting to be decoded",
+          "Amount of audio (in seconds) that has been received but not yet passed to the decoder",
+          0.0,
+          G_MAXFLOAT,
+          0.0,
+          (GParamFlags) G_PARAM_READABLE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_RESAMPLE_QUALITY,
+      g_param_spec_uint(
+          "resample-quality", "Resampling quality",
+          "Quality of the built-in resampler that is used when the input sample rate differs "
+          "from the rate of the models: 0 (fastest), 1 (medium) or 2 (best)",
+          kResampleQualityFast,
+          kResampleQualityHigh,
+          DEFAULT_RESAMPLE_QUALITY,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_USE_VAD,
+      g_param_spec_boolean(
+          "use-vad", "Skip silence using an energy-based VAD",
+          "Whether to drop long stretches of silence (detected by signal energy) "
+          "before feature extraction. A silence that is longer than vad-hangover-secs "
+          "ends the current segment. Segment timestamps still refer to the original audio",
+          DEFAULT_USE_VAD,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_VAD_ENERGY_THRESHOLD,
+      g_param_spec_float(
+          "vad-energy-threshold", "VAD energy threshold",
+          "Energy of a 10 ms frame (in dB, relative to 16-bit samples) above which the frame is considered speech",
+          0.0,
+          200.0,
+          DEFAULT_VAD_ENERGY_THRESHOLD,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_VAD_HANGOVER_SECS,
+      g_param_spec_float(
+          "vad-hangover-secs", "Amount of silence kept around speech",
+          "Amount of silence (in seconds) before and after speech that is still decoded when use-vad is enabled; "
+          "at least one 10 ms frame",
+          0.01,
+          G_MAXFLOAT,
+          DEFAULT_VAD_HANGOVER_SECS,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_SHARE_MODELS,
+      g_param_spec_boolean(
+          "share-models",
+          "Share models with other decoders in the same process (NB! must be set before the model properties)",
+          "Whether to share the acoustic model, FST, word symbols and the big LM with other decoder elements "
+          "in the same process that use the same files and options (NB! must be set before the model properties)",
+          DEFAULT_SHARE_MODELS,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_MODEL_REGISTRY_STATS,
+      g_param_spec_string(
+          "model-registry-stats", "Statistics of the process-wide model registry",
+          "Number of shared model objects, cache hits and misses, bytes loaded and bytes saved by sharing, in JSON",
+          "",
+          (GParamFlags) G_PARAM_READABLE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_MMAP_FST,
+      g_param_spec_boolean(
+          "mmap-fst",
+          "Memory-map the decoding graph instead of reading it (NB! must be set before the fst property)",
+          "Whether to memory-map the decoding graph, so that loading is almost instant and the graph is "
+          "shared between processes through the page cache. The FST must be converted to an aligned const FST first: "
+          "fstconvert --fst_type=const --fst_align HCLG.fst HCLG.const.fst "
+          "(NB! must be set before the fst property)",
+          DEFAULT_MMAP_FST,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_ASYNC_MODEL_LOADING,
+      g_param_spec_boolean(
+          "async-model-loading",
+          "Load models in parallel when going to READY (NB! must be set before the model properties)",
+          "If true, the model, fst, word-syms, lm-fst and big-lm-const-arpa properties only record the "
+          "filenames while the element is in the NULL state. The files are then loaded in parallel during "
+          "the NULL to READY state change, which returns when all of them are loaded. A 'model-load-times' "
+          "element message with the loading time of each file (in seconds) is posted on the bus "
+          "(NB! must be set before the model properties)",
+          DEFAULT_ASYNC_MODEL_LOADING,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_MAX_DECODER_LAG_FRAMES,
+      g_param_spec_uint(
+          "max-decoder-lag-frames", "Maximum decoder lag before checking for an endpoint",
+          "With the threaded decoder, endpoint detection waits until at most this many "
+          "frames (of 10 ms) of the received audio are not decoded yet",
+          0,
+          G_MAXINT,
+          DEFAULT_MAX_DECODER_LAG_FRAMES,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_DECODER_LAG_FRAMES,
+      g_param_spec_uint(
+          "decoder-lag-frames", "Decoder lag",
+          "Number of frames (of 10 ms) of received audio that the threaded decoder had not "
+          "decoded yet at the last endpoint check",
+          0,
+          G_MAXINT,
+          0,
+          (GParamFlags) G_PARAM_READABLE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_INCREMENTAL_LATTICE,
+      g_param_spec_boolean(
+          "incremental-lattice",
+          "Determinize the lattice in chunks during decoding (nnet3, non-threaded decoder only)",
+          "Whether to determinize the lattice incrementally, which makes the final result "
+          "faster after long utterances; see determinize-max-delay and determinize-min-chunk-size",
+          DEFAULT_INCREMENTAL_LATTICE,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_POSTPROCESS_IN_THREAD,
+      g_param_spec_boolean(
+          "postprocess-in-thread",
+          "Produce final results (rescoring, n-best lists, alignments) in a separate thread",
+          "Whether to produce the final result of a segment in a separate thread while the "
+          "next segment is decoded; results are still emitted in order",
+          DEFAULT_POSTPROCESS_IN_THREAD,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_BATCH_SCORING,
+      g_param_spec_boolean(
+          "batch-scoring",
+          "Evaluate the nnet3 model in batches with other decoders (NB! must be set before the model property)",
+          "Whether the decoders in this process that share the nnet3 model evaluate it together: "
+          "chunks of frames-per-chunk frames from all streams are stacked into minibatches of up to "
+          "batch-minibatch-size chunks, waiting at most batch-max-wait-ms for a full one. "
+          "Only used by the non-threaded decoder, not together with incremental-lattice "
+          "(NB! must be set before the model property)",
+          DEFAULT_BATCH_SCORING,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_USE_WORKER_POOL,
+      g_param_spec_boolean(
+          "use-worker-pool",
+          "Decode on a process-wide pool of worker threads",
+          "Whether to decode on a pool of worker threads (one per CPU core) that is shared by all "
+          "decoder elements in the process, instead of in a thread of its own. A stream only "
+          "occupies a worker while it has audio to decode (NB! must be set before the element starts)",
+          DEFAULT_USE_WORKER_POOL,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_COMPUTE_BUDGET_STATS,
+      g_param_spec_string(
+          "compute-budget-stats", "Statistics of the process-wide compute budget",
+          "Maximum number of decoding steps at a time (GST_KALDI_MAX_COMPUTE_THREADS, 0 if "
+          "unlimited), steps running and waiting now, steps started and the total time they "
+          "have waited, in JSON",
+          "",
+          (GParamFlags) G_PARAM_READABLE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_CPU_AFFINITY,
+      g_param_spec_string(
+          "cpu-affinity",
+          "CPUs to decode on, like 0-7,16-23 (NB! must be set before the model and fst properties)",
+          "CPUs that the decoding thread and the threads it starts are pinned to, like 0-7,16-23; "
+          "empty for no pinning. The acoustic model and the decoding graph are loaded by a thread "
+          "pinned to the same CPUs, so that their memory is on the same NUMA node(s); elements on "
+          "different nodes get their own copies. Not used with use-worker-pool "
+          "(NB! must be set before the model and fst properties)",
+          DEFAULT_CPU_AFFINITY,
+          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_RESULT_FORMAT,
+      g_param_spec_uint(
+          "result-format", "Encoding of the full final results",
+          "0: JSON, emitted with the full-final-result signal, "
+          "1: CBOR (RFC 7049) with the same structure, emitted with the full-final-result-bytes signal",
+          kResultFormatJson,
+          kResultFormatCbor,
+          DEFAULT_RESULT_FORMAT,
+          (GParamFlags) G_PARAM_READWRITE));
+
   gst_kaldinnet2onlinedecoder_signals[PARTIAL_RESULT_SIGNAL] = g_signal_new(
       "partial-result", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
       G_STRUCT_OFFSET(Gstkaldinnet2onlinedecoderClass, partial_result),
@@ -487,6 +792,13 @@ static void gst_kaldinnet2onlinedecoder_class_init(
       NULL, kaldi_marshal_VOID__STRING, G_TYPE_NONE, 1,
       G_TYPE_STRING);
 
+  gst_kaldinnet2onlinedecoder_signals[FULL_FINAL_RESULT_BYTES_SIGNAL] = g_signal_new(
+      "full-final-result-bytes", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET(Gstkaldinnet2onlinedecoderClass, full_final_result_bytes),
+      NULL,
+      NULL, kaldi_marshal_VOID__BOXED, G_TYPE_NONE, 1,
+      G_TYPE_BYTES);
+
   gst_element_class_set_details_simple(
       gstelement_class, "KaldiNNet2OnlineDecoder", "Speech/Audio",
       "Convert speech to text", "Tanel Alumae <tanel.alumae@phon.ioc.ee>");
@@ -512,10 +824,20 @@ static void gst_kaldinnet2onlinedecoder_init(
   double tmp_double;
   std::string tmp_string;
 
-  filter->trans_model = NULL;
-  filter->am_nnet2 = NULL;
-  filter->am_nnet3 = NULL;
-  filter->decode_fst = NULL;
+  filter->share_models = DEFAULT_SHARE_MODELS;
+  filter->models = new std::shared_ptr<const ModelSnapshot>(
+      new ModelSnapshot(), gst_kaldinnet2onlinedecoder_release_models);
+  g_mutex_init(&filter->models_lock);
+  filter->pinned_models = NULL;
+  filter->pinned_snapshot = NULL;
+  filter->postprocess_in_thread = DEFAULT_POSTPROCESS_IN_THREAD;
+  filter->postprocessor = NULL;
+  filter->postprocessing_queue = NULL;
+  g_mutex_init(&filter->postprocessing_lock);
+  g_cond_init(&filter->postprocessing_cond);
+  filter->num_pending_results = 0;
+  filter->result_info = NULL;
+  g_mutex_init(&filter->adaptation_state_lock);
 
   filter->sinkpad = NULL;
 
@@ -539,6 +861,13 @@ static void gst_kaldinnet2onlinedecoder_init(
   filter->last_conf = 0;
   filter->model_rspecifier = g_strdup(DEFAULT_MODEL);
   filter->fst_rspecifier = g_strdup(DEFAULT_FST);
+  filter->mmap_fst = DEFAULT_MMAP_FST;
+  filter->batch_scoring = DEFAULT_BATCH_SCORING;
+  filter->async_model_loading = DEFAULT_ASYNC_MODEL_LOADING;
+  filter->pending_loads = NULL;
+  filter->max_decoder_lag_frames = DEFAULT_MAX_DECODER_LAG_FRAMES;
+  filter->decoder_lag_frames = 0;
+  filter->incremental_lattice = DEFAULT_INCREMENTAL_LATTICE;
   filter->word_syms_filename = g_strdup(DEFAULT_WORD_SYMS);
   filter->phone_syms_filename = g_strdup(DEFAULT_PHONE_SYMS);
   filter->word_boundary_info_filename = g_strdup(DEFAULT_WORD_BOUNDARY_FILE);
@@ -553,13 +882,30 @@ static void gst_kaldinnet2onlinedecoder_init(
   filter->feature_config = new OnlineNnet2FeaturePipelineConfig();
   filter->nnet2_decoding_config = new OnlineNnet2DecodingConfig();
   filter->nnet2_decoding_threaded_config = new OnlineNnet2DecodingThreadedConfig();
+  filter->nnet3_decoding_threaded_config = new OnlineNnet3DecodingThreadedConfig();
+  filter->batch_scorer_config = new NnetBatchScorerConfig();
   filter->nnet3_decodable_opts = new nnet3::NnetSimpleLoopedComputationOptions();
   filter->decoder_opts = new LatticeFasterDecoderConfig();
   filter->silence_weighting_config = new OnlineSilenceWeightingConfig();
+  filter->rtf_control_config = new RtfControlConfig();
+  filter->rtf_controller = NULL;
 
   filter->endpoint_config->Register(filter->simple_options);
   filter->feature_config->Register(filter->simple_options);
   filter->silence_weighting_config->Register(filter->simple_options);
+  filter->rtf_control_config->Register(filter->simple_options);
+  filter->nnet3_decoding_threaded_config->Register(filter->simple_options);
+  filter->batch_scorer_config->Register(filter->simple_options);
+  // the other options of the incremental decoder are shared with decoder_opts
+  filter->incremental_decoder_opts = new LatticeIncrementalDecoderConfig();
+  filter->simple_options->Register("determinize-max-delay",
+                                   &filter->incremental_decoder_opts->determinize_max_delay,
+                                   "Incremental lattice: maximum number of frames that "
+                                   "are decoded but not determinized yet");
+  filter->simple_options->Register("determinize-min-chunk-size",
+                                   &filter->incremental_decoder_opts->determinize_min_chunk_size,
+                                   "Incremental lattice: minimum number of frames "
+                                   "determinized at a time");
 
   // since the properties of the decoders overlap, they need to be set in the correct order
   // we'll redo this if the use-threaded-decoder property is changed
@@ -591,7 +937,19 @@ static void gst_kaldinnet2onlinedecoder_init(
   // will be set later
   filter->feature_info = NULL;
   filter->sample_rate = 0;
+  filter->input_sample_rate = 0;
+  filter->resample_quality = DEFAULT_RESAMPLE_QUALITY;
+  filter->use_vad = DEFAULT_USE_VAD;
+  filter->vad_energy_threshold = DEFAULT_VAD_ENERGY_THRESHOLD;
+  filter->vad_hangover_secs = DEFAULT_VAD_HANGOVER_SECS;
+  filter->vad = NULL;
+  filter->sample_format = kSampleFormatS16LE;
   filter->decoding = false;
+  filter->use_worker_pool = DEFAULT_USE_WORKER_POOL;
+  filter->stream = NULL;
+  filter->step_scheduled = false;
+  g_mutex_init(&filter->step_lock);
+  g_cond_init(&filter->step_cond);
   filter->lmwt_scale = DEFAULT_LMWT_SCALE;
   filter->inverse_scale = FALSE;
   filter->chunk_length_in_secs = DEFAULT_CHUNK_LENGTH_IN_SECS;
@@ -603,6 +961,13 @@ static void gst_kaldinnet2onlinedecoder_init(
   filter->num_nbest = DEFAULT_NUM_NBEST;
   filter->min_words_for_ivector = DEFAULT_MIN_WORDS_FOR_IVECTOR;
   filter->rescore_socket = DEFAULT_RESCORE_SOCKET;
+  filter->cpu_affinity_spec = g_strdup(DEFAULT_CPU_AFFINITY);
+  filter->cpu_affinity = new CpuAffinity();
+  filter->result_format = DEFAULT_RESULT_FORMAT;
+  filter->result_writer = new ResultWriter();
+  filter->use_lockfree_audio_source = DEFAULT_USE_LOCKFREE_AUDIO_SOURCE;
+  filter->max_queued_audio_secs = DEFAULT_MAX_QUEUED_AUDIO_SECS;
+  filter->queue_overflow_policy = DEFAULT_QUEUE_OVERFLOW_POLICY;
 
   // init properties from various Kaldi Opts
   GstElementClass * klass = GST_ELEMENT_GET_CLASS(filter);
@@ -726,13 +1091,16 @@ static void gst_kaldinnet2onlinedecoder_set_property(GObject * object,
       filter->silent = g_value_get_boolean(value);
       break;
     case PROP_MODEL:
-      gst_kaldinnet2onlinedecoder_load_model(filter, value);
+      if (!gst_kaldinnet2onlinedecoder_postpone_load(filter, "model", value))
+        gst_kaldinnet2onlinedecoder_load_model(filter, value);
       break;
     case PROP_FST:
-      gst_kaldinnet2onlinedecoder_load_fst(filter, value);
+      if (!gst_kaldinnet2onlinedecoder_postpone_load(filter, "fst", value))
+        gst_kaldinnet2onlinedecoder_load_fst(filter, value);
       break;
     case PROP_WORD_SYMS:
-      gst_kaldinnet2onlinedecoder_load_word_syms(filter, value);
+      if (!gst_kaldinnet2onlinedecoder_postpone_load(filter, "word-syms", value))
+        gst_kaldinnet2onlinedecoder_load_word_syms(filter, value);
       break;
     case PROP_PHONE_SYMS:
       gst_kaldinnet2onlinedecoder_load_phone_syms(filter, value);
@@ -756,10 +1124,12 @@ static void gst_kaldinnet2onlinedecoder_set_property(GObject * object,
       filter->traceback_period_in_secs = g_value_get_float(value);
       break;
     case PROP_LM_FST:
-      gst_kaldinnet2onlinedecoder_load_lm_fst(filter, value);
+      if (!gst_kaldinnet2onlinedecoder_postpone_load(filter, "lm-fst", value))
+        gst_kaldinnet2onlinedecoder_load_lm_fst(filter, value);
       break;
     case PROP_BIG_LM_CONST_ARPA:
-      gst_kaldinnet2onlinedecoder_load_big_lm(filter, value);
+      if (!gst_kaldinnet2onlinedecoder_postpone_load(filter, "big-lm-const-arpa", value))
+        gst_kaldinnet2onlinedecoder_load_big_lm(filter, value);
       break;
     case PROP_WORD_BOUNDARY_FILE:
       gst_kaldinnet2onlinedecoder_load_word_boundary_info(filter, value);
@@ -773,57 +1143,59 @@ static void gst_kaldinnet2onlinedecoder_set_property(GObject * object,
       break;
     case PROP_ADAPTATION_STATE:
       {
+        // Read into a copy: the decoding task and the post-processing thread
+        // use the current state under adaptation_state_lock
+        OnlineIvectorExtractorAdaptationState adaptation_state(
+            filter->feature_info->ivector_extractor_info);
         if (G_VALUE_HOLDS_STRING(value)) {
           gchar * adaptation_state_string = g_value_dup_string(value);
           if (strlen(adaptation_state_string) > 0) {
             std::istringstream str(adaptation_state_string);
             try {
-              filter->adaptation_state->Read(str, false);
+              adaptation_state.Read(str, false);
             } catch (std::runtime_error& e) {
               GST_WARNING_OBJECT(filter, "Failed to read adaptation state from given string, resetting instead");
-              delete filter->adaptation_state;
-              filter->adaptation_state = new OnlineIvectorExtractorAdaptationState(
+              adaptation_state = OnlineIvectorExtractorAdaptationState(
                   filter->feature_info->ivector_extractor_info);
             }
           } else {
             GST_DEBUG_OBJECT(filter, "Resetting adaptation state");
-            delete filter->adaptation_state;
-            filter->adaptation_state = new OnlineIvectorExtractorAdaptationState(
-                filter->feature_info->ivector_extractor_info);
           }
 		      g_free(adaptation_state_string);
         } else {
           GST_DEBUG_OBJECT(filter, "Resetting adaptation state");
-          delete filter->adaptation_state;
-          filter->adaptation_state = new OnlineIvectorExtractorAdaptationState(
-              filter->feature_info->ivector_extractor_info);
         }
+        g_mutex_lock(&filter->adaptation_state_lock);
+        *(filter->adaptation_state) = adaptation_state;
+        g_mutex_unlock(&filter->adaptation_state_lock);
       }
       break;
     case PROP_CMVN_STATE:
       {
+        OnlineCmvnState *cmvn_state = NULL;
         if (G_VALUE_HOLDS_STRING(value)) {
           gchar * cmvn_state_string = g_value_dup_string(value);
           if (strlen(cmvn_state_string) > 0) {
             std::istringstream str(cmvn_state_string);
+            cmvn_state = new OnlineCmvnState();
             try {
-              filter->cmvn_state->Read(str, false);
+              cmvn_state->Read(str, false);
             } catch (std::runtime_error& e) {
               GST_WARNING_OBJECT(filter, "Failed to read CMVN state from given string, resetting instead");
-              delete filter->cmvn_state;
-              gst_kaldinnet2onlinedecoder_reset_cmvn_state(filter);
+              delete cmvn_state;
+              cmvn_state = NULL;
             }
-          } else {
-            GST_DEBUG_OBJECT(filter, "Resetting CMVN state");
-            delete filter->cmvn_state;
-            gst_kaldinnet2onlinedecoder_reset_cmvn_state(filter);
           }
 		      g_free(cmvn_state_string);
-        } else {
+        }
+        if (cmvn_state == NULL) {
           GST_DEBUG_OBJECT(filter, "Resetting CMVN state");
-          delete filter->cmvn_state;
-          gst_kaldinnet2onlinedecoder_reset_cmvn_state(filter);
+          cmvn_state = gst_kaldinnet2onlinedecoder_initial_cmvn_state(filter);
         }
+        g_mutex_lock(&filter->adaptation_state_lock);
+        *(filter->cmvn_state) = *cmvn_state;
+        g_mutex_unlock(&filter->adaptation_state_lock);
+        delete cmvn_state;
       }
       break;
     case PROP_NUM_NBEST:
@@ -847,6 +1219,67 @@ static void gst_kaldinnet2onlinedecoder_set_property(GObject * object,
                                                      &gst_kaldinnet2onlinedecoder_rescore_remote_log);
       }
       break;
+    case PROP_USE_LOCKFREE_AUDIO_SOURCE:
+      filter->use_lockfree_audio_source = g_value_get_boolean(value);
+      break;
+    case PROP_MAX_QUEUED_AUDIO_SECS:
+      filter->max_queued_audio_secs = g_value_get_float(value);
+      gst_kaldinnet2onlinedecoder_set_queue_limit(filter);
+      break;
+    case PROP_QUEUE_OVERFLOW_POLICY:
+      filter->queue_overflow_policy = g_value_get_uint(value);
+      gst_kaldinnet2onlinedecoder_set_queue_limit(filter);
+      break;
+    case PROP_RESAMPLE_QUALITY:
+      filter->resample_quality = g_value_get_uint(value);
+      if (filter->audio_source) {
+        gst_kaldinnet2onlinedecoder_set_resampling(filter, filter->audio_source);
+      }
+      break;
+    case PROP_USE_VAD:
+      filter->use_vad = g_value_get_boolean(value);
+      break;
+    case PROP_VAD_ENERGY_THRESHOLD:
+      filter->vad_energy_threshold = g_value_get_float(value);
+      break;
+    case PROP_VAD_HANGOVER_SECS:
+      filter->vad_hangover_secs = g_value_get_float(value);
+      break;
+    case PROP_SHARE_MODELS:
+      filter->share_models = g_value_get_boolean(value);
+      break;
+    case PROP_MMAP_FST:
+      filter->mmap_fst = g_value_get_boolean(value);
+      break;
+    case PROP_RESULT_FORMAT:
+      filter->result_format = g_value_get_uint(value);
+      break;
+    case PROP_CPU_AFFINITY:
+      if (filter->cpu_affinity->Parse(g_value_get_string(value) ? g_value_get_string(value) : "")) {
+        g_free(filter->cpu_affinity_spec);
+        filter->cpu_affinity_spec = g_value_dup_string(value);
+      } else {
+        GST_WARNING_OBJECT(filter, "Invalid CPU list %s. Ignoring it.", g_value_get_string(value));
+      }
+      break;
+    case PROP_BATCH_SCORING:
+      filter->batch_scoring = g_value_get_boolean(value);
+      break;
+    case PROP_USE_WORKER_POOL:
+      filter->use_worker_pool = g_value_get_boolean(value);
+      break;
+    case PROP_ASYNC_MODEL_LOADING:
+      filter->async_model_loading = g_value_get_boolean(value);
+      break;
+    case PROP_MAX_DECODER_LAG_FRAMES:
+      filter->max_decoder_lag_frames = g_value_get_uint(value);
+      break;
+    case PROP_INCREMENTAL_LATTICE:
+      filter->incremental_lattice = g_value_get_boolean(value);
+      break;
+    case PROP_POSTPROCESS_IN_THREAD:
+      filter->postprocess_in_thread = g_value_get_boolean(value);
+      break;
     default:
       if (prop_id >= PROP_LAST) {
         const gchar* name = g_param_spec_get_name(pspec);
@@ -952,21 +1385,25 @@ static void gst_kaldinnet2onlinedecoder_get_property(GObject * object,
       break;
     case PROP_ADAPTATION_STATE:
       string_stream.clear();
+      g_mutex_lock(&filter->adaptation_state_lock);
       if (filter->adaptation_state) {
           filter->adaptation_state->Write(string_stream, false);
           g_value_set_string(value, string_stream.str().c_str());
       } else {
           g_value_set_string(value, "");
       }
+      g_mutex_unlock(&filter->adaptation_state_lock);
       break;
     case PROP_CMVN_STATE:
       string_stream.clear();
+      g_mutex_lock(&filter->adaptation_state_lock);
       if (filter->cmvn_state) {
           filter->cmvn_state->Write(string_stream, false);
           g_value_set_string(value, string_stream.str().c_str());
       } else {
           g_value_set_string(value, "");
       }
+      g_mutex_unlock(&filter->adaptation_state_lock);
       break;
     case PROP_NUM_NBEST:
       g_value_set_uint(value, filter->num_nbest);
@@ -980,6 +1417,108 @@ static void gst_kaldinnet2onlinedecoder_get_property(GObject * object,
     case PROP_RESCORE_SOCKET:
       g_value_set_string(value, filter->rescore_socket);
       break;
+    case PROP_CPU_AFFINITY:
+      g_value_set_string(value, filter->cpu_affinity_spec);
+      break;
+    case PROP_RESULT_FORMAT:
+      g_value_set_uint(value, filter->result_format);
+      break;
+    case PROP_USE_LOCKFREE_AUDIO_SOURCE:
+      g_value_set_boolean(value, filter->use_lockfree_audio_source);
+      break;
+    case PROP_MAX_QUEUED_AUDIO_SECS:
+      g_value_set_float(value, filter->max_queued_audio_secs);
+      break;
+    case PROP_QUEUE_OVERFLOW_POLICY:
+      g_value_set_uint(value, filter->queue_overflow_policy);
+      break;
+    case PROP_RESAMPLE_QUALITY:
+      g_value_set_uint(value, filter->resample_quality);
+      break;
+    case PROP_USE_VAD:
+      g_value_set_boolean(value, filter->use_vad);
+      break;
+    case PROP_VAD_ENERGY_THRESHOLD:
+      g_value_set_float(value, filter->vad_energy_threshold);
+      break;
+    case PROP_VAD_HANGOVER_SECS:
+      g_value_set_float(value, filter->vad_hangover_secs);
+      break;
+    case PROP_SHARE_MODELS:
+      g_value_set_boolean(value, filter->share_models);
+      break;
+    case PROP_MMAP_FST:
+      g_value_set_boolean(value, filter->mmap_fst);
+      break;
+    case PROP_BATCH_SCORING:
+      g_value_set_boolean(value, filter->batch_scoring);
+      break;
+    case PROP_USE_WORKER_POOL:
+      g_value_set_boolean(value, filter->use_worker_pool);
+      break;
+    case PROP_ASYNC_MODEL_LOADING:
+      g_value_set_boolean(value, filter->async_model_loading);
+      break;
+    case PROP_MAX_DECODER_LAG_FRAMES:
+      g_value_set_uint(value, filter->max_decoder_lag_frames);
+      break;
+    case PROP_DECODER_LAG_FRAMES:
+      g_value_set_uint(value, g_atomic_int_get(&filter->decoder_lag_frames));
+      break;
+    case PROP_INCREMENTAL_LATTICE:
+      g_value_set_boolean(value, filter->incremental_lattice);
+      break;
+    case PROP_POSTPROCESS_IN_THREAD:
+      g_value_set_boolean(value, filter->postprocess_in_thread);
+      break;
+    case PROP_MODEL_REGISTRY_STATS: {
+      ModelRegistry::Stats stats = ModelRegistry::Instance().GetStats();
+      ResultWriter writer;
+      writer.BeginObject();
+      writer.Key("num-objects");
+      writer.Integer(stats.num_objects);
+      writer.Key("num-hits");
+      writer.Integer(stats.num_hits);
+      writer.Key("num-misses");
+      writer.Integer(stats.num_misses);
+      writer.Key("bytes-loaded");
+      writer.Integer(stats.bytes_loaded);
+      writer.Key("bytes-saved");
+      writer.Integer(stats.bytes_saved);
+      writer.EndObject();
+      g_value_set_string(value, writer.Data().c_str());
+      break;
+    }
+    case PROP_COMPUTE_BUDGET_STATS: {
+      ComputeBudget::Stats stats = ComputeBudget::Instance().GetStats();
+      ResultWriter writer;
+      writer.BeginObject();
+      writer.Key("max-threads");
+      writer.Integer(stats.max_threads);
+      writer.Key("num-active");
+      writer.Integer(stats.num_active);
+      writer.Key("num-waiting");
+      writer.Integer(stats.num_waiting);
+      writer.Key("num-steps");
+      writer.Integer(stats.num_steps);
+      writer.Key("wait-secs");
+      writer.Real(stats.wait_secs);
+      writer.EndObject();
+      g_value_set_string(value, writer.Data().c_str());
+      break;
+    }
+    case PROP_QUEUED_AUDIO_SECS:
+      // the decoder replaces the source under the step lock
+      g_mutex_lock(&filter->step_lock);
+      if (filter->audio_source && filter->sample_rate > 0) {
+        g_value_set_float(value,
+            1.0 * filter->audio_source->NumSamplesQueued() /
+            gst_kaldinnet2onlinedecoder_input_rate(filter));
+      } else {
+        g_value_set_float(value, 0.0);
+      }
+      g_mutex_unlock(&filter->step_lock);
+      break;
     default:
       if (prop_id >= PROP_LAST) {
         const gchar* name = g_param_spec_get_name(pspec);
@@ -1020,24 +1559,9 @@ static void gst_kaldinnet2onlinedecoder_get_property(GObject * object,
   }
 }
 
-static BaseFloat gst_kaldinnet2onlinedecoder_get_conf(const CompactLattice &clat) {
-
-  MinimumBayesRiskOptions mbr_opts;
-  mbr_opts.decode_mbr = false;
-  MinimumBayesRisk mbr(clat, mbr_opts);
-  std::vector<BaseFloat> conf = mbr.GetOneBestConfidences();
-
-  BaseFloat res = 1;
-  for (size_t i = 0; i < conf.size(); i++) {
-      res = res * conf[i];
-  }
-
-  return res;
-}
-
 static std::vector<PhoneAlignmentInfo> gst_kaldinnet2onlinedecoder_phone_alignment(
-    Gstkaldinnet2onlinedecoder * filter, const std::vector<int32>& alignment, 
-    const CompactLattice &clat) {
+    Gstkaldinnet2onlinedecoder * filter, const std::vector<int32>& alignment,
+    LatticeAnalysis *analysis) {
 
   std::vector<PhoneAlignmentInfo> result;
 
@@ -1045,32 +1569,23 @@ static std::vector<PhoneAlignmentInfo> gst_kaldinnet2onlinedecoder_phone_alignme
 
   // Output the alignment with the weights
   std::vector<std::vector<int32> > split;
-  SplitToPhones(*filter->trans_model, alignment, &split);
+  SplitToPhones(filter->result_info->models->acoustic_model->trans_model, alignment, &split);
 
   GST_DEBUG_OBJECT(filter, "Split to phones finished");
 
   std::vector<int32> phones;
   for (size_t i = 0; i < split.size(); i++) {
     KALDI_ASSERT(split[i].size() > 0);
-    phones.push_back(filter->trans_model->TransitionIdToPhone(split[i][0]));
-  }
-  Lattice lat;
-  ConvertLattice(clat, &lat);
-  ConvertLatticeToPhones(*filter->trans_model, &lat);
-  CompactLattice phone_clat;
-  ConvertLattice(lat, &phone_clat);  
-  MinimumBayesRiskOptions mbr_opts;
-  mbr_opts.decode_mbr = false; // we just want confidences
-  mbr_opts.print_silence = false; 
-  MinimumBayesRisk *mbr = new MinimumBayesRisk(phone_clat, phones, mbr_opts);
-  std::vector<BaseFloat> confidences = mbr->GetOneBestConfidences();
-  delete mbr;
-  
+    phones.push_back(filter->result_info->models->acoustic_model->trans_model.TransitionIdToPhone(split[i][0]));
+  }
+  std::vector<BaseFloat> confidences;
+  analysis->PhoneConfidences(phones, &confidences);
+
   int32 current_start_frame = 0;
 
   for (size_t i = 0; i < split.size(); i++) {
     KALDI_ASSERT(split[i].size() > 0);
-    int32 phone = filter->trans_model->TransitionIdToPhone(split[i][0]);
+    int32 phone = filter->result_info->models->acoustic_model->trans_model.TransitionIdToPhone(split[i][0]);
 
     PhoneAlignmentInfo alignment_info;
     alignment_info.phone_id = phone;
@@ -1087,23 +1602,13 @@ static std::vector<PhoneAlignmentInfo> gst_kaldinnet2onlinedecoder_phone_alignme
 }
 
 static std::vector<WordAlignmentInfo>  gst_kaldinnet2onlinedecoder_word_alignment(
-    Gstkaldinnet2onlinedecoder * filter, const Lattice &lat,
-    std::vector<int32> &words, CompactLattice &full_clat) {
+    Gstkaldinnet2onlinedecoder * filter, const std::vector<int32> &words,
+    const LatticeAnalysis &analysis) {
   std::vector<WordAlignmentInfo> result;
-  CompactLattice clat, det_lat;
-  
-  CompactLattice aligned_clat;
-
-  ConvertLattice(lat, &clat);
-
-  MinimumBayesRiskOptions mbr_opts;
-  mbr_opts.decode_mbr = false; // we just want confidences
-  mbr_opts.print_silence = false; 
 
-  MinimumBayesRisk mbr = MinimumBayesRisk(full_clat, words, mbr_opts);
-  std::vector<BaseFloat> confidences = mbr.GetOneBestConfidences();
-
-  const std::vector<std::pair<BaseFloat, BaseFloat> > &times = mbr.GetOneBestTimes();
+  std::vector<BaseFloat> confidences;
+  std::vector<std::pair<BaseFloat, BaseFloat> > times;
+  analysis.WordConfidences(words, &confidences, &times);
 
   GST_DEBUG_OBJECT(filter, "Word alignment produced %lu words", words.size());
   KALDI_ASSERT(words.size() == times.size());
@@ -1153,7 +1658,7 @@ static std::string gst_kaldinnet2onlinedecoder_words_to_string(
     Gstkaldinnet2onlinedecoder *filter, const std::vector<int32> &words) {
   std::stringstream sentence;
   for (size_t i = 0; i < words.size(); i++) {
-    std::string s = filter->word_syms->Find(words[i]);
+    std::string s = filter->result_info->models->word_syms->Find(words[i]);
     if (s == "")
       GST_ERROR_OBJECT(filter, "Word-id %d not in symbol table.", words[i]);
     if (i > 0) {
@@ -1174,44 +1679,49 @@ static std::string gst_kaldinnet2onlinedecoder_words_in_hyp_to_string(
   return gst_kaldinnet2onlinedecoder_words_to_string(filter, word_ids);
 }
 
+// Also sets *confidence to the confidence of the utterance
 static std::vector<NBestResult> gst_kaldinnet2onlinedecoder_nbest_results(
-    Gstkaldinnet2onlinedecoder * filter, CompactLattice &clat) {
+    Gstkaldinnet2onlinedecoder * filter, CompactLattice &clat, double *confidence) {
 
   std::vector<NBestResult> nbest_results;
 
   // FIXME: is it needed?
   //gst_kaldinnet2onlinedecoder_scale_lattice(filter, clat);
 
-  if (filter->word_boundary_info) {
+  if (filter->result_info->models->word_boundary_info) {
     CompactLattice aligned_clat;
-    if (WordAlignLattice(clat, *(filter->trans_model), *(filter->word_boundary_info), 0, &aligned_clat)) {
+    if (WordAlignLattice(clat, filter->result_info->models->acoustic_model->trans_model, *(filter->result_info->models->word_boundary_info), 0, &aligned_clat)) {
       clat = aligned_clat;
     }
   }
 
-  if (filter->align_lexicon_info) {
+  if (filter->result_info->models->align_lexicon_info) {
     CompactLattice aligned_clat;
     WordAlignLatticeLexiconOpts opts;
-    if (WordAlignLatticeLexicon(clat, *(filter->trans_model), *(filter->align_lexicon_info), opts, &aligned_clat)) {
+    if (WordAlignLatticeLexicon(clat, filter->result_info->models->acoustic_model->trans_model, *(filter->result_info->models->align_lexicon_info), opts, &aligned_clat)) {
       clat = aligned_clat;
     }
   }
   
-  Lattice lat;
-  ConvertLattice(clat, &lat);
+  std::vector<LatticePath> nbest_paths;
+  CompactLatticeNBest(clat, filter->num_nbest, &nbest_paths);
 
-  std::vector<Lattice> nbest_lats; // one lattice per path
-  {
-    Lattice nbest_lat; // one lattice with all best paths, temporary
-    fst::ShortestPath(lat, &nbest_lat, filter->num_nbest);
-    fst::ConvertNbestToVector(nbest_lat, &nbest_lats);
+  *confidence = 1;
+  if (nbest_paths.empty()) {
+    return nbest_results;
   }
-
-  for (size_t i=0; i < nbest_lats.size(); i++) {
-    std::vector<int32> words;
-    std::vector<int32> alignment;
-    LatticeWeight weight;
-    GetLinearSymbolSequence(nbest_lats[i], &alignment, &words, &weight);
+  // the confidences of all hypotheses come from one analysis of the lattice
+  std::unique_ptr<LatticeAnalysis> analysis;
+
+  for (size_t i=0; i < nbest_paths.size(); i++) {
+    const std::vector<int32> &words = nbest_paths[i].words;
+    const std::vector<int32> &alignment = nbest_paths[i].alignment;
+    const LatticeWeight &weight = nbest_paths[i].weight;
+    if (i == 0) {
+      analysis.reset(new LatticeAnalysis(
+          clat, words, filter->result_info->models->acoustic_model->trans_model));
+      *confidence = analysis->UtteranceConfidence();
+    }
 
     NBestResult nbest_result;
     nbest_result.likelihood = -(weight.Value1() + weight.Value2());
@@ -1224,104 +1734,122 @@ static std::vector<NBestResult> gst_kaldinnet2onlinedecoder_nbest_results(
     if (filter->do_phone_alignment) {
       if (i < filter->num_phone_alignment) {
         nbest_result.phone_alignment =
-            gst_kaldinnet2onlinedecoder_phone_alignment(filter, alignment, clat);
+            gst_kaldinnet2onlinedecoder_phone_alignment(filter, alignment, analysis.get());
       }
     }
-    if (filter->word_boundary_info) {
-      nbest_result.word_alignment = gst_kaldinnet2onlinedecoder_word_alignment(filter, nbest_lats[i], words, clat);
-    }
-    if (filter->align_lexicon_info) {
-      nbest_result.word_alignment = gst_kaldinnet2onlinedecoder_word_alignment(filter, nbest_lats[i], words, clat);
+    if (filter->result_info->models->word_boundary_info
+        || filter->result_info->models->align_lexicon_info) {
+      nbest_result.word_alignment = gst_kaldinnet2onlinedecoder_word_alignment(filter, words, *analysis);
     }
     nbest_results.push_back(nbest_result);
   }
   return nbest_results;
 }
 
-static std::string gst_kaldinnet2onlinedecoder_full_final_result_to_json(
+// Writes the full final result in one pass, in the same layout as the JSON
+// that the element has always produced
+static void gst_kaldinnet2onlinedecoder_write_full_final_result(
     Gstkaldinnet2onlinedecoder * filter,
-    const FullFinalResult &full_final_result) {
-
-  json_t *root = json_object();
-  json_t *result_json_object = json_object();
-  json_object_set_new( root, "status", json_integer(0));
-
-  json_object_set_new( root, "result", result_json_object);
+    const FullFinalResult &full_final_result,
+    ResultWriter *writer) {
+  BaseFloat frame_shift = filter->feature_info->FrameShiftInSeconds();
+  if (filter->nnet_mode == NNET3) {
+    frame_shift *= filter->nnet3_decodable_opts->frame_subsampling_factor;
+  }
 
-  json_object_set_new( result_json_object, "final", json_true());
+  writer->BeginObject();
+  writer->Key("status");
+  writer->Integer(0);
 
+  writer->Key("result");
+  writer->BeginObject();
+  writer->Key("final");
+  writer->Bool(true);
   if (full_final_result.nbest_results.size() > 0) {
-    BaseFloat frame_shift = filter->feature_info->FrameShiftInSeconds();
-    if (filter->nnet_mode == NNET3) {
-      frame_shift *= filter->nnet3_decodable_opts->frame_subsampling_factor;
-    }
-    json_object_set_new(root, "segment-start",  json_real(filter->segment_start_time));
-
-    json_object_set_new(root, "segment-length",  json_real(full_final_result.nbest_results[0].num_frames * frame_shift));
-    json_object_set_new(root, "total-length",  json_real(filter->total_time_decoded));
-    json_t *nbest_json_arr = json_array();
+    writer->Key("hypotheses");
+    writer->BeginArray();
     for(std::vector<NBestResult>::const_iterator it = full_final_result.nbest_results.begin();
         it != full_final_result.nbest_results.end(); ++it) {
-      NBestResult nbest_result = *it;
-      json_t *nbest_result_json_object = json_object();
-      json_object_set_new(nbest_result_json_object, "transcript",
-                          json_string(gst_kaldinnet2onlinedecoder_words_in_hyp_to_string(filter, nbest_result.words).c_str()));
-      json_object_set_new(nbest_result_json_object, "likelihood",  json_real(nbest_result.likelihood));
-      json_array_append( nbest_json_arr, nbest_result_json_object );
+      const NBestResult &nbest_result = *it;
+      writer->BeginObject();
+      writer->Key("transcript");
+      writer->String(gst_kaldinnet2onlinedecoder_words_in_hyp_to_string(filter, nbest_result.words).c_str());
+      writer->Key("likelihood");
+      writer->Real(nbest_result.likelihood);
       if (nbest_result.phone_alignment.size() > 0) {
         if (strcmp(filter->phone_syms_filename, "") == 0) {
           GST_ERROR_OBJECT(filter, "Phoneme symbol table filename (phone-syms) must be set to output phone alignment.");
-        } else if (filter->phone_syms == NULL) {
+        } else if (filter->result_info->models->phone_syms == NULL) {
           GST_ERROR_OBJECT(filter, "Phoneme symbol table wasn't loaded correctly. Not outputting alignment.");
         } else {
-          json_t *phone_alignment_json_arr = json_array();
+          writer->Key("phone-alignment");
+          writer->BeginArray();
           for (size_t j = 0; j < nbest_result.phone_alignment.size(); j++) {
-            PhoneAlignmentInfo alignment_info = nbest_result.phone_alignment[j];
-            json_t *alignment_info_json_object = json_object();
-            std::string phone = filter->phone_syms->Find(alignment_info.phone_id);
-            json_object_set_new(alignment_info_json_object, "phone",
-                                json_string(phone.c_str()));
-            json_object_set_new(alignment_info_json_object, "start",
-                                json_real(alignment_info.start_frame * frame_shift));
-            json_object_set_new(alignment_info_json_object, "length",
-                                json_real(alignment_info.length_in_frames * frame_shift));
-            json_object_set_new(alignment_info_json_object, "confidence",
-                                json_real(alignment_info.confidence));
-            json_array_append(phone_alignment_json_arr, alignment_info_json_object);
+            const PhoneAlignmentInfo &alignment_info = nbest_result.phone_alignment[j];
+            std::string phone = filter->result_info->models->phone_syms->Find(alignment_info.phone_id);
+            writer->BeginObject();
+            writer->Key("phone");
+            writer->String(phone.c_str());
+            writer->Key("start");
+            writer->Real(alignment_info.start_frame * frame_shift);
+            writer->Key("length");
+            writer->Real(alignment_info.length_in_frames * frame_shift);
+            writer->Key("confidence");
+            writer->Real(alignment_info.confidence);
+            writer->EndObject();
           }
-          json_object_set_new(nbest_result_json_object, "phone-alignment", phone_alignment_json_arr);
+          writer->EndArray();
         }
       }
       if (nbest_result.word_alignment.size() > 0) {
-        json_t *word_alignment_json_arr = json_array();
+        writer->Key("word-alignment");
+        writer->BeginArray();
         for (size_t j = 0; j < nbest_result.word_alignment.size(); j++) {
-          WordAlignmentInfo alignment_info = nbest_result.word_alignment[j];
-          json_t *alignment_info_json_object = json_object();
-          std::string word = filter->word_syms->Find(alignment_info.word_id);
-          json_object_set_new(alignment_info_json_object, "word",
-                              json_string(word.c_str()));
-          json_object_set_new(alignment_info_json_object, "start",
-                              json_real(alignment_info.start_frame * frame_shift));
-          json_object_set_new(alignment_info_json_object, "length",
-                              json_real(alignment_info.length_in_frames * frame_shift));
-          json_object_set_new(alignment_info_json_object, "confidence",
-                              json_real(alignment_info.confidence));
-          json_array_append(word_alignment_json_arr, alignment_info_json_object);
+          const WordAlignmentInfo &alignment_info = nbest_result.word_alignment[j];
+          std::string word = filter->result_info->models->word_syms->Find(alignment_info.word_id);
+          writer->BeginObject();
+          writer->Key("word");
+          writer->String(word.c_str());
+          writer->Key("start");
+          writer->Real(alignment_info.start_frame * frame_shift);
+          writer->Key("length");
+          writer->Real(alignment_info.length_in_frames * frame_shift);
+          writer->Key("confidence");
+          writer->Real(alignment_info.confidence);
+          writer->EndObject();
         }
-        json_object_set_new(nbest_result_json_object, "word-alignment", word_alignment_json_arr);
+        writer->EndArray();
       }
-
+      writer->EndObject();
     }
-
-    json_object_set_new(result_json_object, "hypotheses", nbest_json_arr);
+    writer->EndArray();
   }
+  writer->EndObject();
 
-  char *ret_strings = json_dumps(root, 0);
-
-  json_decref(root);
-  std::string result;
-  result = ret_strings;
-  return result;
+  if (full_final_result.nbest_results.size() > 0) {
+    writer->Key("segment-start");
+    writer->Real(filter->result_info->segment_start_time);
+    writer->Key("segment-length");
+    writer->Real(full_final_result.nbest_results[0].num_frames * frame_shift);
+    writer->Key("total-length");
+    writer->Real(filter->result_info->total_time_decoded);
+    if (filter->result_info->rtf_control) {
+      writer->Key("rtf-control");
+      writer->BeginObject();
+      writer->Key("rtf");
+      writer->Real(filter->result_info->rtf);
+      writer->Key("beam");
+      writer->Real(filter->result_info->beam);
+      writer->Key("max-active");
+      writer->Integer(filter->result_info->max_active);
+      writer->EndObject();
+    }
+    if (ComputeBudget::Instance().MaxThreads() > 0) {
+      writer->Key("compute-wait");
+      writer->Real(filter->result_info->compute_wait_secs);
+    }
+  }
+  writer->EndObject();
 }
 
 static void gst_kaldinnet2onlinedecoder_final_result(
@@ -1334,12 +1862,11 @@ static void gst_kaldinnet2onlinedecoder_final_result(
 
   gst_kaldinnet2onlinedecoder_scale_lattice(filter, clat);
 
-  // set confidence
-  filter->last_conf = gst_kaldinnet2onlinedecoder_get_conf(clat);
-
   FullFinalResult full_final_result;
   GST_DEBUG_OBJECT(filter, "Decoding n-best results");
-  full_final_result.nbest_results = gst_kaldinnet2onlinedecoder_nbest_results(filter, clat);
+  // also sets the confidence
+  full_final_result.nbest_results =
+      gst_kaldinnet2onlinedecoder_nbest_results(filter, clat, &filter->last_conf);
 
   if (full_final_result.nbest_results.size() > 0) {
     std::string best_transcript = gst_kaldinnet2onlinedecoder_words_in_hyp_to_string(filter, full_final_result.nbest_results[0].words);
@@ -1360,10 +1887,19 @@ static void gst_kaldinnet2onlinedecoder_final_result(
       g_signal_emit(filter, gst_kaldinnet2onlinedecoder_signals[FINAL_RESULT_SIGNAL], 0, best_transcript.c_str(),
                     full_final_result.nbest_results[0].likelihood, filter->last_conf);
 
-      std::string full_final_result_as_json =
-          gst_kaldinnet2onlinedecoder_full_final_result_to_json(filter, full_final_result);
-      GST_DEBUG_OBJECT(filter, "Final JSON: %s", full_final_result_as_json.c_str());
-      g_signal_emit(filter, gst_kaldinnet2onlinedecoder_signals[FULL_FINAL_RESULT_SIGNAL], 0, full_final_result_as_json.c_str());
+      ResultWriter *writer = filter->result_writer;
+      writer->Reset(static_cast<ResultFormat>(filter->result_format));
+      gst_kaldinnet2onlinedecoder_write_full_final_result(filter, full_final_result, writer);
+      if (filter->result_format == kResultFormatJson) {
+        GST_DEBUG_OBJECT(filter, "Final JSON: %s", writer->Data().c_str());
+        g_signal_emit(filter, gst_kaldinnet2onlinedecoder_signals[FULL_FINAL_RESULT_SIGNAL], 0,
+                      writer->Data().c_str());
+      } else {
+        GBytes *bytes = g_bytes_new(writer->Data().data(), writer->Data().size());
+        g_signal_emit(filter, gst_kaldinnet2onlinedecoder_signals[FULL_FINAL_RESULT_BYTES_SIGNAL], 0,
+                      bytes);
+        g_bytes_unref(bytes);
+      }
 
     }
   }
@@ -1414,7 +1950,8 @@ static bool gst_kaldinnet2onlinedecoder_rescore_big_lm(
   // The command below is faster, though; it's constant not
   // logarithmic in vocab size.
 
-  TableCompose(tmp_lattice, *(filter->lm_fst), &composed_lat, filter->lm_compose_cache);
+  TableCompose(tmp_lattice, *(filter->result_info->models->lm_fst->lm_fst), &composed_lat,
+               filter->result_info->models->lm_fst->compose_cache);
 
   Invert(&composed_lat); // make it so word labels are on the input.
   CompactLattice determinized_lat;
@@ -1429,7 +1966,7 @@ static bool gst_kaldinnet2onlinedecoder_rescore_big_lm(
 
     // Wraps the ConstArpaLm format language model into FST. We re-create it
     // for each lattice to prevent memory usage increasing with time.
-    ConstArpaLmDeterministicFst const_arpa_fst(*(filter->big_lm_const_arpa));
+    ConstArpaLmDeterministicFst const_arpa_fst(*(filter->result_info->models->big_lm_const_arpa));
 
     // Composes lattice with language model.
     CompactLattice composed_clat;
@@ -1450,355 +1987,1195 @@ static bool gst_kaldinnet2onlinedecoder_rescore_big_lm(
   return true;
 }
 
-static void gst_kaldinnet2onlinedecoder_threaded_decode_segment(Gstkaldinnet2onlinedecoder * filter,
-                                                      bool &more_data,
-                                                      int32 chunk_length,
-                                                      BaseFloat traceback_period_secs,
-                                                      Vector<BaseFloat> *remaining_wave_part) {
-    SingleUtteranceNnet2DecoderThreaded decoder(*(filter->nnet2_decoding_threaded_config),
-                                        *(filter->trans_model), 
-                                        *(filter->am_nnet2),
-                                        *(filter->decode_fst),
-                                        *(filter->feature_info),
-                                        *(filter->adaptation_state),
-                                        *(filter->cmvn_state));
-
-    Vector<BaseFloat> wave_part = Vector<BaseFloat>(chunk_length);
-    GST_DEBUG_OBJECT(filter, "Reading audio in %d sample chunks...",
-                     wave_part.Dim());
-    BaseFloat last_traceback = 0.0;
-    BaseFloat num_seconds_decoded = 0.0;
-    if (remaining_wave_part->Dim() > 0) {
-      GST_DEBUG_OBJECT(filter, "Submitting remaining wave of size %d", remaining_wave_part->Dim());
-      decoder.AcceptWaveform(filter->sample_rate, *remaining_wave_part);
-      filter->total_time_decoded += 1.0 * remaining_wave_part->Dim() / filter->sample_rate;
-      while (decoder.NumFramesReceivedApprox() - decoder.NumFramesDecoded() > 100) {
-        Sleep(0.1);
-      }
+// Reads the next chunk of audio into wave_part. If the VAD is enabled, long
+// silences are removed from it, and at the end of the stream the silence it
+// still holds back; the length of the removed audio (in seconds) is
+// returned in dropped_secs and already added to total_time_decoded.
+static bool gst_kaldinnet2onlinedecoder_read_audio(Gstkaldinnet2onlinedecoder * filter,
+                                                   int32 chunk_length,
+                                                   Vector<BaseFloat> *wave_part,
+                                                   BaseFloat *dropped_secs) {
+  wave_part->Resize(chunk_length, kUndefined);
+  bool more_data = filter->audio_source->Read(wave_part);
+  *dropped_secs = 0.0;
+  if (filter->vad != NULL) {
+    Vector<BaseFloat> chunk;
+    chunk.Swap(wave_part);
+    int32 num_dropped = filter->vad->Process(chunk, wave_part);
+    if (!more_data) {
+      num_dropped += filter->vad->Flush();
     }
-    while (true) {
-      more_data = filter->audio_source->Read(&wave_part);
-      GST_DEBUG_OBJECT(filter, "Submitting wave of size: %d", wave_part.Dim());
-      decoder.AcceptWaveform(filter->sample_rate, wave_part);
-      filter->total_time_decoded += 1.0 * wave_part.Dim() / filter->sample_rate;
-      if (!more_data) {
-        decoder.InputFinished();
-        break;
-      }
+    *dropped_secs = 1.0 * num_dropped / filter->sample_rate;
+    filter->total_time_decoded += *dropped_secs;
+  }
+  return more_data;
+}
 
-      if (filter->do_endpointing) {
-        GST_DEBUG_OBJECT(filter, "Before the sleep check: Frames received: ~ %d, frames decoded: %d, pieces pending: %d",
-                         decoder.NumFramesReceivedApprox(),
-                         decoder.NumFramesDecoded(),
-                         decoder.NumWaveformPiecesPending());
+static void gst_kaldinnet2onlinedecoder_get_adaptation_state(
+    OnlineNnet2FeaturePipeline &feature_pipeline,
+    OnlineIvectorExtractorAdaptationState *adaptation_state, OnlineCmvnState *cmvn_state) {
+  feature_pipeline.GetAdaptationState(adaptation_state);
+  feature_pipeline.GetCmvnState(cmvn_state);
+}
 
-        // Wait until there are less than one second of frames left to decode
-        // Depends of the frame shift, but one second is also selected arbitrarily
-        while (decoder.NumFramesReceivedApprox() - decoder.NumFramesDecoded() > 100) {
-          Sleep(0.1);
-        }
+static void gst_kaldinnet2onlinedecoder_get_adaptation_state(
+    SingleUtteranceNnet3DecoderThreaded &decoder,
+    OnlineIvectorExtractorAdaptationState *adaptation_state, OnlineCmvnState *cmvn_state) {
+  decoder.GetAdaptationState(adaptation_state);
+  decoder.GetCmvnState(cmvn_state);
+}
 
-        GST_DEBUG_OBJECT(filter, "After the sleep check: Frames received: ~ %d, frames decoded: %d, pieces pending: %d",
-                         decoder.NumFramesReceivedApprox(),
-                         decoder.NumFramesDecoded(),
-                         decoder.NumWaveformPiecesPending());
+static void gst_kaldinnet2onlinedecoder_get_result_info(
+    Gstkaldinnet2onlinedecoder * filter, SegmentResultInfo *info) {
+  info->models = *(filter->pinned_snapshot);
+  info->segment_start_time = filter->segment_start_time;
+  info->total_time_decoded = filter->total_time_decoded;
+  info->rtf_control = (filter->rtf_controller != NULL);
+  if (info->rtf_control) {
+    info->rtf = filter->rtf_controller->Rtf();
+    info->beam = filter->rtf_controller->Beam();
+    info->max_active = filter->rtf_controller->MaxActive();
+  }
+  info->compute_wait_secs = filter->compute_wait_secs;
+}
 
-        if ((decoder.NumFramesDecoded() > 0)
-            && decoder.EndpointDetected(*(filter->endpoint_config))) {
-          decoder.TerminateDecoding();
-          GST_DEBUG_OBJECT(filter, "Endpoint detected!");
-          break;
-        }
-      }
-      num_seconds_decoded += filter->chunk_length_in_secs;
-      if ((num_seconds_decoded - last_traceback > traceback_period_secs)
-          && (decoder.NumFramesDecoded() > 0)) {
-        Lattice lat;
-        decoder.GetBestPath(false, &lat, NULL);
-        gst_kaldinnet2onlinedecoder_partial_result(filter, lat);
-        last_traceback += traceback_period_secs;
-      }
+// Rescores the lattice of a finished segment and emits the final result.
+// Returns true if the result is good enough to keep the adaptation state
+// of the segment.
+static bool gst_kaldinnet2onlinedecoder_segment_final_result(
+    Gstkaldinnet2onlinedecoder * filter, CompactLattice &clat) {
+  if ((filter->result_info->models->lm_fst != NULL)
+      && (filter->result_info->models->big_lm_const_arpa != NULL)) {
+    GST_DEBUG_OBJECT(filter, "Rescoring lattice with a big LM");
+    CompactLattice rescored_lat;
+    if (gst_kaldinnet2onlinedecoder_rescore_big_lm(filter, clat, rescored_lat)) {
+      clat = rescored_lat;
     }
-
-    decoder.Wait();
-
-    decoder.GetRemainingWaveform(remaining_wave_part);
-    GST_DEBUG_OBJECT(filter, "Remaining waveform size: %d", remaining_wave_part->Dim());
-    filter->total_time_decoded -= 1.0 * remaining_wave_part->Dim() / filter->sample_rate;
-
-    if (num_seconds_decoded > 0.1) {
-      GST_DEBUG_OBJECT(filter, "Getting lattice..");
-      decoder.FinalizeDecoding();
-      CompactLattice clat;
-      bool end_of_utterance = true;
-      decoder.GetLattice(end_of_utterance, &clat, NULL);
-      GST_DEBUG_OBJECT(filter, "Lattice done");
-      if ((filter->lm_fst != NULL) && (filter->big_lm_const_arpa != NULL)) {
-        GST_DEBUG_OBJECT(filter, "Rescoring lattice with a big LM");
-        CompactLattice rescored_lat;
-        if (gst_kaldinnet2onlinedecoder_rescore_big_lm(filter, clat, rescored_lat)) {
-          clat = rescored_lat;
-        }
-      }
-      if (strcmp(filter->rescore_socket, "") != 0) {
-        GST_DEBUG_OBJECT(filter, "Rescoring lattice on a remote rescorer-worker");
-        CompactLattice rescored_lat;
-        if (gst_kaldinnet2onlinedecoder_rescore_remote(filter, clat, rescored_lat)) {
-          clat = rescored_lat;
-        }
-      }
-
-
-      guint num_words = 0;
-      gst_kaldinnet2onlinedecoder_final_result(filter, clat, &num_words);
-      if (num_words >= filter->min_words_for_ivector && filter->last_conf > 0.3) {
-        // Only update adaptation state if the utterance contained enough words
-        decoder.GetAdaptationState(filter->adaptation_state);
-      }
-    } else {
-      GST_DEBUG_OBJECT(filter, "Less than 0.1 seconds decoded, discarding");
+  }
+  if (strcmp(filter->rescore_socket, "") != 0) {
+    GST_DEBUG_OBJECT(filter, "Rescoring lattice on a remote rescorer-worker");
+    CompactLattice rescored_lat;
+    if (gst_kaldinnet2onlinedecoder_rescore_remote(filter, clat, rescored_lat)) {
+      clat = rescored_lat;
     }
+  }
 
+  guint num_words = 0;
+  gst_kaldinnet2onlinedecoder_final_result(filter, clat, &num_words);
+  // Only update adaptation state if the utterance contained enough words
+  return num_words >= filter->min_words_for_ivector && filter->last_conf > 0.3;
 }
 
-static void gst_kaldinnet2onlinedecoder_unthreaded_decode_segment(Gstkaldinnet2onlinedecoder * filter,
-                                                        bool &more_data,
-                                                        int32 chunk_length,
-                                                        BaseFloat traceback_period_secs) {
-
-  OnlineNnet2FeaturePipeline feature_pipeline(*(filter->feature_info));
-  feature_pipeline.SetAdaptationState(*(filter->adaptation_state));
-  SingleUtteranceNnet2Decoder decoder(*(filter->nnet2_decoding_config),
-                                      *(filter->trans_model), 
-                                      *(filter->am_nnet2),
-                                      *(filter->decode_fst),
-                                      &feature_pipeline);
-  OnlineSilenceWeighting silence_weighting(*(filter->trans_model),
-          *(filter->silence_weighting_config));
+// Results that are produced by the post-processing thread, in the order
+// in which the decoding task queued them
+struct PostprocessingJob {
+  enum Kind { PARTIAL_RESULT, FINAL_RESULT, STOP };
+
+  Kind kind;
+  SegmentResultInfo info;
+  Lattice partial_lat;
+  CompactLattice clat;
+  // the adaptation state at the end of the segment
+  OnlineIvectorExtractorAdaptationState *adaptation_state;
+  OnlineCmvnState *cmvn_state;
+
+  explicit PostprocessingJob(Kind kind) :
+      kind(kind), adaptation_state(NULL), cmvn_state(NULL) {}
+  ~PostprocessingJob() { delete adaptation_state; delete cmvn_state; }
+};
 
-  Vector<BaseFloat> wave_part = Vector<BaseFloat>(chunk_length);
-  std::vector<std::pair<int32, BaseFloat> > delta_weights;
-  GST_DEBUG_OBJECT(filter, "Reading audio in %d sample chunks...",
-                   wave_part.Dim());
-  BaseFloat last_traceback = 0.0;
-  BaseFloat num_seconds_decoded = 0.0;
+static gpointer gst_kaldinnet2onlinedecoder_postprocess(gpointer data) {
+  Gstkaldinnet2onlinedecoder *filter = GST_KALDINNET2ONLINEDECODER(data);
   while (true) {
-    more_data = filter->audio_source->Read(&wave_part);
-
-    feature_pipeline.AcceptWaveform(filter->sample_rate, wave_part);
-    if (!more_data) {
-      feature_pipeline.InputFinished();
-    }
-
-    if (silence_weighting.Active() && 
-        feature_pipeline.IvectorFeature() != NULL) {
-      silence_weighting.ComputeCurrentTraceback(decoder.Decoder());
-      silence_weighting.GetDeltaWeights(feature_pipeline.IvectorFeature()->NumFramesReady(), 0,
-                                        &delta_weights);
-      feature_pipeline.IvectorFeature()->UpdateFrameWeights(delta_weights);
-    }
-
-    decoder.AdvanceDecoding();
-    GST_DEBUG_OBJECT(filter, "%d frames decoded", decoder.NumFramesDecoded());
-    num_seconds_decoded += 1.0 * wave_part.Dim() / filter->sample_rate;
-    filter->total_time_decoded += 1.0 * wave_part.Dim() / filter->sample_rate;
-    GST_DEBUG_OBJECT(filter, "Total amount of audio processed: %f seconds", filter->total_time_decoded);
-    if (!more_data) {
+    PostprocessingJob *job =
+        static_cast<PostprocessingJob*>(g_async_queue_pop(filter->postprocessing_queue));
+    if (job->kind == PostprocessingJob::STOP) {
+      delete job;
       break;
     }
-    if (filter->do_endpointing
-        && (decoder.NumFramesDecoded() > 0)
-        && decoder.EndpointDetected(*(filter->endpoint_config))) {
-      GST_DEBUG_OBJECT(filter, "Endpoint detected!");
-      break;
+    filter->result_info = &job->info;
+    if (job->kind == PostprocessingJob::PARTIAL_RESULT) {
+      gst_kaldinnet2onlinedecoder_partial_result(filter, job->partial_lat);
+    } else if (gst_kaldinnet2onlinedecoder_segment_final_result(filter, job->clat)) {
+      g_mutex_lock(&filter->adaptation_state_lock);
+      *(filter->adaptation_state) = *(job->adaptation_state);
+      *(filter->cmvn_state) = *(job->cmvn_state);
+      g_mutex_unlock(&filter->adaptation_state_lock);
     }
+    filter->result_info = NULL;
+    delete job;
 
-    if ((num_seconds_decoded - last_traceback > traceback_period_secs)
-        && (decoder.NumFramesDecoded() > 0)) {
-      Lattice lat;
-      decoder.GetBestPath(false, &lat);
-      gst_kaldinnet2onlinedecoder_partial_result(filter, lat);
-      last_traceback += traceback_period_secs;
-    }
+    g_mutex_lock(&filter->postprocessing_lock);
+    filter->num_pending_results--;
+    g_cond_broadcast(&filter->postprocessing_cond);
+    g_mutex_unlock(&filter->postprocessing_lock);
   }
+  return NULL;
+}
 
-  if (num_seconds_decoded > 0.1) {
-    GST_DEBUG_OBJECT(filter, "Getting lattice..");
-    decoder.FinalizeDecoding();
-    CompactLattice clat;
-    bool end_of_utterance = true;
-    decoder.GetLattice(end_of_utterance, &clat);
-    GST_DEBUG_OBJECT(filter, "Lattice done");
-    if ((filter->lm_fst != NULL) && (filter->big_lm_const_arpa != NULL)) {
-      GST_DEBUG_OBJECT(filter, "Rescoring lattice with a big LM");
-      CompactLattice rescored_lat;
-      if (gst_kaldinnet2onlinedecoder_rescore_big_lm(filter, clat, rescored_lat)) {
-        clat = rescored_lat;
-      }
-    }
+// Results that may wait for the post-processing thread before the decoding
+// task waits for it, so that slow rescoring can't let them pile up
+#define MAX_PENDING_RESULTS 8
 
-    guint num_words = 0;
-    gst_kaldinnet2onlinedecoder_final_result(filter, clat, &num_words);
-    if (num_words >= filter->min_words_for_ivector) {
-      // Only update adaptation state if the utterance contained enough words
-      feature_pipeline.GetAdaptationState(filter->adaptation_state);
-      feature_pipeline.GetCmvnState(filter->cmvn_state);
-    }
-  } else {
-    GST_DEBUG_OBJECT(filter, "Less than 0.1 seconds decoded, discarding");
+static void gst_kaldinnet2onlinedecoder_queue_postprocessing(
+    Gstkaldinnet2onlinedecoder * filter, PostprocessingJob *job) {
+  g_mutex_lock(&filter->postprocessing_lock);
+  while (filter->num_pending_results >= MAX_PENDING_RESULTS) {
+    g_cond_wait(&filter->postprocessing_cond, &filter->postprocessing_lock);
   }
+  filter->num_pending_results++;
+  g_mutex_unlock(&filter->postprocessing_lock);
+  g_async_queue_push(filter->postprocessing_queue, job);
 }
 
-// for nnet3, we keep this duplication to allow nnet3 specific changes
-static void gst_kaldinnet2onlinedecoder_nnet3_unthreaded_decode_segment(Gstkaldinnet2onlinedecoder * filter,
-                                                        bool &more_data,
-                                                        int32 chunk_length,
-                                                        BaseFloat traceback_period_secs) {
-
-  OnlineNnet2FeaturePipeline feature_pipeline(*(filter->feature_info));
-  feature_pipeline.SetAdaptationState(*(filter->adaptation_state));
-  feature_pipeline.SetCmvnState(*(filter->cmvn_state));
-  SingleUtteranceNnet3Decoder decoder(*(filter->decoder_opts),
-                                      *(filter->trans_model), 
-                                      *(filter->decodable_info_nnet3),
-                                      *(filter->decode_fst),
-                                      &feature_pipeline);
-  
-  Vector<BaseFloat> wave_part = Vector<BaseFloat>(chunk_length);
-  GST_DEBUG_OBJECT(filter, "Reading audio in %d sample chunks...",
-                wave_part.Dim());
-  
-  int32 frame_offset = 0;
+// Waits until the post-processing thread has emitted all queued results
+// and updated the adaptation state
+static void gst_kaldinnet2onlinedecoder_wait_for_postprocessing(
+    Gstkaldinnet2onlinedecoder * filter) {
+  if (filter->postprocessor == NULL) {
+    return;
+  }
+  g_mutex_lock(&filter->postprocessing_lock);
+  while (filter->num_pending_results > 0) {
+    g_cond_wait(&filter->postprocessing_cond, &filter->postprocessing_lock);
+  }
+  g_mutex_unlock(&filter->postprocessing_lock);
+}
 
-  int32 frame_subsampling_factor = filter->nnet3_decodable_opts->frame_subsampling_factor;
-  BaseFloat frame_shift = filter->feature_info->FrameShiftInSeconds();
+static void gst_kaldinnet2onlinedecoder_emit_partial_result(
+    Gstkaldinnet2onlinedecoder * filter, const Lattice &lat) {
+  if (filter->postprocessor == NULL) {
+    SegmentResultInfo info;
+    gst_kaldinnet2onlinedecoder_get_result_info(filter, &info);
+    filter->result_info = &info;
+    gst_kaldinnet2onlinedecoder_partial_result(filter, lat);
+    filter->result_info = NULL;
+    return;
+  }
+  PostprocessingJob *job = new PostprocessingJob(PostprocessingJob::PARTIAL_RESULT);
+  gst_kaldinnet2onlinedecoder_get_result_info(filter, &job->info);
+  job->partial_lat = lat;
+  gst_kaldinnet2onlinedecoder_queue_postprocessing(filter, job);
+}
 
-  while (more_data) {
-    decoder.InitDecoding(frame_offset);
-    OnlineSilenceWeighting silence_weighting(*(filter->trans_model),
-          *(filter->silence_weighting_config), 
-          frame_subsampling_factor);
-    std::vector<std::pair<int32, BaseFloat> > delta_weights;
+// Emits the final result of a segment, or with postprocess-in-thread, queues
+// it for the post-processing thread, so that the next segment can be
+// decoded meanwhile. The adaptation state of the segment is taken from
+// 'source' and kept if the result is good enough.
+template<class AdaptationSource>
+static void gst_kaldinnet2onlinedecoder_emit_final_result(
+    Gstkaldinnet2onlinedecoder * filter, CompactLattice &clat, AdaptationSource &source) {
+  if (filter->postprocessor == NULL) {
+    SegmentResultInfo info;
+    gst_kaldinnet2onlinedecoder_get_result_info(filter, &info);
+    filter->result_info = &info;
+    if (gst_kaldinnet2onlinedecoder_segment_final_result(filter, clat)) {
+      g_mutex_lock(&filter->adaptation_state_lock);
+      gst_kaldinnet2onlinedecoder_get_adaptation_state(source, filter->adaptation_state,
+                                                       filter->cmvn_state);
+      g_mutex_unlock(&filter->adaptation_state_lock);
+    }
+    filter->result_info = NULL;
+    return;
+  }
+  PostprocessingJob *job = new PostprocessingJob(PostprocessingJob::FINAL_RESULT);
+  gst_kaldinnet2onlinedecoder_get_result_info(filter, &job->info);
+  job->clat = clat;
+  // the post-processing thread or the application may be updating the
+  // current state
+  g_mutex_lock(&filter->adaptation_state_lock);
+  job->adaptation_state = new OnlineIvectorExtractorAdaptationState(*(filter->adaptation_state));
+  job->cmvn_state = new OnlineCmvnState(*(filter->cmvn_state));
+  g_mutex_unlock(&filter->adaptation_state_lock);
+  gst_kaldinnet2onlinedecoder_get_adaptation_state(source, job->adaptation_state,
+                                                   job->cmvn_state);
+  gst_kaldinnet2onlinedecoder_queue_postprocessing(filter, job);
+}
 
-    BaseFloat last_traceback = 0.0;
-    BaseFloat num_seconds_decoded = 0.0;
+// Waits until the decoder has caught up with the audio, so that endpoints are
+// detected without a delay
+static void gst_kaldinnet2onlinedecoder_wait_for_decoder(
+    Gstkaldinnet2onlinedecoder * filter, SingleUtteranceNnet3DecoderThreaded &decoder) {
+  // the lag is in 10 ms frames, nnet3 decodes subsampled frames
+  int32 frame_subsampling_factor = (filter->nnet_mode == NNET2 ? 1 :
+      filter->nnet3_decodable_opts->frame_subsampling_factor);
+  int32 lag = decoder.WaitForDecoder(filter->max_decoder_lag_frames / frame_subsampling_factor);
+  g_atomic_int_set(&filter->decoder_lag_frames, lag * frame_subsampling_factor);
+}
 
-    while (true) {
+// Applies the beam and max-active chosen by the real-time factor controller
+static void gst_kaldinnet2onlinedecoder_apply_search_limits(
+    Gstkaldinnet2onlinedecoder * filter, SingleUtteranceNnet2SegmentDecoder &decoder) {
+  LatticeFasterDecoderConfig decoder_opts = filter->nnet2_decoding_config->decoder_opts;
+  decoder_opts.beam = filter->rtf_controller->Beam();
+  decoder_opts.max_active = filter->rtf_controller->MaxActive();
+  decoder.SetDecoderOptions(decoder_opts);
+}
 
-      more_data = filter->audio_source->Read(&wave_part);
+// Kaldi's nnet3 decoders only give const access to the search, but the
+// search object itself isn't const
+static void gst_kaldinnet2onlinedecoder_apply_search_limits(
+    Gstkaldinnet2onlinedecoder * filter, SingleUtteranceNnet3Decoder &decoder) {
+  LatticeFasterDecoderConfig decoder_opts = *(filter->decoder_opts);
+  decoder_opts.beam = filter->rtf_controller->Beam();
+  decoder_opts.max_active = filter->rtf_controller->MaxActive();
+  const_cast<LatticeFasterOnlineDecoder &>(decoder.Decoder()).SetOptions(decoder_opts);
+}
 
-      feature_pipeline.AcceptWaveform(filter->sample_rate, wave_part);
-      if (!more_data) {
-        feature_pipeline.InputFinished();
-      }
+static void gst_kaldinnet2onlinedecoder_apply_search_limits(
+    Gstkaldinnet2onlinedecoder * filter, SingleUtteranceNnet3BatchDecoder &decoder) {
+  LatticeFasterDecoderConfig decoder_opts = *(filter->decoder_opts);
+  decoder_opts.beam = filter->rtf_controller->Beam();
+  decoder_opts.max_active = filter->rtf_controller->MaxActive();
+  decoder.SetDecoderOptions(decoder_opts);
+}
 
-      if (silence_weighting.Active() && 
-          feature_pipeline.IvectorFeature() != NULL) {
-        silence_weighting.ComputeCurrentTraceback(decoder.Decoder());
-        silence_weighting.GetDeltaWeights(feature_pipeline.NumFramesReady(), 
-                                          frame_offset * frame_subsampling_factor,
-                                          &delta_weights);
-        feature_pipeline.UpdateFrameWeights(delta_weights);
-      }
+static void gst_kaldinnet2onlinedecoder_apply_search_limits(
+    Gstkaldinnet2onlinedecoder * filter, SingleUtteranceNnet3IncrementalDecoder &decoder) {
+  LatticeIncrementalDecoderConfig decoder_opts = *(filter->incremental_decoder_opts);
+  decoder_opts.beam = filter->rtf_controller->Beam();
+  decoder_opts.max_active = filter->rtf_controller->MaxActive();
+  const_cast<LatticeIncrementalOnlineDecoder &>(decoder.Decoder()).SetOptions(decoder_opts);
+}
 
-      decoder.AdvanceDecoding();
-      GST_DEBUG_OBJECT(filter, "%d frames decoded", decoder.NumFramesDecoded());
-      num_seconds_decoded += 1.0 * wave_part.Dim() / filter->sample_rate;
-      filter->total_time_decoded += 1.0 * wave_part.Dim() / filter->sample_rate;
-      GST_DEBUG_OBJECT(filter, "Total amount of audio processed: %f seconds", filter->total_time_decoded);
-      if (!more_data) {
-        break;
-      }
-      if (filter->do_endpointing
-          && (decoder.NumFramesDecoded() > 0)
-          && decoder.EndpointDetected(*(filter->endpoint_config))) {
-        GST_DEBUG_OBJECT(filter, "Endpoint detected!");
-        break;
-      }
+// Passes the time it took to decode a chunk to the real-time factor
+// controller and narrows or widens the search if it says so
+template<class Decoder>
+static void gst_kaldinnet2onlinedecoder_control_rtf(Gstkaldinnet2onlinedecoder * filter,
+                                                    Decoder &decoder,
+                                                    int32 num_samples,
+                                                    gint64 start_time) {
+  if (filter->rtf_controller == NULL) {
+    return;
+  }
+  double compute_secs = (g_get_monotonic_time() - start_time) / 1e6;
+  if (!filter->rtf_controller->Update(1.0 * num_samples / filter->sample_rate,
+                                      compute_secs)) {
+    return;
+  }
+  gst_kaldinnet2onlinedecoder_apply_search_limits(filter, decoder);
+  GST_DEBUG_OBJECT(filter, "Real-time factor %f, beam set to %f, max-active to %d",
+                   filter->rtf_controller->Rtf(), filter->rtf_controller->Beam(),
+                   filter->rtf_controller->MaxActive());
+  GstStructure *rtf_control = gst_structure_new("rtf-control",
+      "rtf", G_TYPE_DOUBLE, double(filter->rtf_controller->Rtf()),
+      "beam", G_TYPE_DOUBLE, double(filter->rtf_controller->Beam()),
+      "max-active", G_TYPE_INT, filter->rtf_controller->MaxActive(),
+      NULL);
+  gst_element_post_message(GST_ELEMENT(filter),
+                           gst_message_new_element(GST_OBJECT(filter), rtf_control));
+}
+
+static void gst_kaldinnet2onlinedecoder_partial_lattice(SingleUtteranceNnet2SegmentDecoder &decoder,
+                                                       Lattice *lat) {
+  decoder.GetBestPath(false, lat);
+}
+
+static void gst_kaldinnet2onlinedecoder_partial_lattice(SingleUtteranceNnet3Decoder &decoder,
+                                                       Lattice *lat) {
+  decoder.GetBestPath(false, lat);
+}
+
+static void gst_kaldinnet2onlinedecoder_partial_lattice(SingleUtteranceNnet3BatchDecoder &decoder,
+                                                       Lattice *lat) {
+  decoder.GetBestPath(false, lat);
+}
+
+// The best path of the incrementally determinized lattice; only the frames
+// decoded since the last call need to be determinized
+static void gst_kaldinnet2onlinedecoder_partial_lattice(SingleUtteranceNnet3IncrementalDecoder &decoder,
+                                                       Lattice *lat) {
+  const CompactLattice &clat = decoder.GetLattice(decoder.NumFramesDecoded(), false);
+  CompactLattice best_path;
+  CompactLatticeShortestPath(clat, &best_path);
+  ConvertLattice(best_path, lat);
+}
+
+static void gst_kaldinnet2onlinedecoder_final_lattice(SingleUtteranceNnet2SegmentDecoder &decoder,
+                                                     CompactLattice *clat) {
+  bool end_of_utterance = true;
+  decoder.GetLattice(end_of_utterance, clat);
+}
+
+static void gst_kaldinnet2onlinedecoder_final_lattice(SingleUtteranceNnet3Decoder &decoder,
+                                                     CompactLattice *clat) {
+  bool end_of_utterance = true;
+  decoder.GetLattice(end_of_utterance, clat);
+}
+
+static void gst_kaldinnet2onlinedecoder_final_lattice(SingleUtteranceNnet3BatchDecoder &decoder,
+                                                     CompactLattice *clat) {
+  bool end_of_utterance = true;
+  decoder.GetLattice(end_of_utterance, clat);
+}
+
+// Only the frames after the last determinized chunk are left to determinize
+static void gst_kaldinnet2onlinedecoder_final_lattice(SingleUtteranceNnet3IncrementalDecoder &decoder,
+                                                     CompactLattice *clat) {
+  bool use_final_probs = true;
+  *clat = decoder.GetLattice(decoder.NumFramesDecoded(), use_final_probs);
+}
+
+// The nnet2 decoder starts every segment from new features with the current
+// adaptation state, so that, as before, only segments whose results are
+// kept adapt the next ones. The nnet3 decoders keep the features of the
+// whole stream.
+template<class Decoder>
+static bool gst_kaldinnet2onlinedecoder_features_per_segment(const Decoder &decoder) {
+  return false;
+}
+
+static bool gst_kaldinnet2onlinedecoder_features_per_segment(
+    const SingleUtteranceNnet2SegmentDecoder &decoder) {
+  return true;
+}
+
+template<class Decoder>
+static void gst_kaldinnet2onlinedecoder_set_feature_pipeline(
+    Decoder &decoder, OnlineNnet2FeaturePipeline *feature_pipeline) {
+  KALDI_ERR << "This decoder keeps the features of the whole stream";
+}
+
+static void gst_kaldinnet2onlinedecoder_set_feature_pipeline(
+    SingleUtteranceNnet2SegmentDecoder &decoder, OnlineNnet2FeaturePipeline *feature_pipeline) {
+  decoder.SetFeaturePipeline(feature_pipeline);
+}
+
+static void gst_kaldinnet2onlinedecoder_new_decoder(Gstkaldinnet2onlinedecoder * filter,
+                                                    OnlineNnet2FeaturePipeline *feature_pipeline,
+                                                    SingleUtteranceNnet2SegmentDecoder **decoder) {
+  *decoder = new SingleUtteranceNnet2SegmentDecoder(*(filter->nnet2_decoding_config),
+                                                    filter->pinned_models->acoustic_model->trans_model,
+                                                    filter->pinned_models->acoustic_model->am_nnet2,
+                                                    *(filter->pinned_models->decode_fst),
+                                                    feature_pipeline);
+}
+
+static void gst_kaldinnet2onlinedecoder_new_decoder(Gstkaldinnet2onlinedecoder * filter,
+                                                    OnlineNnet2FeaturePipeline *feature_pipeline,
+                                                    SingleUtteranceNnet3Decoder **decoder) {
+  *decoder = new SingleUtteranceNnet3Decoder(*(filter->decoder_opts),
+                                             filter->pinned_models->acoustic_model->trans_model,
+                                             *(filter->pinned_models->acoustic_model->decodable_info_nnet3),
+                                             *(filter->pinned_models->decode_fst),
+                                             feature_pipeline);
+}
+
+// The acoustic model is evaluated by the model's batch scorer
+static void gst_kaldinnet2onlinedecoder_new_decoder(Gstkaldinnet2onlinedecoder * filter,
+                                                    OnlineNnet2FeaturePipeline *feature_pipeline,
+                                                    SingleUtteranceNnet3BatchDecoder **decoder) {
+  *decoder = new SingleUtteranceNnet3BatchDecoder(*(filter->decoder_opts),
+                                                  filter->pinned_models->acoustic_model->trans_model,
+                                                  filter->pinned_models->acoustic_model->batch_scorer,
+                                                  *(filter->pinned_models->decode_fst),
+                                                  feature_pipeline);
+}
+
+static void gst_kaldinnet2onlinedecoder_new_decoder(Gstkaldinnet2onlinedecoder * filter,
+                                                    OnlineNnet2FeaturePipeline *feature_pipeline,
+                                                    SingleUtteranceNnet3IncrementalDecoder **decoder) {
+  // the search options are shared with the normal decoder
+  LatticeIncrementalDecoderConfig *config = filter->incremental_decoder_opts;
+  config->beam = filter->decoder_opts->beam;
+  config->max_active = filter->decoder_opts->max_active;
+  config->min_active = filter->decoder_opts->min_active;
+  config->lattice_beam = filter->decoder_opts->lattice_beam;
+  config->prune_interval = filter->decoder_opts->prune_interval;
+  config->beam_delta = filter->decoder_opts->beam_delta;
+  config->hash_ratio = filter->decoder_opts->hash_ratio;
+  config->prune_scale = filter->decoder_opts->prune_scale;
+  config->det_opts = filter->decoder_opts->det_opts;
+  *decoder = new SingleUtteranceNnet3IncrementalDecoder(*config,
+                                                        filter->pinned_models->acoustic_model->trans_model,
+                                                        *(filter->pinned_models->acoustic_model->decodable_info_nnet3),
+                                                        *(filter->pinned_models->decode_fst),
+                                                        feature_pipeline);
+}
+
+// Feature extraction and nnet evaluation in one thread, the search in another.
+// With nnet2 this replaces Kaldi's SingleUtteranceNnet2DecoderThreaded, which
+// would have to be polled for its progress; its decoder options, acoustic
+// scale and nnet batch size are used.
+static void gst_kaldinnet2onlinedecoder_new_decoder(Gstkaldinnet2onlinedecoder * filter,
+                                                    SingleUtteranceNnet3DecoderThreaded **decoder) {
+  if (filter->nnet_mode == NNET2) {
+    const OnlineNnet2DecodingThreadedConfig &nnet2_config =
+        *(filter->nnet2_decoding_threaded_config);
+    nnet2::DecodableNnet2OnlineOptions decodable_opts;
+    decodable_opts.acoustic_scale = nnet2_config.acoustic_scale;
+    decodable_opts.max_nnet_batch_size = nnet2_config.nnet_batch_size;
+    g_mutex_lock(&filter->adaptation_state_lock);
+    *decoder = new SingleUtteranceNnet3DecoderThreaded(*(filter->nnet3_decoding_threaded_config),
+                                                       nnet2_config.decoder_opts,
+                                                       filter->feature_info->silence_weighting_config,
+                                                       filter->pinned_models->acoustic_model->trans_model,
+                                                       filter->pinned_models->acoustic_model->am_nnet2,
+                                                       decodable_opts,
+                                                       *(filter->pinned_models->decode_fst),
+                                                       *(filter->feature_info),
+                                                       *(filter->adaptation_state),
+                                                       *(filter->cmvn_state));
+    g_mutex_unlock(&filter->adaptation_state_lock);
+    return;
+  }
+  g_mutex_lock(&filter->adaptation_state_lock);
+  *decoder = new SingleUtteranceNnet3DecoderThreaded(*(filter->nnet3_decoding_threaded_config),
+                                                     *(filter->decoder_opts),
+                                                     *(filter->silence_weighting_config),
+                                                     filter->pinned_models->acoustic_model->trans_model,
+                                                     *(filter->pinned_models->acoustic_model->decodable_info_nnet3),
+                                                     *(filter->pinned_models->decode_fst),
+                                                     *(filter->feature_info),
+                                                     *(filter->adaptation_state),
+                                                     *(filter->cmvn_state));
+  g_mutex_unlock(&filter->adaptation_state_lock);
+}
+
+// Decoding in the decoding task (SingleUtteranceNnet2SegmentDecoder,
+// SingleUtteranceNnet3Decoder or SingleUtteranceNnet3IncrementalDecoder).
+// The decoder is kept for the whole session and reset in place between
+// segments. So is the feature pipeline, except for nnet2, which starts every
+// segment with new features and passes the audio that it didn't decode on
+// to the next segment.
+template<class Decoder>
+class UnthreadedDecodingSession {
+ public:
+  UnthreadedDecodingSession(Gstkaldinnet2onlinedecoder * filter,
+                            int32 frame_subsampling_factor) :
+      filter_(filter),
+      frame_subsampling_factor_(frame_subsampling_factor),
+      feature_pipeline_(NewFeaturePipeline()),
+      features_used_(false),
+      segment_wave_offset_(0),
+      frame_offset_(0),
+      time_skipped_(0.0),
+      start_time_(filter->segment_start_time),
+      frame_shift_(filter->feature_info->FrameShiftInSeconds()) {
+    Decoder *decoder;
+    gst_kaldinnet2onlinedecoder_new_decoder(filter, feature_pipeline_.get(), &decoder);
+    decoder_.reset(decoder);
+    features_per_segment_ = gst_kaldinnet2onlinedecoder_features_per_segment(*decoder_);
+    if (filter->rtf_controller != NULL) {
+      gst_kaldinnet2onlinedecoder_apply_search_limits(filter, *decoder_);
+    }
+  }
+
+  void StartSegment() {
+    if (features_per_segment_ && features_used_) {
+      // the features start where the previous segment ended
+      start_time_ += frame_offset_ * frame_shift_ * frame_subsampling_factor_ + time_skipped_;
+      frame_offset_ = 0;
+      time_skipped_ = 0.0;
+      // from the adaptation state that the previous segments have left
+      gst_kaldinnet2onlinedecoder_wait_for_postprocessing(filter_);
+      OnlineNnet2FeaturePipeline *feature_pipeline = NewFeaturePipeline();
+      gst_kaldinnet2onlinedecoder_set_feature_pipeline(*decoder_, feature_pipeline);
+      feature_pipeline_.reset(feature_pipeline);
+    }
+    features_used_ = true;
+    decoder_->InitDecoding(frame_offset_);
+    silence_weighting_.reset(new OnlineSilenceWeighting(
+        filter_->pinned_models->acoustic_model->trans_model,
+        *(filter_->silence_weighting_config), frame_subsampling_factor_));
+  }
+
+  void AudioDropped(BaseFloat secs) {
+    // not in frame_offset_
+    time_skipped_ += secs;
+  }
+
+  void AcceptWaveform(const VectorBase<BaseFloat> &wave_part, bool input_finished) {
+    gint64 chunk_start_time = g_get_monotonic_time();
+    feature_pipeline_->AcceptWaveform(filter_->sample_rate, wave_part);
+    if (input_finished) {
+      feature_pipeline_->InputFinished();
+    }
 
-      if ((num_seconds_decoded - last_traceback > traceback_period_secs)
-          && (decoder.NumFramesDecoded() > 0)) {
-        Lattice lat;
-        decoder.GetBestPath(false, &lat);
-        gst_kaldinnet2onlinedecoder_partial_result(filter, lat);
-        last_traceback += traceback_period_secs;
+    if (silence_weighting_->Active() &&
+        feature_pipeline_->IvectorFeature() != NULL) {
+      silence_weighting_->ComputeCurrentTraceback(decoder_->Decoder());
+      silence_weighting_->GetDeltaWeights(feature_pipeline_->NumFramesReady(),
+                                          frame_offset_ * frame_subsampling_factor_,
+                                          &delta_weights_);
+      feature_pipeline_->UpdateFrameWeights(delta_weights_);
+    }
+
+    decoder_->AdvanceDecoding();
+    gst_kaldinnet2onlinedecoder_control_rtf(filter_, *decoder_, wave_part.Dim(), chunk_start_time);
+
+    if (features_per_segment_) {
+      segment_wave_.emplace_back(wave_part);
+      // drop the audio before the last decoded frame
+      int64 num_samples_decoded = NumSamplesDecoded();
+      while (!segment_wave_.empty()
+             && segment_wave_offset_ + segment_wave_.front().Dim() <= num_samples_decoded) {
+        segment_wave_offset_ += segment_wave_.front().Dim();
+        segment_wave_.pop_front();
       }
     }
+  }
 
+  // the decoder is always up to date
+  void WaitForDecoder() { }
 
-    if (num_seconds_decoded > 0.1) {
-      GST_DEBUG_OBJECT(filter, "Getting lattice..");
-      decoder.FinalizeDecoding();
-      frame_offset += decoder.NumFramesDecoded();
-      CompactLattice clat;
-      bool end_of_utterance = true;
-      decoder.GetLattice(end_of_utterance, &clat);
-      GST_DEBUG_OBJECT(filter, "Lattice done");
-      if ((filter->lm_fst != NULL) && (filter->big_lm_const_arpa != NULL)) {
-        GST_DEBUG_OBJECT(filter, "Rescoring lattice with a big LM");
-        CompactLattice rescored_lat;
-        if (gst_kaldinnet2onlinedecoder_rescore_big_lm(filter, clat, rescored_lat)) {
-          clat = rescored_lat;
-        }
+  int32 NumFramesDecoded() { return decoder_->NumFramesDecoded(); }
+
+  bool EndpointDetected() {
+    return (decoder_->NumFramesDecoded() > 0)
+        && decoder_->EndpointDetected(*(filter_->endpoint_config));
+  }
+
+  // the rest of the audio is decoded in the next segment
+  void TerminateDecoding() { }
+
+  void GetPartialLattice(Lattice *lat) {
+    gst_kaldinnet2onlinedecoder_partial_lattice(*decoder_, lat);
+  }
+
+  void FinishSegment(Vector<BaseFloat> *remaining_wave_part) {
+    if (!features_per_segment_) {
+      // the rest of the audio is in the features of the next segment
+      return;
+    }
+    int64 num_samples_stored = 0;
+    for (size_t i = 0; i < segment_wave_.size(); i++) {
+      num_samples_stored += segment_wave_[i].Dim();
+    }
+    int64 skip = std::min(num_samples_stored,
+                          std::max<int64>(0, NumSamplesDecoded() - segment_wave_offset_));
+    remaining_wave_part->Resize(num_samples_stored - skip, kUndefined);
+    int64 pos = 0;  // position in the stored audio
+    int32 dim = 0;  // samples written to remaining_wave_part
+    for (size_t i = 0; i < segment_wave_.size(); i++) {
+      const Vector<BaseFloat> &piece = segment_wave_[i];
+      int32 start = static_cast<int32>(std::max<int64>(0, std::min<int64>(skip - pos, piece.Dim())));
+      if (start < piece.Dim()) {
+        remaining_wave_part->Range(dim, piece.Dim() - start).CopyFromVec(
+            piece.Range(start, piece.Dim() - start));
+        dim += piece.Dim() - start;
       }
-      if (strcmp(filter->rescore_socket, "") != 0) {
-        GST_DEBUG_OBJECT(filter, "Rescoring lattice on a remote rescorer-worker");
-        CompactLattice rescored_lat;
-        if (gst_kaldinnet2onlinedecoder_rescore_remote(filter, clat, rescored_lat)) {
-          clat = rescored_lat;
+      pos += piece.Dim();
+    }
+    segment_wave_.clear();
+    segment_wave_offset_ = 0;
+    if ((filter_->vad != NULL) && filter_->vad->InSilence()) {
+      // the undecoded rest is silence, skip it like the silence that follows
+      remaining_wave_part->Resize(0);
+    }
+    filter_->total_time_decoded -= 1.0 * remaining_wave_part->Dim() / filter_->sample_rate;
+  }
+
+  void GetFinalLattice(CompactLattice *clat) {
+    decoder_->FinalizeDecoding();
+    frame_offset_ += decoder_->NumFramesDecoded();
+    gst_kaldinnet2onlinedecoder_final_lattice(*decoder_, clat);
+  }
+
+  void EmitFinalResult(CompactLattice &clat) {
+    gst_kaldinnet2onlinedecoder_emit_final_result(filter_, clat, *feature_pipeline_);
+  }
+
+  void DiscardSegment() {
+    // the features of the discarded audio are skipped by the next segment
+    frame_offset_ += decoder_->NumFramesDecoded();
+  }
+
+  void SegmentDone() {
+    filter_->segment_start_time = start_time_
+        + frame_offset_ * frame_shift_ * frame_subsampling_factor_ + time_skipped_;
+  }
+
+ private:
+  OnlineNnet2FeaturePipeline *NewFeaturePipeline() {
+    OnlineNnet2FeaturePipeline *feature_pipeline =
+        new OnlineNnet2FeaturePipeline(*(filter_->feature_info));
+    g_mutex_lock(&filter_->adaptation_state_lock);
+    feature_pipeline->SetAdaptationState(*(filter_->adaptation_state));
+    feature_pipeline->SetCmvnState(*(filter_->cmvn_state));
+    g_mutex_unlock(&filter_->adaptation_state_lock);
+    return feature_pipeline;
+  }
+
+  // Samples of the features up to the last decoded frame
+  int64 NumSamplesDecoded() {
+    return static_cast<int64>((frame_offset_ + decoder_->NumFramesDecoded())
+                              * frame_shift_ * frame_subsampling_factor_
+                              * filter_->sample_rate);
+  }
+
+  Gstkaldinnet2onlinedecoder *filter_;
+  int32 frame_subsampling_factor_;
+  std::unique_ptr<OnlineNnet2FeaturePipeline> feature_pipeline_;
+  std::unique_ptr<Decoder> decoder_;
+  bool features_per_segment_;
+  // whether the current features have been used by a segment
+  bool features_used_;
+  // with features_per_segment_: the audio of the features from sample
+  // segment_wave_offset_ on, which may not be decoded yet
+  std::deque<Vector<BaseFloat> > segment_wave_;
+  int64 segment_wave_offset_;
+  std::unique_ptr<OnlineSilenceWeighting> silence_weighting_;
+  std::vector<std::pair<int32, BaseFloat> > delta_weights_;
+  int32 frame_offset_;
+  // audio removed by the VAD
+  BaseFloat time_skipped_;
+  BaseFloat start_time_;
+  BaseFloat frame_shift_;
+};
+
+// Decoding with a decoder that runs in background threads
+// (SingleUtteranceNnet3DecoderThreaded, with an nnet2 or nnet3 model).
+// A new decoder is started for every segment; the audio that it didn't
+// decode is passed on to the next one.
+template<class Decoder>
+class ThreadedDecodingSession {
+ public:
+  explicit ThreadedDecodingSession(Gstkaldinnet2onlinedecoder * filter) :
+      filter_(filter) { }
+
+  void StartSegment() {
+    decoder_.reset();
+    // the new decoder starts from the adaptation state of the previous segments
+    gst_kaldinnet2onlinedecoder_wait_for_postprocessing(filter_);
+    Decoder *decoder;
+    gst_kaldinnet2onlinedecoder_new_decoder(filter_, &decoder);
+    decoder_.reset(decoder);
+  }
+
+  void AudioDropped(BaseFloat secs) { }
+
+  void AcceptWaveform(const VectorBase<BaseFloat> &wave_part, bool input_finished) {
+    GST_DEBUG_OBJECT(filter_, "Submitting wave of size: %d", wave_part.Dim());
+    decoder_->AcceptWaveform(filter_->sample_rate, wave_part);
+    if (input_finished) {
+      decoder_->InputFinished();
+    }
+  }
+
+  // Wait until at most max-decoder-lag-frames are left to decode
+  void WaitForDecoder() {
+    gst_kaldinnet2onlinedecoder_wait_for_decoder(filter_, *decoder_);
+  }
+
+  int32 NumFramesDecoded() { return decoder_->NumFramesDecoded(); }
+
+  bool EndpointDetected() {
+    GST_DEBUG_OBJECT(filter_, "Before waiting for the decoder: Frames received: ~ %d, frames decoded: %d, pieces pending: %d",
+                     decoder_->NumFramesReceivedApprox(),
+                     decoder_->NumFramesDecoded(),
+                     decoder_->NumWaveformPiecesPending());
+    WaitForDecoder();
+    GST_DEBUG_OBJECT(filter_, "After waiting for the decoder: Frames received: ~ %d, frames decoded: %d, pieces pending: %d",
+                     decoder_->NumFramesReceivedApprox(),
+                     decoder_->NumFramesDecoded(),
+                     decoder_->NumWaveformPiecesPending());
+    return (decoder_->NumFramesDecoded() > 0)
+        && decoder_->EndpointDetected(*(filter_->endpoint_config));
+  }
+
+  void TerminateDecoding() { decoder_->TerminateDecoding(); }
+
+  void GetPartialLattice(Lattice *lat) {
+    decoder_->GetBestPath(false, lat, NULL);
+  }
+
+  void FinishSegment(Vector<BaseFloat> *remaining_wave_part) {
+    decoder_->Wait();
+    decoder_->GetRemainingWaveform(remaining_wave_part);
+    GST_DEBUG_OBJECT(filter_, "Remaining waveform size: %d", remaining_wave_part->Dim());
+    if ((filter_->vad != NULL) && filter_->vad->InSilence()) {
+      // the undecoded rest is silence, skip it like the silence that follows
+      remaining_wave_part->Resize(0);
+    }
+    filter_->total_time_decoded -= 1.0 * remaining_wave_part->Dim() / filter_->sample_rate;
+  }
+
+  void GetFinalLattice(CompactLattice *clat) {
+    decoder_->FinalizeDecoding();
+    bool end_of_utterance = true;
+    decoder_->GetLattice(end_of_utterance, clat, NULL);
+  }
+
+  void EmitFinalResult(CompactLattice &clat) {
+    gst_kaldinnet2onlinedecoder_emit_final_result(filter_, clat, *decoder_);
+  }
+
+  void DiscardSegment() { }
+
+  void SegmentDone() {
+    filter_->segment_start_time = filter_->total_time_decoded;
+  }
+
+ private:
+  Gstkaldinnet2onlinedecoder *filter_;
+  std::unique_ptr<Decoder> decoder_;
+};
+
+// Decodes the chunks of a stream with the models that were current when it
+// was created. Segments are ended at endpoints and long silences.
+class DecodingEngineBase {
+ public:
+  virtual ~DecodingEngineBase() { }
+
+  // Decodes a chunk of audio; 'more_data' is false for the last chunk of the
+  // stream. Returns false when the engine can't decode more: the stream has
+  // ended or the models have changed.
+  virtual bool DecodeChunk(const Vector<BaseFloat> &wave_part,
+                           BaseFloat dropped_secs, bool more_data) = 0;
+};
+
+// The per-chunk decoding, specialized at compile time for each kind of
+// decoder by a session class (UnthreadedDecodingSession or
+// ThreadedDecodingSession)
+template<class Session>
+class DecodingEngine : public DecodingEngineBase {
+ public:
+  // Takes ownership of 'session'
+  DecodingEngine(Gstkaldinnet2onlinedecoder * filter, Session *session,
+                 BaseFloat traceback_period_secs,
+                 Vector<BaseFloat> *remaining_wave_part) :
+      filter_(filter),
+      session_(session),
+      traceback_period_secs_(traceback_period_secs),
+      remaining_wave_part_(remaining_wave_part),
+      in_segment_(false),
+      last_traceback_(0.0),
+      num_seconds_decoded_(0.0) { }
+
+  bool DecodeChunk(const Vector<BaseFloat> &wave_part,
+                   BaseFloat dropped_secs, bool more_data) {
+    if (!in_segment_) {
+      StartSegment();
+    }
+    session_->AudioDropped(dropped_secs);
+    if (num_seconds_decoded_ == 0.0) {
+      // leading silence that was skipped belongs before the segment
+      filter_->segment_start_time += dropped_secs;
+    }
+    if (wave_part.Dim() == 0 && more_data) {
+      return true;
+    }
+
+    session_->AcceptWaveform(wave_part, !more_data);
+    GST_DEBUG_OBJECT(filter_, "%d frames decoded", session_->NumFramesDecoded());
+    num_seconds_decoded_ += 1.0 * wave_part.Dim() / filter_->sample_rate;
+    filter_->total_time_decoded += 1.0 * wave_part.Dim() / filter_->sample_rate;
+    GST_DEBUG_OBJECT(filter_, "Total amount of audio processed: %f seconds", filter_->total_time_decoded);
+
+    if (more_data) {
+      if ((filter_->vad != NULL) && filter_->vad->InSilence()) {
+        session_->TerminateDecoding();
+        GST_DEBUG_OBJECT(filter_, "Long silence detected, ending segment");
+      } else if (filter_->do_endpointing && session_->EndpointDetected()) {
+        session_->TerminateDecoding();
+        GST_DEBUG_OBJECT(filter_, "Endpoint detected!");
+      } else {
+        if ((num_seconds_decoded_ - last_traceback_ > traceback_period_secs_)
+            && (session_->NumFramesDecoded() > 0)) {
+          Lattice lat;
+          session_->GetPartialLattice(&lat);
+          gst_kaldinnet2onlinedecoder_emit_partial_result(filter_, lat);
+          last_traceback_ += traceback_period_secs_;
         }
+        return true;
       }
+    }
 
-      guint num_words = 0;
-      gst_kaldinnet2onlinedecoder_final_result(filter, clat, &num_words);
-      if (num_words >= filter->min_words_for_ivector && filter->last_conf > 0.3) {
-        // Only update adaptation state if the utterance contained enough words
-        feature_pipeline.GetAdaptationState(filter->adaptation_state);
-        feature_pipeline.GetCmvnState(filter->cmvn_state);
-      }
+    EndSegment();
+    if (!more_data) {
+      return false;
+    }
+    if (std::atomic_load(filter_->models).get() != filter_->pinned_models) {
+      // the decoder keeps using the graph it was created with, so pick up
+      // the new models with a new decoder
+      GST_DEBUG_OBJECT(filter_, "Models have changed, restarting the decoder");
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  void StartSegment() {
+    session_->StartSegment();
+    in_segment_ = true;
+    last_traceback_ = 0.0;
+    num_seconds_decoded_ = 0.0;
+    if (remaining_wave_part_->Dim() > 0) {
+      GST_DEBUG_OBJECT(filter_, "Submitting remaining wave of size %d", remaining_wave_part_->Dim());
+      session_->AcceptWaveform(*remaining_wave_part_, false);
+      num_seconds_decoded_ += 1.0 * remaining_wave_part_->Dim() / filter_->sample_rate;
+      filter_->total_time_decoded += 1.0 * remaining_wave_part_->Dim() / filter_->sample_rate;
+      session_->WaitForDecoder();
+    }
+  }
+
+  void EndSegment() {
+    session_->FinishSegment(remaining_wave_part_);
+    if (num_seconds_decoded_ > 0.1) {
+      GST_DEBUG_OBJECT(filter_, "Getting lattice..");
+      CompactLattice clat;
+      session_->GetFinalLattice(&clat);
+      GST_DEBUG_OBJECT(filter_, "Lattice done");
+      session_->EmitFinalResult(clat);
+    } else {
+      GST_DEBUG_OBJECT(filter_, "Less than 0.1 seconds decoded, discarding");
+      session_->DiscardSegment();
+    }
+    session_->SegmentDone();
+    in_segment_ = false;
+  }
+
+  Gstkaldinnet2onlinedecoder *filter_;
+  std::unique_ptr<Session> session_;
+  BaseFloat traceback_period_secs_;
+  // audio that a threaded decoder didn't decode before the end of a segment
+  Vector<BaseFloat> *remaining_wave_part_;
+  bool in_segment_;
+  BaseFloat last_traceback_;
+  BaseFloat num_seconds_decoded_;
+};
+
+// An engine for the pinned models and the decoder that the properties ask for
+static DecodingEngineBase *gst_kaldinnet2onlinedecoder_new_engine(
+    Gstkaldinnet2onlinedecoder * filter, BaseFloat traceback_period_secs,
+    Vector<BaseFloat> *remaining_wave_part) {
+  if (filter->use_threaded_decoder) {
+    typedef ThreadedDecodingSession<SingleUtteranceNnet3DecoderThreaded> Session;
+    return new DecodingEngine<Session>(filter, new Session(filter),
+                                       traceback_period_secs, remaining_wave_part);
+  } else if (filter->nnet_mode == NNET2) {
+    typedef UnthreadedDecodingSession<SingleUtteranceNnet2SegmentDecoder> Session;
+    return new DecodingEngine<Session>(filter, new Session(filter, 1),
+                                       traceback_period_secs, remaining_wave_part);
+  } else {
+    int32 frame_subsampling_factor = filter->nnet3_decodable_opts->frame_subsampling_factor;
+    if (filter->pinned_models->acoustic_model->batch_scorer != NULL) {
+      typedef UnthreadedDecodingSession<SingleUtteranceNnet3BatchDecoder> Session;
+      return new DecodingEngine<Session>(filter, new Session(filter, frame_subsampling_factor),
+                                         traceback_period_secs, remaining_wave_part);
+    } else if (filter->incremental_lattice) {
+      typedef UnthreadedDecodingSession<SingleUtteranceNnet3IncrementalDecoder> Session;
+      return new DecodingEngine<Session>(filter, new Session(filter, frame_subsampling_factor),
+                                         traceback_period_secs, remaining_wave_part);
     } else {
-      GST_DEBUG_OBJECT(filter, "Less than 0.1 seconds decoded, discarding");
+      typedef UnthreadedDecodingSession<SingleUtteranceNnet3Decoder> Session;
+      return new DecodingEngine<Session>(filter, new Session(filter, frame_subsampling_factor),
+                                         traceback_period_secs, remaining_wave_part);
+    }
+  }
+}
+
+// The decoding of a stream, from the first buffer to EOS. The decoding task
+// runs it in one go, reading the audio as it arrives; with use-worker-pool,
+// the worker pool runs it in steps whenever enough audio has arrived.
+class DecodingStream {
+ public:
+  explicit DecodingStream(Gstkaldinnet2onlinedecoder * filter) :
+      filter_(filter),
+      chunk_length_(int32(filter->sample_rate * filter->chunk_length_in_secs)),
+      traceback_period_secs_(filter->traceback_period_in_secs) {
+    GST_DEBUG_OBJECT(filter, "Reading audio in %d sample chunks...", chunk_length_);
+    filter->segment_start_time = 0.0;
+    filter->total_time_decoded = 0.0;
+    filter->compute_wait_secs = 0.0;
+    if (filter->use_vad) {
+      filter->vad = new EnergyVad(filter->sample_rate,
+                                  filter->vad_energy_threshold,
+                                  filter->vad_hangover_secs);
+    }
+    if (filter->rtf_control_config->target_rtf > 0 && !filter->use_threaded_decoder) {
+      const LatticeFasterDecoderConfig &decoder_opts = (filter->nnet_mode == NNET2 ?
+          filter->nnet2_decoding_config->decoder_opts : *(filter->decoder_opts));
+      filter->rtf_controller = new RtfController(*(filter->rtf_control_config),
+                                                 decoder_opts.beam,
+                                                 decoder_opts.max_active);
+    }
+    if (filter->postprocess_in_thread) {
+      filter->postprocessing_queue = g_async_queue_new();
+      filter->postprocessor = g_thread_new("postprocess",
+                                           gst_kaldinnet2onlinedecoder_postprocess,
+                                           filter);
     }
+  }
 
-    filter->segment_start_time = frame_offset * frame_shift * frame_subsampling_factor;
+  ~DecodingStream() {
+    EndEngine();
+    if (filter_->postprocessor != NULL) {
+      // the remaining results go before EOS
+      g_async_queue_push(filter_->postprocessing_queue,
+                         new PostprocessingJob(PostprocessingJob::STOP));
+      g_thread_join(filter_->postprocessor);
+      filter_->postprocessor = NULL;
+      g_async_queue_unref(filter_->postprocessing_queue);
+      filter_->postprocessing_queue = NULL;
+    }
+    delete filter_->vad;
+    filter_->vad = NULL;
+    delete filter_->rtf_controller;
+    filter_->rtf_controller = NULL;
   }
-  
+
+  // True if a chunk can be decoded without waiting for audio
+  bool CanDecodeChunk() {
+    return !filter_->audio_source->ReadWouldBlock(chunk_length_);
+  }
+
+  // Decodes the next chunk, waiting for the audio if needed. Returns false
+  // after the last chunk of the stream.
+  bool DecodeChunk() {
+    if (!engine_) {
+      // New decoders start from the adaptation state, which the
+      // post-processing of the previous segments may still update
+      gst_kaldinnet2onlinedecoder_wait_for_postprocessing(filter_);
+      // Each segment is decoded with the models that were current when it
+      // started; models that are set in the meantime are used from the next
+      // segment on
+      models_ = std::atomic_load(filter_->models);
+      filter_->pinned_models = models_.get();
+      filter_->pinned_snapshot = &models_;
+      engine_.reset(gst_kaldinnet2onlinedecoder_new_engine(filter_, traceback_period_secs_,
+                                                          &remaining_wave_part_));
+    }
+    BaseFloat dropped_secs;
+    bool more_data = gst_kaldinnet2onlinedecoder_read_audio(filter_, chunk_length_,
+                                                            &wave_part_, &dropped_secs);
+    bool segment_continues;
+    {
+      // the audio has been read, so the slot is only held while computing
+      ComputeSlot slot(&filter_->compute_wait_secs);
+      segment_continues = engine_->DecodeChunk(wave_part_, dropped_secs, more_data);
+    }
+    if (!segment_continues) {
+      EndEngine();
+      filter_->segment_start_time = filter_->total_time_decoded;
+    }
+    return more_data;
+  }
+
+ private:
+  void EndEngine() {
+    // the decoders use the pinned models
+    engine_.reset();
+    filter_->pinned_models = NULL;
+    filter_->pinned_snapshot = NULL;
+    models_.reset();
+  }
+
+  Gstkaldinnet2onlinedecoder *filter_;
+  int32 chunk_length_;
+  BaseFloat traceback_period_secs_;
+  Vector<BaseFloat> wave_part_;
+  Vector<BaseFloat> remaining_wave_part_;
+  std::shared_ptr<const ModelSnapshot> models_;
+  std::unique_ptr<DecodingEngineBase> engine_;
+};
+
+static int gst_kaldinnet2onlinedecoder_input_rate(
+    Gstkaldinnet2onlinedecoder * filter) {
+  return filter->input_sample_rate > 0 ? filter->input_sample_rate : filter->sample_rate;
+}
+
+static void gst_kaldinnet2onlinedecoder_set_queue_limit(
+    Gstkaldinnet2onlinedecoder * filter) {
+  if (filter->audio_source) {
+    filter->audio_source->SetQueueLimit(
+        size_t(filter->max_queued_audio_secs * gst_kaldinnet2onlinedecoder_input_rate(filter)),
+        static_cast<QueueOverflowPolicy>(filter->queue_overflow_policy));
+  }
+}
+
+static void gst_kaldinnet2onlinedecoder_set_resampling(
+    Gstkaldinnet2onlinedecoder * filter, GstAudioSource *audio_source) {
+  audio_source->SetResampling(gst_kaldinnet2onlinedecoder_input_rate(filter),
+                              filter->sample_rate,
+                              static_cast<ResampleQuality>(filter->resample_quality));
+}
+
+static GstAudioSource *gst_kaldinnet2onlinedecoder_new_audio_source(
+    Gstkaldinnet2onlinedecoder * filter) {
+  GstAudioSource *audio_source;
+  if (filter->use_lockfree_audio_source) {
+    GST_DEBUG_OBJECT(filter, "Using lock-free audio source");
+    float length_in_secs = std::max(float(LOCKFREE_AUDIO_SOURCE_LENGTH_IN_SECS),
+                                    filter->max_queued_audio_secs);
+    // sized for the widest format, since the caps may only arrive later
+    audio_source = new GstRingBufferSource(length_in_secs *
+                                           gst_kaldinnet2onlinedecoder_input_rate(filter) *
+                                           kMaxSampleWidth);
+  } else {
+    audio_source = new GstBufferSource();
+  }
+  audio_source->SetSampleFormat(filter->sample_format);
+  gst_kaldinnet2onlinedecoder_set_resampling(filter, audio_source);
+  audio_source->SetQueueLimit(
+      size_t(filter->max_queued_audio_secs * gst_kaldinnet2onlinedecoder_input_rate(filter)),
+      static_cast<QueueOverflowPolicy>(filter->queue_overflow_policy));
+  return audio_source;
+}
+
+// After the last chunk of a stream: sends EOS and gets ready for the next
+// stream
+static void gst_kaldinnet2onlinedecoder_end_stream(Gstkaldinnet2onlinedecoder * filter) {
+  GST_DEBUG_OBJECT(filter, "Pushing EOS event");
+  gst_pad_push_event(filter->srcpad, gst_event_new_eos());
+  if (!filter->use_worker_pool) {
+    GST_DEBUG_OBJECT(filter, "Pausing decoding task");
+    gst_pad_pause_task(filter->srcpad);
+  }
+  GstAudioSource *audio_source = gst_kaldinnet2onlinedecoder_new_audio_source(filter);
+  // the stream may have ended because of a flush while the chain function
+  // is still pushing to the source, which it does under the stream lock.
+  // Other threads only use the source under the step lock while 'decoding'
+  // is set, so both change together.
+  GST_PAD_STREAM_LOCK(filter->sinkpad);
+  g_mutex_lock(&filter->step_lock);
+  std::swap(filter->audio_source, audio_source);
+  filter->decoding = false;
+  g_mutex_unlock(&filter->step_lock);
+  GST_PAD_STREAM_UNLOCK(filter->sinkpad);
+  delete audio_source;
+}
+
+// Replaces the audio source with an empty one while no stream is decoded.
+// The pointer is changed under the step lock, under which other threads
+// than the streaming thread use the source.
+static void gst_kaldinnet2onlinedecoder_replace_audio_source(
+    Gstkaldinnet2onlinedecoder * filter) {
+  GstAudioSource *audio_source = gst_kaldinnet2onlinedecoder_new_audio_source(filter);
+  g_mutex_lock(&filter->step_lock);
+  std::swap(filter->audio_source, audio_source);
+  g_mutex_unlock(&filter->step_lock);
+  delete audio_source;
+}
+
+// Whether a stream is being decoded; 'decoding' is changed by the decoding
+// thread or a worker of the pool, so it is read under the step lock
+static bool gst_kaldinnet2onlinedecoder_is_decoding(Gstkaldinnet2onlinedecoder * filter) {
+  g_mutex_lock(&filter->step_lock);
+  bool decoding = filter->decoding;
+  g_mutex_unlock(&filter->step_lock);
+  return decoding;
 }
 
 static void gst_kaldinnet2onlinedecoder_loop(
     Gstkaldinnet2onlinedecoder * filter) {
 
   GST_DEBUG_OBJECT(filter, "Starting decoding loop..");
-  BaseFloat traceback_period_secs = filter->traceback_period_in_secs;
+  // the post-processing and decoder threads started from here inherit it;
+  // the task thread comes from a pool that is shared with other elements,
+  // so it is unpinned again when the stream is done
+  ScopedCpuAffinity pinned(*(filter->cpu_affinity));
+  if (!filter->cpu_affinity->Empty() && !pinned.Applied()) {
+    GST_WARNING_OBJECT(filter, "Could not pin the decoding thread to CPUs %s",
+                       filter->cpu_affinity_spec);
+  }
+  DecodingStream *stream = new DecodingStream(filter);
+  while (stream->DecodeChunk()) {
+  }
+  delete stream;
+  GST_DEBUG_OBJECT(filter, "Finished decoding loop");
+  gst_kaldinnet2onlinedecoder_end_stream(filter);
+}
 
-  int32 chunk_length = int32(filter->sample_rate * filter->chunk_length_in_secs);
+// Chunks a stream may decode before the other streams get their turn
+#define MAX_CHUNKS_PER_STEP 20
 
-  bool more_data = true;
-  Vector<BaseFloat> remaining_wave_part;
-  filter->segment_start_time = 0.0;
-  filter->total_time_decoded = 0.0;
-  while (more_data) {
-    if (filter->nnet_mode == NNET2) {
-      if (filter->use_threaded_decoder) {
-        gst_kaldinnet2onlinedecoder_threaded_decode_segment(filter, more_data, chunk_length, traceback_period_secs, &remaining_wave_part);
-      } else {
-        gst_kaldinnet2onlinedecoder_unthreaded_decode_segment(filter, more_data, chunk_length, traceback_period_secs);
-      }
-    } else {
-      gst_kaldinnet2onlinedecoder_nnet3_unthreaded_decode_segment(filter, more_data, chunk_length, traceback_period_secs);
+static void gst_kaldinnet2onlinedecoder_step(gpointer data, gpointer user_data);
+
+// The process-wide pool that decodes the streams of all elements with
+// use-worker-pool, one worker per CPU core or per slot of the compute budget
+static GThreadPool *gst_kaldinnet2onlinedecoder_worker_pool() {
+  static gsize initialized = 0;
+  static GThreadPool *pool = NULL;
+  if (g_once_init_enter(&initialized)) {
+    int32 num_workers = ComputeBudget::Instance().MaxThreads();
+    if (num_workers == 0) {
+      num_workers = g_get_num_processors();
     }
-    filter->segment_start_time = filter->total_time_decoded;
+    pool = g_thread_pool_new(gst_kaldinnet2onlinedecoder_step, NULL,
+                             num_workers, FALSE, NULL);
+    g_once_init_leave(&initialized, 1);
   }
+  return pool;
+}
 
-  GST_DEBUG_OBJECT(filter, "Finished decoding loop");
-  GST_DEBUG_OBJECT(filter, "Pushing EOS event");
-  gst_pad_push_event(filter->srcpad, gst_event_new_eos());
+// Makes sure that a step of the stream is queued or running; called after
+// audio has been pushed or the stream has ended
+static void gst_kaldinnet2onlinedecoder_schedule_step(Gstkaldinnet2onlinedecoder * filter) {
+  g_mutex_lock(&filter->step_lock);
+  if (filter->decoding && !filter->step_scheduled) {
+    filter->step_scheduled = true;
+    g_thread_pool_push(gst_kaldinnet2onlinedecoder_worker_pool(), filter, NULL);
+  }
+  g_mutex_unlock(&filter->step_lock);
+}
+
+static void gst_kaldinnet2onlinedecoder_step_done(Gstkaldinnet2onlinedecoder * filter) {
+  filter->step_scheduled = false;
+  g_cond_broadcast(&filter->step_cond);
+  g_mutex_unlock(&filter->step_lock);
+}
 
-  GST_DEBUG_OBJECT(filter, "Pausing decoding task");
-  gst_pad_pause_task(filter->srcpad);
-  delete filter->audio_source;
-  filter->audio_source = new GstBufferSource();
+// Decodes the chunks of a stream that can be decoded without waiting for
+// audio, on a worker of the pool
+static void gst_kaldinnet2onlinedecoder_step(gpointer data, gpointer user_data) {
+  Gstkaldinnet2onlinedecoder *filter = static_cast<Gstkaldinnet2onlinedecoder*>(data);
+  g_mutex_lock(&filter->step_lock);
+  if (!filter->decoding) {
+    // stopped by stop_steps()
+    gst_kaldinnet2onlinedecoder_step_done(filter);
+    return;
+  }
+  g_mutex_unlock(&filter->step_lock);
+  if (filter->stream == NULL) {
+    GST_DEBUG_OBJECT(filter, "Starting to decode a stream on the worker pool");
+    filter->stream = new DecodingStream(filter);
+  }
+  int32 num_chunks = 0;
+  while (true) {
+    g_mutex_lock(&filter->step_lock);
+    // when stopped while decoding, the stream is deleted by stop_steps();
+    // audio that was pushed before the check is seen here, audio pushed
+    // after it schedules a new step
+    if (!filter->decoding || !filter->stream->CanDecodeChunk()) {
+      gst_kaldinnet2onlinedecoder_step_done(filter);
+      return;
+    }
+    g_mutex_unlock(&filter->step_lock);
+    if (!filter->stream->DecodeChunk()) {
+      delete filter->stream;
+      filter->stream = NULL;
+      GST_DEBUG_OBJECT(filter, "Finished decoding a stream on the worker pool");
+      gst_kaldinnet2onlinedecoder_end_stream(filter);
+      g_mutex_lock(&filter->step_lock);
+      gst_kaldinnet2onlinedecoder_step_done(filter);
+      return;
+    }
+    if (++num_chunks == MAX_CHUNKS_PER_STEP) {
+      // to the back of the queue, still scheduled
+      g_thread_pool_push(gst_kaldinnet2onlinedecoder_worker_pool(), filter, NULL);
+      return;
+    }
+  }
+}
+
+// Stops decoding on the worker pool, dropping the rest of the stream
+static void gst_kaldinnet2onlinedecoder_stop_steps(Gstkaldinnet2onlinedecoder * filter) {
+  g_mutex_lock(&filter->step_lock);
   filter->decoding = false;
+  // a step that is waiting for audio gets the rest of it
+  filter->audio_source->SetEnded(true);
+  while (filter->step_scheduled) {
+    g_cond_wait(&filter->step_cond, &filter->step_lock);
+  }
+  g_mutex_unlock(&filter->step_lock);
+  if (filter->stream != NULL) {
+    delete filter->stream;
+    filter->stream = NULL;
+  }
+  // the next stream starts with an empty source that hasn't ended
+  gst_kaldinnet2onlinedecoder_replace_audio_source(filter);
 }
 
 /* GstElement vmethod implementations */
@@ -1820,10 +3197,27 @@ gst_kaldinnet2onlinedecoder_query (GstPad *pad, GstObject * parent, GstQuery * q
           filter->sample_rate = (int) filter->feature_info->mfcc_opts.frame_opts.samp_freq;
       }
 
+      /* The model's sample rate is preferred, other rates are resampled */
       GstCaps *new_caps = gst_caps_new_simple ("audio/x-raw",
-            "format", G_TYPE_STRING, "S16LE",
             "rate", G_TYPE_INT, filter->sample_rate,
             "channels", G_TYPE_INT, 1, NULL);
+      gst_caps_append(new_caps, gst_caps_new_simple ("audio/x-raw",
+            "rate", GST_TYPE_INT_RANGE, 1, G_MAXINT,
+            "channels", G_TYPE_INT, 1, NULL));
+
+      /* All formats are converted natively, S16LE is preferred */
+      GValue formats = G_VALUE_INIT;
+      GValue format = G_VALUE_INIT;
+      g_value_init(&formats, GST_TYPE_LIST);
+      g_value_init(&format, G_TYPE_STRING);
+      const gchar *format_names[] = { "S16LE", "S32LE", "F32LE" };
+      for (size_t i = 0; i < G_N_ELEMENTS(format_names); i++) {
+        g_value_set_static_string(&format, format_names[i]);
+        gst_value_list_append_value(&formats, &format);
+      }
+      gst_caps_set_value(new_caps, "format", &formats);
+      g_value_unset(&format);
+      g_value_unset(&formats);
 
       GST_DEBUG_OBJECT (filter, "Setting caps query result: %" GST_PTR_FORMAT, new_caps);
       gst_query_set_caps_result (query, new_caps);
@@ -1853,8 +3247,19 @@ static gboolean gst_kaldinnet2onlinedecoder_sink_event(GstPad * pad,
 
   switch (GST_EVENT_TYPE(event)) {
     case GST_EVENT_SEGMENT: {
+      if (filter->use_worker_pool) {
+        // the first step starts the stream when audio arrives
+        GST_DEBUG_OBJECT(filter, "Decoding on the worker pool");
+        g_mutex_lock(&filter->step_lock);
+        filter->decoding = true;
+        g_mutex_unlock(&filter->step_lock);
+        ret = TRUE;
+        break;
+      }
       GST_DEBUG_OBJECT(filter, "Starting decoding task");
+      g_mutex_lock(&filter->step_lock);
       filter->decoding = true;
+      g_mutex_unlock(&filter->step_lock);
       gst_pad_start_task(filter->srcpad,
                          (GstTaskFunction) gst_kaldinnet2onlinedecoder_loop,
                          filter, NULL);
@@ -1864,6 +3269,40 @@ static gboolean gst_kaldinnet2onlinedecoder_sink_event(GstPad * pad,
       break;
     }
     case GST_EVENT_CAPS: {
+      GstCaps *caps;
+      gst_event_parse_caps(event, &caps);
+      GstStructure *structure = gst_caps_get_structure(caps, 0);
+      SampleFormat format;
+      if (!SampleFormatFromString(gst_structure_get_string(structure, "format"),
+                                  &format)) {
+        GST_ERROR_OBJECT(filter, "Unsupported caps: %" GST_PTR_FORMAT, caps);
+        ret = FALSE;
+        break;
+      }
+      GST_DEBUG_OBJECT(filter, "Got caps: %" GST_PTR_FORMAT, caps);
+      filter->sample_format = format;
+      filter->audio_source->SetSampleFormat(format);
+      gint rate;
+      if (gst_structure_get_int(structure, "rate", &rate)) {
+        if (rate != filter->sample_rate) {
+          GST_INFO_OBJECT(filter, "Resampling input from %d Hz to %d Hz",
+                          rate, filter->sample_rate);
+        }
+        int previous_rate = gst_kaldinnet2onlinedecoder_input_rate(filter);
+        filter->input_sample_rate = rate;
+        if (filter->use_lockfree_audio_source && rate > previous_rate) {
+          // The ring was sized for fewer samples per second. Between streams
+          // nothing reads from it, so it is replaced by a bigger one.
+          if (!gst_kaldinnet2onlinedecoder_is_decoding(filter)) {
+            gst_kaldinnet2onlinedecoder_replace_audio_source(filter);
+          } else {
+            GST_WARNING_OBJECT(filter, "Input rate increased to %d Hz while decoding, "
+                               "the audio queue holds less audio until the next stream", rate);
+          }
+        }
+        gst_kaldinnet2onlinedecoder_set_resampling(filter, filter->audio_source);
+        gst_kaldinnet2onlinedecoder_set_queue_limit(filter);
+      }
       ret = TRUE;
       break;
     }
@@ -1877,9 +3316,15 @@ static gboolean gst_kaldinnet2onlinedecoder_sink_event(GstPad * pad,
     case GST_EVENT_FLUSH_START: {
       /* flush all buffers */
       GST_DEBUG_OBJECT(filter, "Flush start received");
-      if (filter->decoding) {
+      // not serialized: the decoder may be ending the stream and replacing
+      // the source, which it does under the step lock
+      g_mutex_lock(&filter->step_lock);
+      bool decoding = filter->decoding;
+      if (decoding) {
         filter->audio_source->SetFlush(true);
-      } else {
+      }
+      g_mutex_unlock(&filter->step_lock);
+      if (!decoding) {
         GST_DEBUG_OBJECT(filter, "Flush start received while not decoding, pushing event out");
         gst_pad_push_event(filter->srcpad, gst_event_new_flush_start());
       }
@@ -1889,8 +3334,16 @@ static gboolean gst_kaldinnet2onlinedecoder_sink_event(GstPad * pad,
     case GST_EVENT_EOS: {
       /* end-of-stream, we should close down all stream leftovers here */
       GST_DEBUG_OBJECT(filter, "EOS received");
-      if (filter->decoding) {
+      g_mutex_lock(&filter->step_lock);
+      bool decoding = filter->decoding;
+      if (decoding) {
         filter->audio_source->SetEnded(true);
+      }
+      g_mutex_unlock(&filter->step_lock);
+      if (decoding) {
+        if (filter->use_worker_pool) {
+          gst_kaldinnet2onlinedecoder_schedule_step(filter);
+        }
       } else {
         GST_DEBUG_OBJECT(filter, "EOS received while not decoding, pushing EOS out");
         gst_pad_push_event(filter->srcpad, gst_event_new_eos());
@@ -1918,6 +3371,9 @@ static GstFlowReturn gst_kaldinnet2onlinedecoder_chain(GstPad * pad,
   if (!filter->silent) {
     GST_DEBUG_OBJECT(filter, "Pushing buffer of length %zu", gst_buffer_get_size(buf));
     filter->audio_source->PushBuffer(buf);
+    if (filter->use_worker_pool) {
+      gst_kaldinnet2onlinedecoder_schedule_step(filter);
+    }
   }
   gst_buffer_unref(buf);
   return GST_FLOW_OK;
@@ -1932,6 +3388,91 @@ static GstFlowReturn gst_kaldinnet2onlinedecoder_chain(GstPad * pad,
   }
 }
 
+ModelSnapshot::ModelSnapshot() :
+    acoustic_model(NULL), decode_fst(NULL), word_syms(NULL), phone_syms(NULL),
+    word_boundary_info(NULL), align_lexicon_info(NULL), lm_fst(NULL),
+    big_lm_const_arpa(NULL) {
+}
+
+ModelSnapshot::ModelSnapshot(const ModelSnapshot &other) :
+    acoustic_model(other.acoustic_model), decode_fst(other.decode_fst),
+    word_syms(other.word_syms), phone_syms(other.phone_syms),
+    word_boundary_info(other.word_boundary_info),
+    align_lexicon_info(other.align_lexicon_info), lm_fst(other.lm_fst),
+    big_lm_const_arpa(other.big_lm_const_arpa) {
+  ModelRegistry &registry = ModelRegistry::Instance();
+  registry.Ref(acoustic_model);
+  registry.Ref(decode_fst);
+  registry.Ref(word_syms);
+  registry.Ref(phone_syms);
+  registry.Ref(word_boundary_info);
+  registry.Ref(align_lexicon_info);
+  registry.Ref(lm_fst);
+  registry.Ref(big_lm_const_arpa);
+}
+
+ModelSnapshot::~ModelSnapshot() {
+  ModelRegistry &registry = ModelRegistry::Instance();
+  registry.Release(acoustic_model);
+  registry.Release(decode_fst);
+  registry.Release(word_syms);
+  registry.Release(phone_syms);
+  registry.Release(word_boundary_info);
+  registry.Release(align_lexicon_info);
+  registry.Release(lm_fst);
+  registry.Release(big_lm_const_arpa);
+}
+
+static gpointer
+gst_kaldinnet2onlinedecoder_delete_models(gpointer data) {
+  GAsyncQueue *released_models = static_cast<GAsyncQueue*>(data);
+  while (true) {
+    delete static_cast<ModelSnapshot*>(g_async_queue_pop(released_models));
+  }
+  return NULL;
+}
+
+// The queue of released model snapshots, which one thread in the process
+// deletes in the order they were released
+static GAsyncQueue *gst_kaldinnet2onlinedecoder_released_models() {
+  static gsize initialized = 0;
+  static GAsyncQueue *released_models = NULL;
+  if (g_once_init_enter(&initialized)) {
+    released_models = g_async_queue_new();
+    g_thread_unref(g_thread_new("release-models",
+                                gst_kaldinnet2onlinedecoder_delete_models,
+                                released_models));
+    g_once_init_leave(&initialized, 1);
+  }
+  return released_models;
+}
+
+// Deleter of the model snapshots. The last user of a replaced snapshot is
+// usually the decoding task, which shouldn't stall while a big graph is
+// freed, so this is done on a separate thread.
+static void
+gst_kaldinnet2onlinedecoder_release_models(const ModelSnapshot * models) {
+  g_async_queue_push(gst_kaldinnet2onlinedecoder_released_models(),
+                     const_cast<ModelSnapshot*>(models));
+}
+
+// Publishes a new model snapshot in which 'field' is replaced by 'object',
+// whose reference is taken over by the snapshot. Segments that are being
+// decoded keep using the previous snapshot.
+template<class T>
+static void
+gst_kaldinnet2onlinedecoder_replace_model(Gstkaldinnet2onlinedecoder * filter,
+                                          T *ModelSnapshot::*field, T *object) {
+  // models are loaded in parallel in async-model-loading mode
+  g_mutex_lock(&filter->models_lock);
+  ModelSnapshot *models = new ModelSnapshot(*std::atomic_load(filter->models));
+  ModelRegistry::Instance().Release(models->*field);
+  models->*field = object;
+  std::atomic_store(filter->models, std::shared_ptr<const ModelSnapshot>(
+      models, gst_kaldinnet2onlinedecoder_release_models));
+  g_mutex_unlock(&filter->models_lock);
+}
+
 static void
 gst_kaldinnet2onlinedecoder_load_word_syms(Gstkaldinnet2onlinedecoder * filter,
                                            const GValue * value) {
@@ -1943,18 +3484,19 @@ gst_kaldinnet2onlinedecoder_load_word_syms(Gstkaldinnet2onlinedecoder * filter,
       try {
         GST_DEBUG_OBJECT(filter, "Loading word symbols file: %s", str);
 
-        fst::SymbolTable * new_word_syms = fst::SymbolTable::ReadText(str);
-        if (!new_word_syms) {
-          throw std::runtime_error("Word symbol table not read.");
-        }
-
-        // Delete old objects if needed
-        if (filter->word_syms) {
-          delete filter->word_syms;
-        }
+        fst::SymbolTable * new_word_syms =
+            ModelRegistry::Instance().Acquire<fst::SymbolTable>(
+                "word-syms", str, "", filter->share_models, [str]() -> fst::SymbolTable * {
+                  fst::SymbolTable *word_syms = fst::SymbolTable::ReadText(str);
+                  if (!word_syms) {
+                    throw std::runtime_error("Word symbol table not read.");
+                  }
+                  return word_syms;
+                });
 
         // Replace the symbol table
-        filter->word_syms = new_word_syms;
+        gst_kaldinnet2onlinedecoder_replace_model(filter, &ModelSnapshot::word_syms,
+                                                  new_word_syms);
 
         // Only change the parameter if it has worked correctly
         g_free(filter->word_syms_filename);
@@ -1982,18 +3524,19 @@ gst_kaldinnet2onlinedecoder_load_phone_syms(Gstkaldinnet2onlinedecoder * filter,
       try {
         GST_DEBUG_OBJECT(filter, "Loading phone symbols file: %s", str);
 
-        fst::SymbolTable * new_phone_syms = fst::SymbolTable::ReadText(str);
-        if (!new_phone_syms) {
-          throw std::runtime_error("Phone symbol table not read.");
-        }
-
-        // Delete old objects if needed
-        if (filter->phone_syms) {
-          delete filter->phone_syms;
-        }
+        fst::SymbolTable * new_phone_syms =
+            ModelRegistry::Instance().Acquire<fst::SymbolTable>(
+                "phone-syms", str, "", false, [str]() -> fst::SymbolTable * {
+                  fst::SymbolTable *phone_syms = fst::SymbolTable::ReadText(str);
+                  if (!phone_syms) {
+                    throw std::runtime_error("Phone symbol table not read.");
+                  }
+                  return phone_syms;
+                });
 
         // Replace the symbol table
-        filter->phone_syms = new_phone_syms;
+        gst_kaldinnet2onlinedecoder_replace_model(filter, &ModelSnapshot::phone_syms,
+                                                  new_phone_syms);
 
         // Only change the parameter if it has worked correctly
         g_free(filter->phone_syms_filename);
@@ -2020,19 +3563,16 @@ gst_kaldinnet2onlinedecoder_load_word_boundary_info(Gstkaldinnet2onlinedecoder *
     if (strcmp(str, "") != 0) {
       try {
         GST_DEBUG_OBJECT(filter, "Loading word boundary file: %s", str);
-        WordBoundaryInfoNewOpts opts; // use default opts
-        WordBoundaryInfo* new_word_boundary_info = new WordBoundaryInfo(opts, str);
-        if (!new_word_boundary_info) {
-          throw std::runtime_error("Word boundary info not read.");
-        }
-
-        // Delete old objects if needed
-        if (filter->word_boundary_info) {
-          delete filter->word_boundary_info;
-        }
+        WordBoundaryInfo* new_word_boundary_info =
+            ModelRegistry::Instance().Acquire<WordBoundaryInfo>(
+                "word-boundary-info", str, "", false, [str]() -> WordBoundaryInfo * {
+                  WordBoundaryInfoNewOpts opts; // use default opts
+                  return new WordBoundaryInfo(opts, str);
+                });
 
         // Replace the word boundary info
-        filter->word_boundary_info = new_word_boundary_info;
+        gst_kaldinnet2onlinedecoder_replace_model(filter, &ModelSnapshot::word_boundary_info,
+                                                  new_word_boundary_info);
 
         // Only change the parameter if it has worked correctly
         g_free(filter->word_boundary_info_filename);
@@ -2059,24 +3599,23 @@ gst_kaldinnet2onlinedecoder_load_align_lexicon_info(Gstkaldinnet2onlinedecoder *
     if (strcmp(str, "") != 0) {
       try {
         GST_DEBUG_OBJECT(filter, "Loading align lexicon file: %s", str);
-        std::vector<std::vector<int32> > lexicon;
-        bool binary_in;
-        Input ki(str, &binary_in);
-        KALDI_ASSERT(!binary_in && "Not expecting binary file for lexicon");
-        if (!ReadLexiconForWordAlign(ki.Stream(), &lexicon)) {
-          KALDI_ERR << "Error reading alignment lexicon from "
-                    << str;
-        }
-
-        WordAlignLatticeLexiconInfo* lexicon_info = new WordAlignLatticeLexiconInfo(lexicon);
-
-        // Delete old objects if needed
-        if (filter->align_lexicon_info) {
-          delete filter->align_lexicon_info;
-        }
+        WordAlignLatticeLexiconInfo* lexicon_info =
+            ModelRegistry::Instance().Acquire<WordAlignLatticeLexiconInfo>(
+                "align-lexicon-info", str, "", false, [str]() -> WordAlignLatticeLexiconInfo * {
+                  std::vector<std::vector<int32> > lexicon;
+                  bool binary_in;
+                  Input ki(str, &binary_in);
+                  KALDI_ASSERT(!binary_in && "Not expecting binary file for lexicon");
+                  if (!ReadLexiconForWordAlign(ki.Stream(), &lexicon)) {
+                    KALDI_ERR << "Error reading alignment lexicon from "
+                              << str;
+                  }
+                  return new WordAlignLatticeLexiconInfo(lexicon);
+                });
 
         // Replace the align lexicon info
-        filter->align_lexicon_info = lexicon_info;
+        gst_kaldinnet2onlinedecoder_replace_model(filter, &ModelSnapshot::align_lexicon_info,
+                                                  lexicon_info);
 
         // Only change the parameter if it has worked correctly
         g_free(filter->align_lexicon_info_filename);
@@ -2093,6 +3632,115 @@ gst_kaldinnet2onlinedecoder_load_align_lexicon_info(Gstkaldinnet2onlinedecoder *
   }
 }
 
+static AcousticModel *
+gst_kaldinnet2onlinedecoder_read_acoustic_model(Gstkaldinnet2onlinedecoder * filter,
+                                                const gchar *str) {
+  GST_DEBUG_OBJECT(filter, "Loading acoustic model: %s", str);
+  AcousticModel *acoustic_model = new AcousticModel();
+  try {
+    bool binary;
+    Input ki(str, &binary);
+    if (filter->nnet_mode == NNET3 && IsInt8Nnet3Model(ki.Stream(), binary)) {
+      // written by nnet3-quantize-int8
+      GST_DEBUG_OBJECT(filter, "Acoustic model has int8 layers");
+      ReadInt8Nnet3Model(ki.Stream(), binary, &(acoustic_model->trans_model),
+                         &(acoustic_model->am_nnet3));
+    } else {
+      acoustic_model->trans_model.Read(ki.Stream(), binary);
+      if (filter->nnet_mode == NNET2) {
+        acoustic_model->am_nnet2.Read(ki.Stream(), binary);
+      } else {
+        acoustic_model->am_nnet3.Read(ki.Stream(), binary);
+      }
+    }
+    if (filter->nnet_mode == NNET3) {
+      SetBatchnormTestMode(true, &(acoustic_model->am_nnet3.GetNnet()));
+      SetDropoutTestMode(true, &(acoustic_model->am_nnet3.GetNnet()));
+      if (filter->batch_scoring) {
+        // takes a copy of the nnet before the decodable info modifies it
+        nnet3::NnetBatchComputerOptions batch_opts;
+        nnet3::NnetSimpleLoopedComputationOptions *opts = filter->nnet3_decodable_opts;
+        batch_opts.frame_subsampling_factor = opts->frame_subsampling_factor;
+        batch_opts.frames_per_chunk = opts->frames_per_chunk;
+        batch_opts.acoustic_scale = opts->acoustic_scale;
+        batch_opts.optimize_config = opts->optimize_config;
+        batch_opts.compute_config = opts->compute_config;
+        acoustic_model->batch_scorer = new NnetBatchScorer(*(filter->batch_scorer_config),
+                                                           batch_opts,
+                                                           acoustic_model->am_nnet3.GetNnet(),
+                                                           acoustic_model->am_nnet3.Priors());
+      }
+      // this object contains precomputed stuff that is used by all decodable
+      // objects.  It takes a pointer to am_nnet because if it has iVectors it has
+      // to modify the nnet to accept iVectors at intervals.
+      acoustic_model->decodable_info_nnet3 =
+          new nnet3::DecodableNnetSimpleLoopedInfo(*(filter->nnet3_decodable_opts),
+                                                   &(acoustic_model->am_nnet3));
+    }
+  } catch (...) {
+    delete acoustic_model;
+    throw;
+  }
+  return acoustic_model;
+}
+
+// Models that are loaded by threads pinned to different NUMA nodes are
+// not shared, so that every node has its own copy
+static std::string
+gst_kaldinnet2onlinedecoder_numa_key(Gstkaldinnet2onlinedecoder * filter) {
+  if (filter->cpu_affinity->Empty()) {
+    return "";
+  }
+  return " nodes " + filter->cpu_affinity->NumaNodes();
+}
+
+// Writes all options that a config registers, so that they can be part of
+// a model registry key
+template<class Config>
+static void
+gst_kaldinnet2onlinedecoder_write_config(Config *config, std::ostream &os) {
+  SimpleOptions options;
+  config->Register(&options);
+  std::vector<std::pair<std::string, SimpleOptions::OptionInfo> > option_info_list =
+      options.GetOptionInfoList();
+  for (size_t i = 0; i < option_info_list.size(); i++) {
+    const std::string &name = option_info_list[i].first;
+    os << " " << name << "=";
+    bool tmp_bool;
+    int32 tmp_int;
+    uint32 tmp_uint;
+    float tmp_float;
+    double tmp_double;
+    std::string tmp_string;
+    switch (option_info_list[i].second.type) {
+      case SimpleOptions::kBool:
+        options.GetOption(name, &tmp_bool);
+        os << tmp_bool;
+        break;
+      case SimpleOptions::kInt32:
+        options.GetOption(name, &tmp_int);
+        os << tmp_int;
+        break;
+      case SimpleOptions::kUint32:
+        options.GetOption(name, &tmp_uint);
+        os << tmp_uint;
+        break;
+      case SimpleOptions::kFloat:
+        options.GetOption(name, &tmp_float);
+        os << tmp_float;
+        break;
+      case SimpleOptions::kDouble:
+        options.GetOption(name, &tmp_double);
+        os << tmp_double;
+        break;
+      case SimpleOptions::kString:
+        options.GetOption(name, &tmp_string);
+        os << tmp_string;
+        break;
+    }
+  }
+}
+
 static void
 gst_kaldinnet2onlinedecoder_load_model(Gstkaldinnet2onlinedecoder * filter,
                                        const GValue * value) {
@@ -2101,37 +3749,34 @@ gst_kaldinnet2onlinedecoder_load_model(Gstkaldinnet2onlinedecoder * filter,
 
     // Check if the model filename is not empty
     if (strcmp(str, "") != 0) {
-      // Build objects if needed
-      if (!filter->trans_model) {
-        filter->trans_model = new TransitionModel();
-      }
-
-      if (!filter->am_nnet2) {
-        filter->am_nnet2 = new nnet2::AmNnet();
-      }
-
-      if (!filter->am_nnet3) {
-        filter->am_nnet3 = new nnet3::AmNnetSimple();
-      }
-
-      // Make the objects read the new models
       try {
-        bool binary;
-        Input ki(str, &binary);
-        filter->trans_model->Read(ki.Stream(), binary);
-        if (filter->nnet_mode == NNET2) {
-          filter->am_nnet2->Read(ki.Stream(), binary);
-        }
-        else {
-          filter->am_nnet3->Read(ki.Stream(), binary);
-          SetBatchnormTestMode(true, &(filter->am_nnet3->GetNnet()));
-          SetDropoutTestMode(true, &(filter->am_nnet3->GetNnet()));
-          // this object contains precomputed stuff that is used by all decodable
-          // objects.  It takes a pointer to am_nnet because if it has iVectors it has
-          // to modify the nnet to accept iVectors at intervals.
-          filter->decodable_info_nnet3 = new nnet3::DecodableNnetSimpleLoopedInfo(*(filter->nnet3_decodable_opts),
-                                                                                  filter->am_nnet3);          
+        // The decodable info depends on the nnet3 options, so models loaded
+        // with different options can't be shared
+        std::ostringstream options;
+        options << "nnet" << filter->nnet_mode;
+        if (filter->nnet_mode == NNET3) {
+          nnet3::NnetSimpleLoopedComputationOptions *opts = filter->nnet3_decodable_opts;
+          options << " " << opts->extra_left_context_initial
+                  << " " << opts->frame_subsampling_factor
+                  << " " << opts->frames_per_chunk
+                  << " " << opts->acoustic_scale;
+          gst_kaldinnet2onlinedecoder_write_config(&(opts->optimize_config), options);
+          gst_kaldinnet2onlinedecoder_write_config(&(opts->compute_config), options);
+          if (filter->batch_scoring) {
+            options << " batch " << filter->batch_scorer_config->minibatch_size
+                    << " " << filter->batch_scorer_config->max_wait_ms;
+          }
         }
+        options << gst_kaldinnet2onlinedecoder_numa_key(filter);
+        AcousticModel *new_acoustic_model =
+            ModelRegistry::Instance().Acquire<AcousticModel>(
+                "acoustic-model", str, options.str(), filter->share_models, [filter, str]() {
+                  ScopedCpuAffinity pinned(*(filter->cpu_affinity));
+                  return gst_kaldinnet2onlinedecoder_read_acoustic_model(filter, str);
+                });
+
+        gst_kaldinnet2onlinedecoder_replace_model(filter, &ModelSnapshot::acoustic_model,
+                                                  new_acoustic_model);
 
         // Only change the parameter if it has worked correctly
         g_free(filter->model_rspecifier);
@@ -2148,6 +3793,29 @@ gst_kaldinnet2onlinedecoder_load_model(Gstkaldinnet2onlinedecoder * filter,
   }
 }
 
+static fst::Fst<fst::StdArc> *
+gst_kaldinnet2onlinedecoder_map_fst(Gstkaldinnet2onlinedecoder * filter,
+                                    const gchar *filename) {
+  // Unlike ReadFstKaldiGeneric(), this needs a real file (not a pipe),
+  // since the graph is mapped directly from it
+  std::ifstream strm(filename, std::ios_base::in | std::ios_base::binary);
+  if (!strm) {
+    KALDI_ERR << "Could not open decoding graph " << filename;
+  }
+  fst::FstReadOptions read_opts(filename);
+  read_opts.mode = fst::FstReadOptions::MAP;
+  fst::Fst<fst::StdArc> *decode_fst = fst::Fst<fst::StdArc>::Read(strm, read_opts);
+  if (decode_fst == NULL) {
+    KALDI_ERR << "Could not read decoding graph " << filename;
+  }
+  if (decode_fst->Type() != "const") {
+    GST_WARNING_OBJECT(filter, "Decoding graph %s is of type '%s', only const FSTs can be memory-mapped. "
+                       "It was read into memory instead, convert it with "
+                       "'fstconvert --fst_type=const --fst_align'", filename, decode_fst->Type().c_str());
+  }
+  return decode_fst;
+}
+
 static void
 gst_kaldinnet2onlinedecoder_load_fst(Gstkaldinnet2onlinedecoder * filter,
                                      const GValue * value) {
@@ -2159,15 +3827,22 @@ gst_kaldinnet2onlinedecoder_load_fst(Gstkaldinnet2onlinedecoder * filter,
       try {
         GST_DEBUG_OBJECT(filter, "Loading decoder graph: %s", str);
 
-        fst::Fst<fst::StdArc> * new_decode_fst = fst::ReadFstKaldiGeneric(str);
-
-        // Delete objects if needed
-        if (filter->decode_fst) {
-          delete filter->decode_fst;
-        }
+        fst::Fst<fst::StdArc> * new_decode_fst =
+            ModelRegistry::Instance().Acquire<fst::Fst<fst::StdArc> >(
+                "fst", str,
+                (filter->mmap_fst ? "map" : "read") + gst_kaldinnet2onlinedecoder_numa_key(filter),
+                filter->share_models,
+                [filter, str]() -> fst::Fst<fst::StdArc> * {
+                  if (filter->mmap_fst) {
+                    return gst_kaldinnet2onlinedecoder_map_fst(filter, str);
+                  }
+                  ScopedCpuAffinity pinned(*(filter->cpu_affinity));
+                  return fst::ReadFstKaldiGeneric(str);
+                });
 
         // Replace the decoding graph
-        filter->decode_fst = new_decode_fst;
+        gst_kaldinnet2onlinedecoder_replace_model(filter, &ModelSnapshot::decode_fst,
+                                                  new_decode_fst);
 
         // Only change the parameter if it has worked correctly
         g_free(filter->fst_rspecifier);
@@ -2184,6 +3859,50 @@ gst_kaldinnet2onlinedecoder_load_fst(Gstkaldinnet2onlinedecoder * filter,
   }
 }
 
+static RescoringLmFst *
+gst_kaldinnet2onlinedecoder_read_lm_fst(const gchar *str) {
+  fst::VectorFst<fst::StdArc> *std_lm_fst =
+      fst::VectorFst<fst::StdArc>::Read(str);
+  if (std_lm_fst == NULL) {
+    KALDI_ERR << "Could not read LM FST " << str;
+  }
+  fst::Project(std_lm_fst, fst::PROJECT_OUTPUT);
+
+  if (std_lm_fst->Properties(fst::kILabelSorted, true) == 0) {
+    // Make sure LM is sorted on ilabel.
+    fst::ILabelCompare<fst::StdArc> ilabel_comp;
+    fst::ArcSort(std_lm_fst, ilabel_comp);
+  }
+
+  RescoringLmFst *lm_fst = new RescoringLmFst();
+
+  // mapped_fst is the LM fst interpreted using the LatticeWeight semiring,
+  // with all the cost on the first member of the pair (since it's a graph
+  // weight).
+  int32 num_states_cache = 50000;
+  fst::CacheOptions cache_opts(true, num_states_cache);
+  fst::MapFstOptions mapfst_opts(cache_opts);
+  fst::StdToLatticeMapper<BaseFloat> mapper;
+  lm_fst->lm_fst = new fst::MapFst<fst::StdArc, LatticeArc,
+      fst::StdToLatticeMapper<BaseFloat> >(*std_lm_fst, mapper, mapfst_opts);
+  delete std_lm_fst;
+
+  // The next fifteen or so lines are a kind of optimization and
+  // can be ignored if you just want to understand what is going on.
+  // Change the options for TableCompose to match the input
+  // (because it's the arcs of the LM FST we want to do lookup
+  // on).
+  fst::TableComposeOptions compose_opts(fst::TableMatcherOptions(),
+                                        true, fst::SEQUENCE_FILTER,
+                                        fst::MATCH_INPUT);
+
+  // The following is an optimization for the TableCompose
+  // composition: it stores certain tables that enable fast
+  // lookup of arcs during composition.
+  lm_fst->compose_cache = new fst::TableComposeCache<fst::Fst<LatticeArc> >(compose_opts);
+  return lm_fst;
+}
+
 static void
 gst_kaldinnet2onlinedecoder_load_lm_fst(Gstkaldinnet2onlinedecoder * filter,
                                         const GValue * value) {
@@ -2195,48 +3914,15 @@ gst_kaldinnet2onlinedecoder_load_lm_fst(Gstkaldinnet2onlinedecoder * filter,
       try {
         GST_DEBUG_OBJECT(filter, "Loading baseline language model FST: %s", str);
 
-        // Delete objects if needed
-        if (filter->lm_fst) {
-          delete filter->lm_fst;
-        }
-        if (filter->lm_compose_cache) {
-          delete filter->lm_compose_cache;
-        }
-
-        fst::VectorFst<fst::StdArc> *std_lm_fst =
-            fst::VectorFst<fst::StdArc>::Read(str);
-        fst::Project(std_lm_fst, fst::PROJECT_OUTPUT);
+        // The compose cache is modified when rescoring, so this is not shared
+        RescoringLmFst *new_lm_fst =
+            ModelRegistry::Instance().Acquire<RescoringLmFst>(
+                "lm-fst", str, "", false, [str]() {
+                  return gst_kaldinnet2onlinedecoder_read_lm_fst(str);
+                });
 
-        if (std_lm_fst->Properties(fst::kILabelSorted, true) == 0) {
-          // Make sure LM is sorted on ilabel.
-          fst::ILabelCompare<fst::StdArc> ilabel_comp;
-          fst::ArcSort(std_lm_fst, ilabel_comp);
-        }
-
-        // mapped_fst is the LM fst interpreted using the LatticeWeight semiring,
-        // with all the cost on the first member of the pair (since it's a graph
-        // weight).
-        int32 num_states_cache = 50000;
-        fst::CacheOptions cache_opts(true, num_states_cache);
-        fst::MapFstOptions mapfst_opts(cache_opts);
-        fst::StdToLatticeMapper<BaseFloat> mapper;
-        filter->lm_fst = new fst::MapFst<fst::StdArc, LatticeArc,
-            fst::StdToLatticeMapper<BaseFloat> >(*std_lm_fst, mapper, mapfst_opts);
-        delete std_lm_fst;
-
-        // The next fifteen or so lines are a kind of optimization and
-        // can be ignored if you just want to understand what is going on.
-        // Change the options for TableCompose to match the input
-        // (because it's the arcs of the LM FST we want to do lookup
-        // on).
-        fst::TableComposeOptions compose_opts(fst::TableMatcherOptions(),
-                                              true, fst::SEQUENCE_FILTER,
-                                              fst::MATCH_INPUT);
-
-        // The following is an optimization for the TableCompose
-        // composition: it stores certain tables that enable fast
-        // lookup of arcs during composition.
-        filter->lm_compose_cache = new fst::TableComposeCache<fst::Fst<LatticeArc> >(compose_opts);
+        gst_kaldinnet2onlinedecoder_replace_model(filter, &ModelSnapshot::lm_fst,
+                                                  new_lm_fst);
 
         // Only change the parameter if it has worked correctly
         g_free(filter->lm_fst_name);
@@ -2252,14 +3938,13 @@ gst_kaldinnet2onlinedecoder_load_lm_fst(Gstkaldinnet2onlinedecoder * filter,
   }
 }
 
-static void 
-gst_kaldinnet2onlinedecoder_reset_cmvn_state(Gstkaldinnet2onlinedecoder * filter) {
+static OnlineCmvnState *
+gst_kaldinnet2onlinedecoder_initial_cmvn_state(Gstkaldinnet2onlinedecoder * filter) {
   Matrix<double> global_cmvn_stats;
   if (filter->feature_info->global_cmvn_stats_rxfilename != "")
       ReadKaldiObject(filter->feature_info->global_cmvn_stats_rxfilename,
                       &global_cmvn_stats);
-  GST_DEBUG_OBJECT(filter, "Resetting online CMVN state");                      
-  filter->cmvn_state = new OnlineCmvnState(global_cmvn_stats);
+  return new OnlineCmvnState(global_cmvn_stats);
 }
 
 static void
@@ -2273,12 +3958,21 @@ gst_kaldinnet2onlinedecoder_load_big_lm(Gstkaldinnet2onlinedecoder * filter,
       try {
         GST_DEBUG_OBJECT(filter, "Loading big language model in constant ARPA format: %s", str);
 
-        // Delete object if needed
-        if (filter->big_lm_const_arpa) {
-          delete filter->big_lm_const_arpa;
-        }
-        filter->big_lm_const_arpa = new ConstArpaLm();
-        ReadKaldiObject(str, filter->big_lm_const_arpa);
+        ConstArpaLm *new_big_lm_const_arpa =
+            ModelRegistry::Instance().Acquire<ConstArpaLm>(
+                "const-arpa", str, "", filter->share_models, [str]() -> ConstArpaLm * {
+                  ConstArpaLm *big_lm_const_arpa = new ConstArpaLm();
+                  try {
+                    ReadKaldiObject(str, big_lm_const_arpa);
+                  } catch (...) {
+                    delete big_lm_const_arpa;
+                    throw;
+                  }
+                  return big_lm_const_arpa;
+                });
+
+        gst_kaldinnet2onlinedecoder_replace_model(filter, &ModelSnapshot::big_lm_const_arpa,
+                                                  new_big_lm_const_arpa);
 
         // Only change the parameter if it has worked correctly
         g_free(filter->big_lm_const_arpa_name);
@@ -2299,10 +3993,6 @@ gst_kaldinnet2onlinedecoder_allocate(
     Gstkaldinnet2onlinedecoder * filter) {
   GST_INFO_OBJECT(filter, "Loading Kaldi models and feature extractor");
 
-  if (!filter->audio_source) {
-      filter->audio_source = new GstBufferSource();
-  }
-
   if (filter->feature_info == NULL) {
       filter->feature_info = new OnlineNnet2FeaturePipelineInfo(*(filter->feature_config));
   }
@@ -2312,10 +4002,14 @@ gst_kaldinnet2onlinedecoder_allocate(
   else
     filter->sample_rate = (int) filter->feature_info->mfcc_opts.frame_opts.samp_freq;
 
+  if (!filter->audio_source) {
+      filter->audio_source = gst_kaldinnet2onlinedecoder_new_audio_source(filter);
+  }
+
   filter->adaptation_state = new OnlineIvectorExtractorAdaptationState(
       filter->feature_info->ivector_extractor_info);
 
-  gst_kaldinnet2onlinedecoder_reset_cmvn_state(filter);
+  filter->cmvn_state = gst_kaldinnet2onlinedecoder_initial_cmvn_state(filter);
   
   return true;
 }
@@ -2327,6 +4021,108 @@ static bool gst_kaldinnet2onlinedecoder_deallocate(
   return true;
 }
 
+typedef void (*ModelLoadFunc)(Gstkaldinnet2onlinedecoder * filter,
+                              const GValue * value);
+
+// A model file that is loaded on its own thread during an asynchronous
+// NULL to READY transition
+struct ModelLoadJob {
+  Gstkaldinnet2onlinedecoder *filter;
+  const gchar *name;  // name of the property
+  const GValue *value;
+  ModelLoadFunc load;
+  GThread *thread;
+  double load_time;
+};
+
+static ModelLoadFunc
+gst_kaldinnet2onlinedecoder_model_loader(const gchar * name) {
+  if (strcmp(name, "model") == 0)
+    return gst_kaldinnet2onlinedecoder_load_model;
+  if (strcmp(name, "fst") == 0)
+    return gst_kaldinnet2onlinedecoder_load_fst;
+  if (strcmp(name, "word-syms") == 0)
+    return gst_kaldinnet2onlinedecoder_load_word_syms;
+  if (strcmp(name, "lm-fst") == 0)
+    return gst_kaldinnet2onlinedecoder_load_lm_fst;
+  return gst_kaldinnet2onlinedecoder_load_big_lm;
+}
+
+static bool
+gst_kaldinnet2onlinedecoder_postpone_load(Gstkaldinnet2onlinedecoder * filter,
+                                          const gchar * name,
+                                          const GValue * value) {
+  // Once the element has started going to READY, files are loaded right away
+  GST_OBJECT_LOCK(filter);
+  bool in_null_state = (GST_STATE(filter) == GST_STATE_NULL
+      && GST_STATE_PENDING(filter) == GST_STATE_VOID_PENDING);
+  GST_OBJECT_UNLOCK(filter);
+  if (!filter->async_model_loading || !in_null_state) {
+    // a file loaded now replaces one that was waiting to be loaded
+    if (filter->pending_loads != NULL)
+      gst_structure_remove_field(filter->pending_loads, name);
+    return false;
+  }
+
+  if (filter->pending_loads == NULL) {
+    filter->pending_loads = gst_structure_new_empty("pending-model-loads");
+  }
+  gst_structure_set_value(filter->pending_loads, name, value);
+  return true;
+}
+
+static gpointer
+gst_kaldinnet2onlinedecoder_run_model_load_job(gpointer data) {
+  ModelLoadJob *job = (ModelLoadJob *) data;
+  gint64 start = g_get_monotonic_time();
+  // The loaders of different files modify disjoint fields of the filter,
+  // and the model registry is thread-safe
+  try {
+    job->load(job->filter, job->value);
+  } catch (std::exception& e) {
+    GST_WARNING_OBJECT(job->filter, "Error loading %s: %s", job->name, e.what());
+  }
+  job->load_time = (g_get_monotonic_time() - start) / 1e6;
+  return NULL;
+}
+
+// Loads the postponed files in parallel, one thread per file, and waits for
+// all of them, so that the element is READY with its models when the state
+// change returns
+static void
+gst_kaldinnet2onlinedecoder_load_pending_models(Gstkaldinnet2onlinedecoder * filter) {
+  GstStructure *pending_loads = filter->pending_loads;
+  gint64 start = g_get_monotonic_time();
+
+  std::vector<ModelLoadJob> jobs(gst_structure_n_fields(pending_loads));
+  for (size_t i = 0; i < jobs.size(); i++) {
+    ModelLoadJob &job = jobs[i];
+    job.filter = filter;
+    job.name = gst_structure_nth_field_name(pending_loads, i);
+    job.value = gst_structure_get_value(pending_loads, job.name);
+    job.load = gst_kaldinnet2onlinedecoder_model_loader(job.name);
+    job.load_time = 0.0;
+    job.thread = g_thread_new(job.name,
+                              gst_kaldinnet2onlinedecoder_run_model_load_job,
+                              &job);
+  }
+
+  GstStructure *load_times = gst_structure_new_empty("model-load-times");
+  for (size_t i = 0; i < jobs.size(); i++) {
+    g_thread_join(jobs[i].thread);
+    GST_INFO_OBJECT(filter, "Loaded %s in %.2f seconds", jobs[i].name, jobs[i].load_time);
+    gst_structure_set(load_times, jobs[i].name, G_TYPE_DOUBLE, jobs[i].load_time, NULL);
+  }
+  gst_structure_set(load_times, "total", G_TYPE_DOUBLE,
+                    (g_get_monotonic_time() - start) / 1e6, NULL);
+  filter->pending_loads = NULL;
+  gst_structure_free(pending_loads);
+
+  // Failed loads are only warned about, like when loading synchronously
+  gst_element_post_message(GST_ELEMENT(filter),
+                           gst_message_new_element(GST_OBJECT(filter), load_times));
+}
+
 static GstStateChangeReturn gst_kaldinnet2onlinedecoder_change_state(
     GstElement *element, GstStateChange transition) {
 
@@ -2337,6 +4133,20 @@ static GstStateChangeReturn gst_kaldinnet2onlinedecoder_change_state(
     case GST_STATE_CHANGE_NULL_TO_READY:
       if (!gst_kaldinnet2onlinedecoder_allocate(filter))
         return GST_STATE_CHANGE_FAILURE;
+      if (filter->pending_loads != NULL)
+        gst_kaldinnet2onlinedecoder_load_pending_models(filter);
+      break;
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      g_mutex_lock(&filter->step_lock);
+      filter->audio_source->SetFlush(false);
+      g_mutex_unlock(&filter->step_lock);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      // Unblock the streaming thread if it is waiting for room in a full
+      // queue; the decoder may be replacing the source at the same time
+      g_mutex_lock(&filter->step_lock);
+      filter->audio_source->SetFlush(true);
+      g_mutex_unlock(&filter->step_lock);
       break;
     default:
       break;
@@ -2347,6 +4157,13 @@ static GstStateChangeReturn gst_kaldinnet2onlinedecoder_change_state(
     return ret;
 
   switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      // The pads are deactivated now, so the chain function can't be using
+      // the audio source that is replaced
+      if (filter->use_worker_pool) {
+        gst_kaldinnet2onlinedecoder_stop_steps(filter);
+      }
+      break;
     case GST_STATE_CHANGE_READY_TO_NULL:
       gst_kaldinnet2onlinedecoder_deallocate(filter);
       break;
@@ -2364,44 +4181,37 @@ static void gst_kaldinnet2onlinedecoder_finalize(GObject * object) {
   g_free(filter->fst_rspecifier);
   g_free(filter->word_syms_filename);
   g_free(filter->phone_syms_filename);
+  g_free(filter->cpu_affinity_spec);
+  delete filter->cpu_affinity;
+  delete filter->result_writer;
   delete filter->endpoint_config;
   delete filter->feature_config;
   delete filter->nnet2_decoding_config;
   delete filter->nnet3_decodable_opts;
+  delete filter->nnet3_decoding_threaded_config;
+  delete filter->batch_scorer_config;
   delete filter->decoder_opts;
+  delete filter->incremental_decoder_opts;
   delete filter->silence_weighting_config;
+  delete filter->rtf_control_config;
   delete filter->simple_options;
   if (filter->feature_info) {
     delete filter->feature_info;
   }
-  if (filter->trans_model) {
-    delete filter->trans_model;
-  }
-  if (filter->am_nnet2) {
-    delete filter->am_nnet2;
-  }
-  if (filter->am_nnet3) {
-    delete filter->am_nnet3;
-  }
-  if (filter->decode_fst) {
-    delete filter->decode_fst;
-  }
-  if (filter->word_syms) {
-    delete filter->word_syms;
-  }
+  delete filter->models;
+  g_mutex_clear(&filter->models_lock);
+  g_mutex_clear(&filter->postprocessing_lock);
+  g_cond_clear(&filter->postprocessing_cond);
+  g_mutex_clear(&filter->adaptation_state_lock);
+  g_mutex_clear(&filter->step_lock);
+  g_cond_clear(&filter->step_cond);
   if (filter->adaptation_state) {
     delete filter->adaptation_state;
   }
   g_free(filter->lm_fst_name);
   g_free(filter->big_lm_const_arpa_name);
-  if (filter->lm_fst) {
-    delete filter->lm_fst;
-  }
-  if (filter->big_lm_const_arpa) {
-    delete filter->big_lm_const_arpa;
-  }
-  if (filter->lm_compose_cache) {
-    delete filter->lm_compose_cache;
+  if (filter->pending_loads) {
+    gst_structure_free(filter->pending_loads);
   }
 
 
@@ -2424,7 +4234,10 @@ static gboolean kaldinnet2onlinedecoder_init(
 
   return gst_element_register(kaldinnet2onlinedecoder,
                               "kaldinnet2onlinedecoder", GST_RANK_NONE,
-                              GST_TYPE_KALDINNET2ONLINEDECODER);
+                              GST_TYPE_KALDINNET2ONLINEDECODER)
+      && gst_element_register(kaldinnet2onlinedecoder,
+                              "kaldinnet2onlinedecodermulti", GST_RANK_NONE,
+                              GST_TYPE_KALDINNET2ONLINEDECODERMULTI);
 }
 
 /* PACKAGE: this is usually set by autotools depending on some _INIT macro
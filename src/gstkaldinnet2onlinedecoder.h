@@ -22,10 +22,21 @@
 #ifndef KALDI_SRC_GSTKALDINNET2ONLINEDECODER_H_
 #define KALDI_SRC_GSTKALDINNET2ONLINEDECODER_H_
 
+#include <memory>
+
 #include <gst/gst.h>
 
 #include "./simple-options-gst.h"
 #include "./gst-audio-source.h"
+#include "./cpu-affinity.h"
+#include "./result-writer.h"
+#include "./gst-ring-buffer-source.h"
+#include "./energy-vad.h"
+#include "./nnet2-segment-decoder.h"
+#include "./rtf-controller.h"
+#include "./nnet3-threaded-decoder.h"
+#include "./nnet3-batch-scorer.h"
+#include "./nnet3-batch-decoder.h"
 #include "./remote-rescore.h"
 
 #include "online2/online-nnet2-decoding-threaded.h"
@@ -33,6 +44,7 @@
 
 // support for nnet3
 #include "online2/online-nnet3-decoding.h"
+#include "online2/online-nnet3-incremental-decoding.h"
 
 #include "online2/onlinebin-util.h"
 #include "online2/online-timing.h"
@@ -46,6 +58,69 @@
 
 namespace kaldi {
 
+// Everything that is read from the acoustic model file. Shared between
+// decoder elements through the ModelRegistry, so it must not be modified
+// after loading.
+struct AcousticModel {
+  TransitionModel trans_model;
+  nnet2::AmNnet am_nnet2;
+  nnet3::AmNnetSimple am_nnet3;
+  // only for nnet3
+  nnet3::DecodableNnetSimpleLoopedInfo *decodable_info_nnet3;
+  // only for nnet3 with batch-scoring
+  NnetBatchScorer *batch_scorer;
+
+  AcousticModel() : decodable_info_nnet3(NULL), batch_scorer(NULL) {}
+  ~AcousticModel() { delete decodable_info_nnet3; delete batch_scorer; }
+};
+
+// Baseline LM that is subtracted when rescoring with the big LM. The compose
+// cache is modified during rescoring, so this is private to an element.
+struct RescoringLmFst {
+  fst::MapFst<fst::StdArc, LatticeArc, fst::StdToLatticeMapper<BaseFloat> > *lm_fst;
+  fst::TableComposeCache<fst::Fst<LatticeArc> > *compose_cache;
+
+  RescoringLmFst() : lm_fst(NULL), compose_cache(NULL) {}
+  ~RescoringLmFst() { delete lm_fst; delete compose_cache; }
+};
+
+// The models that a segment is decoded with. The objects are owned by the
+// ModelRegistry and a snapshot holds one reference to each of them. A
+// published snapshot is never modified: setting a model property publishes
+// a new one, and the old one is freed when the last segment using it ends.
+struct ModelSnapshot {
+  AcousticModel *acoustic_model;
+  fst::Fst<fst::StdArc> *decode_fst;
+  fst::SymbolTable *word_syms;
+  fst::SymbolTable *phone_syms;
+  WordBoundaryInfo *word_boundary_info;
+  WordAlignLatticeLexiconInfo *align_lexicon_info;
+  RescoringLmFst *lm_fst;
+  ConstArpaLm *big_lm_const_arpa;
+
+  ModelSnapshot();
+  // Takes another reference to each of the models of 'other'
+  ModelSnapshot(const ModelSnapshot &other);
+  ~ModelSnapshot();
+
+ private:
+  ModelSnapshot &operator = (const ModelSnapshot &other);
+};
+
+// What the result functions need to know about the segment that a result
+// belongs to. With postprocess-in-thread, results are produced while the
+// decoding task is already decoding the next segment.
+struct SegmentResultInfo {
+  std::shared_ptr<const ModelSnapshot> models;
+  float segment_start_time;
+  float total_time_decoded;
+  bool rtf_control;
+  BaseFloat rtf;
+  BaseFloat beam;
+  int32 max_active;
+  double compute_wait_secs;
+};
+
 G_BEGIN_DECLS
 
 /* #defines don't like whitespacey bits */
@@ -61,6 +136,8 @@ G_BEGIN_DECLS
   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_KALDINNET2ONLINEDECODER))
 
 typedef struct _Gstkaldinnet2onlinedecoder Gstkaldinnet2onlinedecoder;
+
+class DecodingStream;
 typedef struct _Gstkaldinnet2onlinedecoderClass Gstkaldinnet2onlinedecoderClass;
 
 #define NNET2  2
@@ -79,11 +156,28 @@ struct _Gstkaldinnet2onlinedecoder {
   gboolean inverse_scale;
   double last_conf;
   float lmwt_scale;
-  GstBufferSource *audio_source;
+  GstAudioSource *audio_source;
+  gboolean use_lockfree_audio_source;
+  float max_queued_audio_secs;
+  guint queue_overflow_policy;
+  gboolean use_vad;
+  float vad_energy_threshold;
+  float vad_hangover_secs;
+  EnergyVad *vad;
   gboolean do_phone_alignment;
 
   gchar* model_rspecifier;
   gchar* fst_rspecifier;
+  gboolean mmap_fst;
+  gboolean batch_scoring;
+  // CPUs that the decoding threads and the loading of the acoustic model
+  // and the decoding graph are pinned to
+  gchar *cpu_affinity_spec;
+  CpuAffinity *cpu_affinity;
+  // Model files that are loaded when going to READY, in async-model-loading
+  // mode; maps property names to filenames
+  gboolean async_model_loading;
+  GstStructure *pending_loads;
   gchar* word_syms_filename;
   gchar* phone_syms_filename;
   gchar* word_boundary_info_filename;
@@ -96,43 +190,83 @@ struct _Gstkaldinnet2onlinedecoder {
   OnlineNnet2DecodingConfig *nnet2_decoding_config;
   // support for nnet3
   nnet3::NnetSimpleLoopedComputationOptions *nnet3_decodable_opts;
+  OnlineNnet3DecodingThreadedConfig *nnet3_decoding_threaded_config;
+  NnetBatchScorerConfig *batch_scorer_config;
   LatticeFasterDecoderConfig *decoder_opts;  
+  LatticeIncrementalDecoderConfig *incremental_decoder_opts;
   fst::DeterminizeLatticePrunedOptions *det_opts;
   
   OnlineSilenceWeightingConfig *silence_weighting_config;
+  RtfControlConfig *rtf_control_config;
+  // only exists while decoding with rtf-target set
+  RtfController *rtf_controller;
 
   OnlineNnet2FeaturePipelineInfo *feature_info;
-  TransitionModel *trans_model;
-  nnet2::AmNnet *am_nnet2;
-  nnet3::AmNnetSimple *am_nnet3;
-  nnet3::DecodableNnetSimpleLoopedInfo *decodable_info_nnet3;
-  fst::Fst<fst::StdArc> *decode_fst;
-  fst::SymbolTable *word_syms;
-  fst::SymbolTable *phone_syms;
-  WordBoundaryInfo *word_boundary_info;
-  WordAlignLatticeLexiconInfo *align_lexicon_info;
+  gboolean share_models;
+  // The current models, replaced atomically when a model property is set;
+  // models_lock serializes the setters
+  std::shared_ptr<const ModelSnapshot> *models;
+  GMutex models_lock;
+  // The models of the segment that is being decoded, only used by the
+  // decoding task
+  const ModelSnapshot *pinned_models;
+  const std::shared_ptr<const ModelSnapshot> *pinned_snapshot;
+  // The segment whose result is being produced, set by the thread that
+  // produces it
+  const SegmentResultInfo *result_info;
+  gboolean postprocess_in_thread;
+  GThread *postprocessor;
+  GAsyncQueue *postprocessing_queue;
+  GMutex postprocessing_lock;
+  GCond postprocessing_cond;
+  gint num_pending_results;
   int sample_rate;
+  // rate of the incoming audio, 0 until the caps are known
+  int input_sample_rate;
+  guint resample_quality;
+  SampleFormat sample_format;
   int nbest;
   gboolean decoding;
+  // With use-worker-pool, the stream is decoded in steps on a process-wide
+  // pool instead of in a task of its own. step_lock protects decoding and
+  // step_scheduled; the stream is only used by the step that is running.
+  // audio_source is replaced under step_lock (and the sink pad's stream
+  // lock while decoding), so threads other than the streaming thread and
+  // the decoder use it only under step_lock.
+  gboolean use_worker_pool;
+  DecodingStream *stream;
+  gboolean step_scheduled;
+  GMutex step_lock;
+  GCond step_cond;
   float chunk_length_in_secs;
   float traceback_period_in_secs;
   bool use_threaded_decoder;
+  // flow control of the threaded decoders, in 10 ms frames
+  gint max_decoder_lag_frames;
+  gint decoder_lag_frames;  // measured, written by the decoding task
+  gboolean incremental_lattice;
   guint num_nbest;
   guint num_phone_alignment;
   guint min_words_for_ivector;
   OnlineIvectorExtractorAdaptationState *adaptation_state;
   OnlineCmvnState *cmvn_state;
+  // guards the contents of adaptation_state and cmvn_state, which the
+  // decoding task, the post-processing thread and the property accessors use
+  GMutex adaptation_state_lock;
   float segment_start_time;
   float total_time_decoded;
+  // time the stream has waited for the process-wide compute budget
+  double compute_wait_secs;
 
   // The following are needed for optional LM rescoring with a "big" LM
   gchar* lm_fst_name;
   gchar* big_lm_const_arpa_name;
-  fst::MapFst<fst::StdArc, LatticeArc, fst::StdToLatticeMapper<BaseFloat> > *lm_fst;
-  fst::TableComposeCache<fst::Fst<LatticeArc> > *lm_compose_cache;
-  ConstArpaLm *big_lm_const_arpa;
   const gchar* rescore_socket; // rescoring in remote process
   RemoteRescore* remote_rescore = NULL;
+
+  // encoding of the full final results, and the buffer they are written to
+  guint result_format;
+  ResultWriter *result_writer;
 };
 
 struct _Gstkaldinnet2onlinedecoderClass {
@@ -140,6 +274,7 @@ struct _Gstkaldinnet2onlinedecoderClass {
   void (*partial_result)(GstElement *element, const gchar *result_str);
   void (*final_result)(GstElement *element, const gchar *result_str, float like, float confidence);
   void (*full_final_result)(GstElement *element, const gchar *result_str);
+  void (*full_final_result_bytes)(GstElement *element, GBytes *result);
 };
 
 GType gst_kaldinnet2onlinedecoder_get_type(void);
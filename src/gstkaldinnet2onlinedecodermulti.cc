@@ -0,0 +1,439 @@
+// gstkaldinnet2onlinedecodermulti.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * SECTION:element-kaldinnet2onlinedecodermulti
+ *
+ * Decodes several audio streams, each with its own kaldinnet2onlinedecoder.
+ * The decoders are configured through the element in the "decoder" property.
+ *
+ * Each requested sink_%u pad gets a decoder of its own; its text comes out of
+ * the matching src_%u pad, and its results are signalled with the stream
+ * number as the first argument:
+ * |[
+ * asr = Gst.ElementFactory.make("kaldinnet2onlinedecodermulti", "asr")
+ * decoder = asr.get_property("decoder")
+ * decoder.set_property("nnet-mode", 3)
+ * decoder.set_property("model", "final.mdl")
+ * ...
+ * asr.connect("final-result", lambda asr, stream, text, like, conf: ...)
+ * source.get_static_pad("src").link(asr.get_request_pad("sink_%u"))
+ * ]|
+ */
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include <gst/gst.h>
+
+#include "./kaldimarshal.h"
+#include "./gstkaldinnet2onlinedecoder.h"
+#include "./gstkaldinnet2onlinedecodermulti.h"
+
+namespace kaldi {
+
+GST_DEBUG_CATEGORY_STATIC(gst_kaldinnet2onlinedecodermulti_debug);
+#define GST_CAT_DEFAULT gst_kaldinnet2onlinedecodermulti_debug
+
+enum {
+  PARTIAL_RESULT_SIGNAL,
+  FINAL_RESULT_SIGNAL,
+  FULL_FINAL_RESULT_SIGNAL,
+  FULL_FINAL_RESULT_BYTES_SIGNAL,
+  LAST_SIGNAL
+};
+
+enum {
+  PROP_0,
+  PROP_DECODER
+};
+
+// A stream: a decoder and the bin's pads that lead to and from it
+struct MultiDecoderStream {
+  Gstkaldinnet2onlinedecodermulti *multi;
+  guint index;
+  GstElement *decoder;
+  GstPad *sinkpad;
+  GstPad *srcpad;
+};
+
+static GstStaticPadTemplate sink_template =
+GST_STATIC_PAD_TEMPLATE("sink_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS(
+        "audio/x-raw, "
+        "format = (string) { S16LE, S32LE, F32LE }, "
+        "channels = (int) 1, "
+        "rate = (int) [ 1, MAX ]"));
+
+static GstStaticPadTemplate src_template =
+GST_STATIC_PAD_TEMPLATE("src_%u",
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS("text/x-raw, format= { utf8 }"));
+
+static guint gst_kaldinnet2onlinedecodermulti_signals[LAST_SIGNAL];
+
+#define gst_kaldinnet2onlinedecodermulti_parent_class parent_class
+G_DEFINE_TYPE(Gstkaldinnet2onlinedecodermulti, gst_kaldinnet2onlinedecodermulti,
+              GST_TYPE_BIN);
+
+static void gst_kaldinnet2onlinedecodermulti_get_property(GObject * object,
+                                                          guint prop_id,
+                                                          GValue * value,
+                                                          GParamSpec * pspec);
+
+static void gst_kaldinnet2onlinedecodermulti_finalize(GObject * object);
+
+static GstPad *gst_kaldinnet2onlinedecodermulti_request_new_pad(
+    GstElement *element, GstPadTemplate *templ, const gchar *name,
+    const GstCaps *caps);
+
+static void gst_kaldinnet2onlinedecodermulti_release_pad(GstElement *element,
+                                                         GstPad *pad);
+
+static void gst_kaldinnet2onlinedecodermulti_decoder_notify(GObject *decoder,
+                                                            GParamSpec *pspec,
+                                                            gpointer user_data);
+
+static void gst_kaldinnet2onlinedecodermulti_class_init(
+    Gstkaldinnet2onlinedecodermultiClass * klass) {
+  GObjectClass *gobject_class;
+  GstElementClass *gstelement_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gstelement_class = (GstElementClass *) klass;
+
+  GST_DEBUG_CATEGORY_INIT(gst_kaldinnet2onlinedecodermulti_debug,
+                          "kaldinnet2onlinedecodermulti", 0,
+                          "Multi-stream kaldinnet2onlinedecoder");
+
+  gobject_class->get_property = gst_kaldinnet2onlinedecodermulti_get_property;
+  gobject_class->finalize = gst_kaldinnet2onlinedecodermulti_finalize;
+
+  gstelement_class->request_new_pad =
+      GST_DEBUG_FUNCPTR(gst_kaldinnet2onlinedecodermulti_request_new_pad);
+  gstelement_class->release_pad =
+      GST_DEBUG_FUNCPTR(gst_kaldinnet2onlinedecodermulti_release_pad);
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_DECODER,
+      g_param_spec_object(
+          "decoder",
+          "Decoder whose properties are used for all streams",
+          "A kaldinnet2onlinedecoder that doesn't decode anything itself: the properties set on it "
+          "are set, in the same order, on the decoders of all streams, including those that are "
+          "requested later. Its share-models is set, so the streams use the models it loads",
+          GST_TYPE_ELEMENT,
+          (GParamFlags) G_PARAM_READABLE));
+
+  gst_kaldinnet2onlinedecodermulti_signals[PARTIAL_RESULT_SIGNAL] = g_signal_new(
+      "partial-result", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET(Gstkaldinnet2onlinedecodermultiClass, partial_result),
+      NULL,
+      NULL, kaldi_marshal_VOID__UINT_STRING, G_TYPE_NONE, 2,
+      G_TYPE_UINT, G_TYPE_STRING);
+
+  gst_kaldinnet2onlinedecodermulti_signals[FINAL_RESULT_SIGNAL] = g_signal_new(
+      "final-result", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET(Gstkaldinnet2onlinedecodermultiClass, final_result),
+      NULL,
+      NULL, kaldi_marshal_VOID__UINT_STRING_DOUBLE_DOUBLE, G_TYPE_NONE, 4,
+      G_TYPE_UINT, G_TYPE_STRING, G_TYPE_DOUBLE, G_TYPE_DOUBLE);
+
+  gst_kaldinnet2onlinedecodermulti_signals[FULL_FINAL_RESULT_SIGNAL] = g_signal_new(
+      "full-final-result", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET(Gstkaldinnet2onlinedecodermultiClass, full_final_result),
+      NULL,
+      NULL, kaldi_marshal_VOID__UINT_STRING, G_TYPE_NONE, 2,
+      G_TYPE_UINT, G_TYPE_STRING);
+
+  gst_kaldinnet2onlinedecodermulti_signals[FULL_FINAL_RESULT_BYTES_SIGNAL] = g_signal_new(
+      "full-final-result-bytes", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET(Gstkaldinnet2onlinedecodermultiClass, full_final_result_bytes),
+      NULL,
+      NULL, kaldi_marshal_VOID__UINT_BOXED, G_TYPE_NONE, 2,
+      G_TYPE_UINT, G_TYPE_BYTES);
+
+  gst_element_class_set_details_simple(
+      gstelement_class, "KaldiNNet2OnlineDecoderMulti", "Speech/Audio",
+      "Convert speech to text, many streams at a time",
+      "Tanel Alumae <tanel.alumae@phon.ioc.ee>");
+
+  gst_element_class_add_pad_template(gstelement_class,
+                                     gst_static_pad_template_get(&src_template));
+  gst_element_class_add_pad_template(
+      gstelement_class, gst_static_pad_template_get(&sink_template));
+}
+
+static void gst_kaldinnet2onlinedecodermulti_init(
+    Gstkaldinnet2onlinedecodermulti * multi) {
+  multi->set_properties = new std::vector<std::string>();
+  multi->streams = new std::map<guint, MultiDecoderStream*>();
+  multi->next_stream = 0;
+  g_mutex_init(&multi->lock);
+
+  multi->decoder = GST_ELEMENT(gst_object_ref_sink(
+      g_object_new(GST_TYPE_KALDINNET2ONLINEDECODER, "name", "decoder", NULL)));
+  g_signal_connect(multi->decoder, "notify",
+                   G_CALLBACK(gst_kaldinnet2onlinedecodermulti_decoder_notify),
+                   multi);
+  // recorded like any other property, so it's the first one the streams get
+  g_object_set(multi->decoder, "share-models", TRUE, NULL);
+}
+
+static void gst_kaldinnet2onlinedecodermulti_get_property(GObject * object,
+                                                          guint prop_id,
+                                                          GValue * value,
+                                                          GParamSpec * pspec) {
+  Gstkaldinnet2onlinedecodermulti *multi = GST_KALDINNET2ONLINEDECODERMULTI(object);
+
+  switch (prop_id) {
+    case PROP_DECODER:
+      g_value_set_object(value, multi->decoder);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+      break;
+  }
+}
+
+// Copies a property of the configuring decoder to the decoder of a stream
+static void gst_kaldinnet2onlinedecodermulti_copy_property(
+    Gstkaldinnet2onlinedecodermulti *multi, const gchar *name,
+    GstElement *decoder) {
+  // The configuring decoder stays in NULL, so with async-model-loading the
+  // model files it is given are only recorded as pending loads, and its
+  // getters still return the previous files
+  Gstkaldinnet2onlinedecoder *config_decoder = GST_KALDINNET2ONLINEDECODER(multi->decoder);
+  if (config_decoder->pending_loads != NULL) {
+    const GValue *pending = gst_structure_get_value(config_decoder->pending_loads, name);
+    if (pending != NULL) {
+      g_object_set_property(G_OBJECT(decoder), name, pending);
+      return;
+    }
+  }
+  GValue value = G_VALUE_INIT;
+  GParamSpec *pspec = g_object_class_find_property(
+      G_OBJECT_GET_CLASS(multi->decoder), name);
+  g_value_init(&value, G_PARAM_SPEC_VALUE_TYPE(pspec));
+  g_object_get_property(G_OBJECT(multi->decoder), name, &value);
+  g_object_set_property(G_OBJECT(decoder), name, &value);
+  g_value_unset(&value);
+}
+
+static void gst_kaldinnet2onlinedecodermulti_decoder_notify(GObject *decoder,
+                                                            GParamSpec *pspec,
+                                                            gpointer user_data) {
+  Gstkaldinnet2onlinedecodermulti *multi = GST_KALDINNET2ONLINEDECODERMULTI(user_data);
+  std::string name = g_param_spec_get_name(pspec);
+  // GstObject notifies the name and parent, which aren't decoder settings
+  if (pspec->owner_type != GST_TYPE_KALDINNET2ONLINEDECODER
+      || !(pspec->flags & G_PARAM_WRITABLE)) {
+    return;
+  }
+  GST_DEBUG_OBJECT(multi, "Decoder property %s set", name.c_str());
+
+  g_mutex_lock(&multi->lock);
+  // a property that is set again moves to the end, so that the streams get
+  // the settings in the order the last ones were made
+  std::vector<std::string>::iterator it =
+      std::find(multi->set_properties->begin(), multi->set_properties->end(), name);
+  if (it != multi->set_properties->end()) {
+    multi->set_properties->erase(it);
+  }
+  multi->set_properties->push_back(name);
+  for (std::map<guint, MultiDecoderStream*>::iterator s = multi->streams->begin();
+       s != multi->streams->end(); ++s) {
+    gst_kaldinnet2onlinedecodermulti_copy_property(multi, name.c_str(),
+                                                   s->second->decoder);
+  }
+  g_mutex_unlock(&multi->lock);
+}
+
+static void gst_kaldinnet2onlinedecodermulti_partial_result(GstElement *decoder,
+                                                            const gchar *result_str,
+                                                            gpointer user_data) {
+  MultiDecoderStream *stream = static_cast<MultiDecoderStream*>(user_data);
+  g_signal_emit(stream->multi,
+                gst_kaldinnet2onlinedecodermulti_signals[PARTIAL_RESULT_SIGNAL], 0,
+                stream->index, result_str);
+}
+
+static void gst_kaldinnet2onlinedecodermulti_final_result(GstElement *decoder,
+                                                          const gchar *result_str,
+                                                          gdouble like,
+                                                          gdouble confidence,
+                                                          gpointer user_data) {
+  MultiDecoderStream *stream = static_cast<MultiDecoderStream*>(user_data);
+  g_signal_emit(stream->multi,
+                gst_kaldinnet2onlinedecodermulti_signals[FINAL_RESULT_SIGNAL], 0,
+                stream->index, result_str, like, confidence);
+}
+
+static void gst_kaldinnet2onlinedecodermulti_full_final_result(GstElement *decoder,
+                                                               const gchar *result_str,
+                                                               gpointer user_data) {
+  MultiDecoderStream *stream = static_cast<MultiDecoderStream*>(user_data);
+  g_signal_emit(stream->multi,
+                gst_kaldinnet2onlinedecodermulti_signals[FULL_FINAL_RESULT_SIGNAL], 0,
+                stream->index, result_str);
+}
+
+static void gst_kaldinnet2onlinedecodermulti_full_final_result_bytes(GstElement *decoder,
+                                                                     GBytes *result,
+                                                                     gpointer user_data) {
+  MultiDecoderStream *stream = static_cast<MultiDecoderStream*>(user_data);
+  g_signal_emit(stream->multi,
+                gst_kaldinnet2onlinedecodermulti_signals[FULL_FINAL_RESULT_BYTES_SIGNAL], 0,
+                stream->index, result);
+}
+
+static GstPad *gst_kaldinnet2onlinedecodermulti_new_ghost_pad(
+    Gstkaldinnet2onlinedecodermulti *multi, GstStaticPadTemplate *static_templ,
+    guint index, GstPad *target) {
+  GstPadTemplate *templ = gst_element_class_get_pad_template(
+      GST_ELEMENT_GET_CLASS(multi), static_templ->name_template);
+  gchar *name = g_strdup_printf(static_templ->name_template, index);
+  GstPad *pad = gst_ghost_pad_new_from_template(name, target, templ);
+  g_free(name);
+  if (GST_STATE(multi) > GST_STATE_READY) {
+    gst_pad_set_active(pad, TRUE);
+  }
+  return pad;
+}
+
+static GstPad *gst_kaldinnet2onlinedecodermulti_request_new_pad(
+    GstElement *element, GstPadTemplate *templ, const gchar *name,
+    const GstCaps *caps) {
+  Gstkaldinnet2onlinedecodermulti *multi = GST_KALDINNET2ONLINEDECODERMULTI(element);
+
+  if (templ->direction != GST_PAD_SINK) {
+    return NULL;
+  }
+
+  g_mutex_lock(&multi->lock);
+  guint index = multi->next_stream;
+  if (name != NULL && sscanf(name, "sink_%u", &index) != 1) {
+    g_mutex_unlock(&multi->lock);
+    GST_WARNING_OBJECT(multi, "Invalid pad name %s", name);
+    return NULL;
+  }
+  if (multi->streams->find(index) != multi->streams->end()) {
+    g_mutex_unlock(&multi->lock);
+    GST_WARNING_OBJECT(multi, "Stream %u already exists", index);
+    return NULL;
+  }
+  multi->next_stream = std::max(multi->next_stream, index + 1);
+
+  MultiDecoderStream *stream = new MultiDecoderStream();
+  stream->multi = multi;
+  stream->index = index;
+  gchar *decoder_name = g_strdup_printf("decoder_%u", index);
+  stream->decoder = GST_ELEMENT(
+      g_object_new(GST_TYPE_KALDINNET2ONLINEDECODER, "name", decoder_name, NULL));
+  g_free(decoder_name);
+  for (std::vector<std::string>::iterator it = multi->set_properties->begin();
+       it != multi->set_properties->end(); ++it) {
+    gst_kaldinnet2onlinedecodermulti_copy_property(multi, it->c_str(),
+                                                   stream->decoder);
+  }
+  g_object_set(stream->decoder, "use-worker-pool", TRUE, NULL);
+  (*multi->streams)[index] = stream;
+  g_mutex_unlock(&multi->lock);
+
+  g_signal_connect(stream->decoder, "partial-result",
+                   G_CALLBACK(gst_kaldinnet2onlinedecodermulti_partial_result),
+                   stream);
+  g_signal_connect(stream->decoder, "final-result",
+                   G_CALLBACK(gst_kaldinnet2onlinedecodermulti_final_result),
+                   stream);
+  g_signal_connect(stream->decoder, "full-final-result",
+                   G_CALLBACK(gst_kaldinnet2onlinedecodermulti_full_final_result),
+                   stream);
+  g_signal_connect(stream->decoder, "full-final-result-bytes",
+                   G_CALLBACK(gst_kaldinnet2onlinedecodermulti_full_final_result_bytes),
+                   stream);
+
+  gst_bin_add(GST_BIN(multi), stream->decoder);
+
+  GstPad *decoder_sink = gst_element_get_static_pad(stream->decoder, "sink");
+  stream->sinkpad = gst_kaldinnet2onlinedecodermulti_new_ghost_pad(
+      multi, &sink_template, index, decoder_sink);
+  gst_object_unref(decoder_sink);
+  GstPad *decoder_src = gst_element_get_static_pad(stream->decoder, "src");
+  stream->srcpad = gst_kaldinnet2onlinedecodermulti_new_ghost_pad(
+      multi, &src_template, index, decoder_src);
+  gst_object_unref(decoder_src);
+
+  gst_element_add_pad(element, stream->srcpad);
+  gst_element_add_pad(element, stream->sinkpad);
+  gst_element_sync_state_with_parent(stream->decoder);
+
+  GST_DEBUG_OBJECT(multi, "Added stream %u", index);
+  return stream->sinkpad;
+}
+
+static void gst_kaldinnet2onlinedecodermulti_release_pad(GstElement *element,
+                                                         GstPad *pad) {
+  Gstkaldinnet2onlinedecodermulti *multi = GST_KALDINNET2ONLINEDECODERMULTI(element);
+
+  g_mutex_lock(&multi->lock);
+  MultiDecoderStream *stream = NULL;
+  for (std::map<guint, MultiDecoderStream*>::iterator s = multi->streams->begin();
+       s != multi->streams->end(); ++s) {
+    if (s->second->sinkpad == pad) {
+      stream = s->second;
+      multi->streams->erase(s);
+      break;
+    }
+  }
+  g_mutex_unlock(&multi->lock);
+  if (stream == NULL) {
+    return;
+  }
+
+  GST_DEBUG_OBJECT(multi, "Removing stream %u", stream->index);
+  gst_element_set_state(stream->decoder, GST_STATE_NULL);
+  g_signal_handlers_disconnect_by_data(stream->decoder, stream);
+  gst_element_remove_pad(element, stream->srcpad);
+  gst_element_remove_pad(element, stream->sinkpad);
+  gst_bin_remove(GST_BIN(multi), stream->decoder);
+  delete stream;
+}
+
+static void gst_kaldinnet2onlinedecodermulti_finalize(GObject * object) {
+  Gstkaldinnet2onlinedecodermulti *multi = GST_KALDINNET2ONLINEDECODERMULTI(object);
+
+  g_signal_handlers_disconnect_by_data(multi->decoder, multi);
+  gst_object_unref(multi->decoder);
+  // the decoders themselves are gone with the bin's children
+  for (std::map<guint, MultiDecoderStream*>::iterator s = multi->streams->begin();
+       s != multi->streams->end(); ++s) {
+    delete s->second;
+  }
+  delete multi->streams;
+  delete multi->set_properties;
+  g_mutex_clear(&multi->lock);
+
+  G_OBJECT_CLASS(parent_class)->finalize(object);
+}
+
+}  // namespace kaldi
@@ -0,0 +1,78 @@
+// gstkaldinnet2onlinedecodermulti.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_GSTKALDINNET2ONLINEDECODERMULTI_H_
+#define KALDI_SRC_GSTKALDINNET2ONLINEDECODERMULTI_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <gst/gst.h>
+
+namespace kaldi {
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_KALDINNET2ONLINEDECODERMULTI \
+  (gst_kaldinnet2onlinedecodermulti_get_type())
+#define GST_KALDINNET2ONLINEDECODERMULTI(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_KALDINNET2ONLINEDECODERMULTI,Gstkaldinnet2onlinedecodermulti))
+#define GST_KALDINNET2ONLINEDECODERMULTI_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_KALDINNET2ONLINEDECODERMULTI,Gstkaldinnet2onlinedecodermultiClass))
+#define GST_IS_KALDINNET2ONLINEDECODERMULTI(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_KALDINNET2ONLINEDECODERMULTI))
+#define GST_IS_KALDINNET2ONLINEDECODERMULTI_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_KALDINNET2ONLINEDECODERMULTI))
+
+typedef struct _Gstkaldinnet2onlinedecodermulti Gstkaldinnet2onlinedecodermulti;
+typedef struct _Gstkaldinnet2onlinedecodermultiClass Gstkaldinnet2onlinedecodermultiClass;
+
+struct MultiDecoderStream;
+
+// Decodes many streams in one element: every requested sink_%u pad gets a
+// kaldinnet2onlinedecoder of its own, whose results come out of src_%u and
+// are signalled with the stream number. The decoders are configured like
+// the element in the "decoder" property, share its models and are decoded
+// on the process-wide worker pool, so idle streams don't hold a thread.
+struct _Gstkaldinnet2onlinedecodermulti {
+  GstBin parent;
+
+  // not decoding itself; the properties set on it are copied to the
+  // decoders of the streams
+  GstElement *decoder;
+  // names of the properties set on the decoder, in the order they were set
+  std::vector<std::string> *set_properties;
+  std::map<guint, MultiDecoderStream*> *streams;
+  guint next_stream;
+  GMutex lock;
+};
+
+struct _Gstkaldinnet2onlinedecodermultiClass {
+  GstBinClass parent_class;
+  void (*partial_result)(GstElement *element, guint stream, const gchar *result_str);
+  void (*final_result)(GstElement *element, guint stream, const gchar *result_str,
+                       float like, float confidence);
+  void (*full_final_result)(GstElement *element, guint stream, const gchar *result_str);
+  void (*full_final_result_bytes)(GstElement *element, guint stream, GBytes *result);
+};
+
+GType gst_kaldinnet2onlinedecodermulti_get_type(void);
+
+G_END_DECLS
+}
+#endif  // KALDI_SRC_GSTKALDINNET2ONLINEDECODERMULTI_H_
@@ -0,0 +1,168 @@
+// gst-plugin/lattice-analysis.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <limits>
+
+#include "./lattice-analysis.h"
+#include "lat/lattice-functions.h"
+
+namespace kaldi {
+
+static MinimumBayesRiskOptions ConfidenceOnlyOptions() {
+  MinimumBayesRiskOptions mbr_opts;
+  mbr_opts.decode_mbr = false;  // we just want confidences
+  mbr_opts.print_silence = false;
+  return mbr_opts;
+}
+
+// Posterior of 'symbol' in a bin of the sausage, 0 if it is not there
+static BaseFloat BinPosterior(const std::vector<std::pair<int32, BaseFloat> > &bin,
+                              int32 symbol) {
+  for (size_t i = 0; i < bin.size(); i++) {
+    if (bin[i].first == symbol) {
+      return bin[i].second;
+    }
+  }
+  return 0.0;
+}
+
+LatticeAnalysis::LatticeAnalysis(const CompactLattice &clat,
+                                 const std::vector<int32> &best_words,
+                                 const TransitionModel &trans_model) :
+    clat_(clat),
+    trans_model_(trans_model),
+    best_words_(best_words),
+    word_mbr_(new MinimumBayesRisk(clat, best_words, ConfidenceOnlyOptions())),
+    phone_mbr_(NULL) {
+}
+
+LatticeAnalysis::~LatticeAnalysis() {
+  delete word_mbr_;
+  delete phone_mbr_;
+}
+
+BaseFloat LatticeAnalysis::UtteranceConfidence() const {
+  const std::vector<BaseFloat> &conf = word_mbr_->GetOneBestConfidences();
+  BaseFloat res = 1;
+  for (size_t i = 0; i < conf.size(); i++) {
+    res = res * conf[i];
+  }
+  return res;
+}
+
+void LatticeAnalysis::WordConfidences(
+    const std::vector<int32> &words, std::vector<BaseFloat> *confidences,
+    std::vector<std::pair<BaseFloat, BaseFloat> > *times) const {
+  Confidences(*word_mbr_, best_words_, words, confidences, times);
+}
+
+void LatticeAnalysis::PhoneConfidences(const std::vector<int32> &phones,
+                                       std::vector<BaseFloat> *confidences) {
+  if (phone_mbr_ == NULL) {
+    Lattice lat;
+    ConvertLattice(clat_, &lat);
+    ConvertLatticeToPhones(trans_model_, &lat);
+    CompactLattice phone_clat;
+    ConvertLattice(lat, &phone_clat);
+    reference_phones_ = phones;
+    phone_mbr_ = new MinimumBayesRisk(phone_clat, phones, ConfidenceOnlyOptions());
+  }
+  std::vector<std::pair<BaseFloat, BaseFloat> > times;
+  Confidences(*phone_mbr_, reference_phones_, phones, confidences, &times);
+}
+
+void LatticeAnalysis::Confidences(
+    const MinimumBayesRisk &mbr, const std::vector<int32> &reference,
+    const std::vector<int32> &symbols, std::vector<BaseFloat> *confidences,
+    std::vector<std::pair<BaseFloat, BaseFloat> > *times) {
+  if (symbols == reference) {
+    *confidences = mbr.GetOneBestConfidences();
+    *times = mbr.GetOneBestTimes();
+    return;
+  }
+
+  // Edit-distance alignment of the symbols to the bins of the sausage:
+  // a symbol in a bin costs the posterior mass of the other entries, a bin
+  // left out costs the mass of its non-epsilon entries and a symbol in no
+  // bin costs 1
+  const std::vector<std::vector<std::pair<int32, BaseFloat> > > &bins =
+      mbr.GetSausageStats();
+  const std::vector<std::pair<BaseFloat, BaseFloat> > &bin_times = mbr.GetSausageTimes();
+  size_t num_bins = bins.size(), num_symbols = symbols.size();
+  enum { kStart, kSkipBin, kSkipSymbol, kMatch };
+  std::vector<std::vector<BaseFloat> > cost(num_bins + 1,
+                                            std::vector<BaseFloat>(num_symbols + 1));
+  std::vector<std::vector<char> > step(num_bins + 1,
+                                       std::vector<char>(num_symbols + 1, kStart));
+  for (size_t i = 0; i <= num_bins; i++) {
+    for (size_t j = 0; j <= num_symbols; j++) {
+      if (i == 0 && j == 0) {
+        cost[i][j] = 0.0;
+        continue;
+      }
+      cost[i][j] = std::numeric_limits<BaseFloat>::infinity();
+      if (i > 0) {
+        cost[i][j] = cost[i - 1][j] + 1 - BinPosterior(bins[i - 1], 0);
+        step[i][j] = kSkipBin;
+      }
+      if (j > 0 && cost[i][j - 1] + 1 < cost[i][j]) {
+        cost[i][j] = cost[i][j - 1] + 1;
+        step[i][j] = kSkipSymbol;
+      }
+      if (i > 0 && j > 0) {
+        BaseFloat match = cost[i - 1][j - 1] + 1 - BinPosterior(bins[i - 1], symbols[j - 1]);
+        if (match < cost[i][j]) {
+          cost[i][j] = match;
+          step[i][j] = kMatch;
+        }
+      }
+    }
+  }
+
+  confidences->assign(num_symbols, 0.0);
+  times->assign(num_symbols, std::pair<BaseFloat, BaseFloat>(0.0, 0.0));
+  // the bin of each symbol, -1 for none
+  std::vector<int32> symbol_bin(num_symbols, -1);
+  for (size_t i = num_bins, j = num_symbols; i > 0 || j > 0; ) {
+    switch (step[i][j]) {
+      case kMatch:
+        symbol_bin[j - 1] = i - 1;
+        i--;
+        j--;
+        break;
+      case kSkipSymbol:
+        j--;
+        break;
+      default:
+        i--;
+    }
+  }
+  BaseFloat previous_end = 0.0;
+  for (size_t j = 0; j < num_symbols; j++) {
+    if (symbol_bin[j] >= 0) {
+      (*confidences)[j] = BinPosterior(bins[symbol_bin[j]], symbols[j]);
+      (*times)[j] = bin_times[symbol_bin[j]];
+      previous_end = bin_times[symbol_bin[j]].second;
+    } else {
+      // not in the lattice around here: no time of its own
+      (*times)[j] = std::pair<BaseFloat, BaseFloat>(previous_end, previous_end);
+    }
+  }
+}
+
+}  // namespace kaldi
@@ -0,0 +1,85 @@
+// gst-plugin/lattice-analysis.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_LATTICE_ANALYSIS_H_
+#define KALDI_SRC_LATTICE_ANALYSIS_H_
+
+#include <utility>
+#include <vector>
+
+#include "hmm/transition-model.h"
+#include "lat/kaldi-lattice.h"
+#include "lat/sausages.h"
+
+namespace kaldi {
+
+// The confidences of the final result of an utterance, from one minimum
+// Bayes risk analysis of its lattice instead of one per use. MBR is run
+// once on the word lattice with the best path as the reference, which gives
+// the utterance confidence and the confidences and times of the words of the
+// best path, exactly as running it for them separately would. The other
+// hypotheses of the n-best list are aligned to the confusion network
+// ("sausage") of that analysis and take the posteriors of their words in
+// the bins they are aligned to. The phone lattice and its analysis are made
+// the same way, once, when phone confidences are first asked for.
+class LatticeAnalysis {
+ public:
+  // 'clat' is the (word-aligned) lattice of the utterance and 'best_words'
+  // the words of its best path, without epsilons, which are copied. 'clat'
+  // and 'trans_model' must outlive this.
+  LatticeAnalysis(const CompactLattice &clat, const std::vector<int32> &best_words,
+                  const TransitionModel &trans_model);
+
+  ~LatticeAnalysis();
+
+  // Product of the confidences of the words of the best path
+  BaseFloat UtteranceConfidence() const;
+
+  // Confidences and (start, end) frames of the words of a hypothesis,
+  // given without epsilons
+  void WordConfidences(const std::vector<int32> &words,
+                       std::vector<BaseFloat> *confidences,
+                       std::vector<std::pair<BaseFloat, BaseFloat> > *times) const;
+
+  // Confidences of the phones of a hypothesis. The phones of the first
+  // hypothesis that is asked for are the reference of the phone analysis,
+  // so that should be the best one.
+  void PhoneConfidences(const std::vector<int32> &phones,
+                        std::vector<BaseFloat> *confidences);
+
+ private:
+  // Confidences and times of 'symbols' from the analysis 'mbr' whose
+  // reference is 'reference'
+  static void Confidences(const MinimumBayesRisk &mbr,
+                          const std::vector<int32> &reference,
+                          const std::vector<int32> &symbols,
+                          std::vector<BaseFloat> *confidences,
+                          std::vector<std::pair<BaseFloat, BaseFloat> > *times);
+
+  const CompactLattice &clat_;
+  const TransitionModel &trans_model_;
+  std::vector<int32> best_words_;
+  MinimumBayesRisk *word_mbr_;
+  std::vector<int32> reference_phones_;
+  MinimumBayesRisk *phone_mbr_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(LatticeAnalysis);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_LATTICE_ANALYSIS_H_
@@ -0,0 +1,160 @@
+// gst-plugin/lattice-nbest-bench.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the time of getting the n best paths of synthetic lattices by
+// converting them to a Lattice and running fst::ShortestPath (as the plugin
+// used to do) with CompactLatticeNBest. Not part of the plugin, build it with
+// "make lattice-nbest-bench".
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "fstext/fstext-lib.h"
+#include "lat/kaldi-lattice.h"
+#include "lat/lattice-functions.h"
+#include "util/parse-options.h"
+
+#include "./lattice-nbest.h"
+
+namespace kaldi {
+
+// A lattice like the ones the decoder produces: 'num_words' word positions,
+// each with 'num_alternatives' competing words of 1 to 10 transition-ids.
+// The words of the arcs leaving a state differ, so that, as in a
+// determinized lattice, every path has its own word sequence.
+static void MakeLattice(int32 num_words, int32 num_alternatives,
+                        CompactLattice *clat) {
+  clat->DeleteStates();
+  CompactLattice::StateId state = clat->AddState();
+  clat->SetStart(state);
+  for (int32 i = 0; i < num_words; i++) {
+    CompactLattice::StateId next_state = clat->AddState();
+    for (int32 j = 0; j < num_alternatives; j++) {
+      int32 word = 1 + j + num_alternatives * (i % 100);
+      std::vector<int32> alignment(1 + Rand() % 10);
+      for (size_t k = 0; k < alignment.size(); k++) {
+        alignment[k] = 1 + Rand() % 5000;
+      }
+      LatticeWeight weight(5.0 * RandUniform(), 20.0 * RandUniform());
+      clat->AddArc(state, CompactLatticeArc(word, word,
+                                            CompactLatticeWeight(weight, alignment),
+                                            next_state));
+    }
+    state = next_state;
+  }
+  clat->SetFinal(state, CompactLatticeWeight::One());
+}
+
+// The old way, from the CompactLattice to the paths
+static void ShortestPathNBest(const CompactLattice &clat, int32 n,
+                              std::vector<LatticePath> *paths) {
+  Lattice lat;
+  ConvertLattice(clat, &lat);
+  Lattice nbest_lat;
+  fst::ShortestPath(lat, &nbest_lat, n);
+  std::vector<Lattice> nbest_lats;
+  fst::ConvertNbestToVector(nbest_lat, &nbest_lats);
+  paths->resize(nbest_lats.size());
+  for (size_t i = 0; i < nbest_lats.size(); i++) {
+    GetLinearSymbolSequence(nbest_lats[i], &(*paths)[i].alignment,
+                            &(*paths)[i].words, &(*paths)[i].weight);
+  }
+}
+
+static bool SamePaths(const std::vector<LatticePath> &a,
+                      const std::vector<LatticePath> &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].words != b[i].words || a[i].alignment != b[i].alignment
+        || !ApproxEqual(a[i].weight, b[i].weight)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace kaldi
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+    const char *usage =
+        "Times the n-best extraction of the full final results on synthetic lattices\n"
+        "of growing size: ShortestPath on the converted Lattice vs. CompactLatticeNBest\n"
+        "\n"
+        "Usage: lattice-nbest-bench [options]\n";
+    ParseOptions po(usage);
+    int32 num_nbest = 10;
+    int32 num_alternatives = 4;
+    int32 num_repeats = 20;
+    int32 seed = 0;
+    po.Register("num-nbest", &num_nbest, "Number of paths to extract");
+    po.Register("num-alternatives", &num_alternatives,
+                "Number of competing words at each word position");
+    po.Register("num-repeats", &num_repeats, "Number of times each lattice is processed");
+    po.Register("seed", &seed, "Seed of the random lattices");
+    po.Read(argc, argv);
+    if (po.NumArgs() != 0) {
+      po.PrintUsage();
+      return 1;
+    }
+    srand(seed);
+
+    const int32 lattice_sizes[] = { 10, 30, 100, 300, 1000, 3000 };
+    std::cout << std::setw(8) << "words" << std::setw(10) << "arcs"
+              << std::setw(18) << "shortest-path ms" << std::setw(12) << "lazy ms"
+              << std::setw(10) << "speedup" << "  same paths" << std::endl;
+    bool all_same = true;
+    for (size_t s = 0; s < sizeof(lattice_sizes) / sizeof(lattice_sizes[0]); s++) {
+      CompactLattice clat;
+      MakeLattice(lattice_sizes[s], num_alternatives, &clat);
+
+      std::vector<LatticePath> old_paths, new_paths;
+      Timer old_timer;
+      for (int32 r = 0; r < num_repeats; r++) {
+        ShortestPathNBest(clat, num_nbest, &old_paths);
+      }
+      double old_secs = old_timer.Elapsed() / num_repeats;
+      Timer new_timer;
+      for (int32 r = 0; r < num_repeats; r++) {
+        CompactLatticeNBest(clat, num_nbest, &new_paths);
+      }
+      double new_secs = new_timer.Elapsed() / num_repeats;
+
+      bool same = SamePaths(old_paths, new_paths);
+      all_same = all_same && same;
+      std::cout << std::setw(8) << lattice_sizes[s]
+                << std::setw(10) << lattice_sizes[s] * num_alternatives
+                << std::fixed << std::setprecision(3)
+                << std::setw(18) << old_secs * 1000.0
+                << std::setw(12) << new_secs * 1000.0
+                << std::setprecision(1)
+                << std::setw(10) << old_secs / new_secs
+                << "  " << (same ? "yes" : "NO") << std::endl;
+    }
+    return all_same ? 0 : 1;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
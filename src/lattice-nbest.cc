@@ -0,0 +1,155 @@
+// gst-plugin/lattice-nbest.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <set>
+#include <utility>
+
+#include "./lattice-nbest.h"
+#include "fstext/fstext-lib.h"
+
+namespace kaldi {
+
+// bound on the partial paths that are kept, in case the lattice has a huge
+// number of paths with the same words; the memory of the search is bounded
+// by this plus the arcs of one state
+static const size_t kMaxSearchNodes = 1000000;
+
+namespace {
+
+// A partial path of the search: 'state' is reached from the path of node
+// 'parent' by its arc number 'arc_index', or, when arc_index is -1, this is
+// the complete path that ends in the final state of its parent.
+struct SearchNode {
+  int32 parent;
+  CompactLattice::StateId state;
+  int32 arc_index;
+  LatticeWeight weight;
+};
+
+}  // namespace
+
+void CompactLatticeNBest(const CompactLattice &clat_in, int32 n,
+                         std::vector<LatticePath> *paths) {
+  typedef CompactLattice::StateId StateId;
+  typedef CompactLattice::Arc Arc;
+  paths->clear();
+  if (n <= 0 || clat_in.Start() == fst::kNoStateId) {
+    return;
+  }
+  const CompactLattice *clat = &clat_in;
+  CompactLattice sorted_clat;
+  if (clat_in.Properties(fst::kTopSorted, true) == 0) {
+    sorted_clat = clat_in;
+    if (!fst::TopSort(&sorted_clat)) {
+      KALDI_ERR << "Cannot get the n-best paths of a lattice with cycles";
+    }
+    clat = &sorted_clat;
+  }
+
+  // the cost of the best way from each state to the end, in reverse
+  // topological order
+  const double infinity = std::numeric_limits<double>::infinity();
+  StateId num_states = clat->NumStates();
+  std::vector<double> cost_to_end(num_states, infinity);
+  for (StateId s = num_states - 1; s >= 0; s--) {
+    double cost = ConvertToCost(clat->Final(s));
+    for (fst::ArcIterator<CompactLattice> aiter(*clat, s); !aiter.Done(); aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      cost = std::min(cost, ConvertToCost(arc.weight) + cost_to_end[arc.nextstate]);
+    }
+    cost_to_end[s] = cost;
+  }
+  if (cost_to_end[clat->Start()] == infinity) {
+    return;
+  }
+
+  // queued by the cost of the partial path plus the cost of the best way to
+  // the end from where it is; ties by node number, so that the order is the
+  // same from run to run
+  typedef std::pair<double, int32> QueueElem;
+  std::priority_queue<QueueElem, std::vector<QueueElem>,
+                      std::greater<QueueElem> > queue;
+  std::vector<SearchNode> nodes;
+  std::set<std::vector<int32> > seen_words;
+
+  SearchNode start = { -1, clat->Start(), 0, LatticeWeight::One() };
+  nodes.push_back(start);
+  queue.push(QueueElem(cost_to_end[start.state], 0));
+
+  while (!queue.empty() && static_cast<int32>(paths->size()) < n) {
+    if (nodes.size() >= kMaxSearchNodes) {
+      KALDI_WARN << "Stopping the n-best search at " << kMaxSearchNodes
+                 << " partial paths with " << paths->size() << " paths";
+      break;
+    }
+    int32 index = queue.top().second;
+    queue.pop();
+    SearchNode node = nodes[index];
+
+    if (node.arc_index == -1) {
+      // a complete path: the arcs are collected from the end backwards
+      LatticePath path;
+      path.weight = node.weight;
+      CompactLatticeWeight final_weight = clat->Final(node.state);
+      const std::vector<int32> &final_string = final_weight.String();
+      path.alignment.assign(final_string.rbegin(), final_string.rend());
+      for (int32 i = node.parent; nodes[i].parent != -1; i = nodes[i].parent) {
+        fst::ArcIterator<CompactLattice> aiter(*clat, nodes[nodes[i].parent].state);
+        aiter.Seek(nodes[i].arc_index);
+        const Arc &arc = aiter.Value();
+        const std::vector<int32> &string = arc.weight.String();
+        path.alignment.insert(path.alignment.end(), string.rbegin(), string.rend());
+        if (arc.olabel != 0) {
+          path.words.push_back(arc.olabel);
+        }
+      }
+      std::reverse(path.alignment.begin(), path.alignment.end());
+      std::reverse(path.words.begin(), path.words.end());
+      if (seen_words.insert(path.words).second) {
+        paths->push_back(path);
+      }
+      continue;
+    }
+
+    int32 arc_index = 0;
+    for (fst::ArcIterator<CompactLattice> aiter(*clat, node.state); !aiter.Done();
+         aiter.Next(), arc_index++) {
+      const Arc &arc = aiter.Value();
+      if (cost_to_end[arc.nextstate] == infinity) {
+        continue;
+      }
+      SearchNode next = { index, arc.nextstate, arc_index,
+                          Times(node.weight, arc.weight.Weight()) };
+      nodes.push_back(next);
+      queue.push(QueueElem(ConvertToCost(next.weight) + cost_to_end[next.state],
+                           nodes.size() - 1));
+    }
+    CompactLatticeWeight final_weight = clat->Final(node.state);
+    if (final_weight != CompactLatticeWeight::Zero()) {
+      SearchNode complete = { index, node.state, -1,
+                              Times(node.weight, final_weight.Weight()) };
+      nodes.push_back(complete);
+      queue.push(QueueElem(ConvertToCost(complete.weight), nodes.size() - 1));
+    }
+  }
+}
+
+}  // namespace kaldi
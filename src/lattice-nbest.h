@@ -0,0 +1,47 @@
+// gst-plugin/lattice-nbest.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_LATTICE_NBEST_H_
+#define KALDI_SRC_LATTICE_NBEST_H_
+
+#include <vector>
+
+#include "lat/kaldi-lattice.h"
+
+namespace kaldi {
+
+// One path of a lattice: its words, the transition-ids along it and its
+// total (graph, acoustic) cost
+struct LatticePath {
+  std::vector<int32> words;
+  std::vector<int32> alignment;
+  LatticeWeight weight;
+};
+
+// Puts the n best paths of 'clat' with distinct word sequences in 'paths',
+// best first. Works on the CompactLattice directly instead of converting it
+// to a Lattice and running fst::ShortestPath: the cost from every state to
+// the end is computed once backwards, and an A* search with these exact
+// costs as the heuristic then extends partial paths best first, so only the
+// paths that are output and the prefixes that compete with them are ever
+// expanded, and it stops as soon as n distinct word sequences are found.
+void CompactLatticeNBest(const CompactLattice &clat, int32 n,
+                         std::vector<LatticePath> *paths);
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_LATTICE_NBEST_H_
@@ -0,0 +1,156 @@
+// gst-plugin/model-registry.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <climits>
+#include <cstdlib>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "./model-registry.h"
+
+namespace kaldi {
+
+ModelRegistry &ModelRegistry::Instance() {
+  // never destroyed, elements may still release models at exit
+  static ModelRegistry *instance = new ModelRegistry();
+  return *instance;
+}
+
+ModelRegistry::ModelRegistry() : num_private_(0) {
+  g_mutex_init(&lock_);
+  g_cond_init(&loaded_cond_);
+  stats_.num_objects = 0;
+  stats_.num_hits = 0;
+  stats_.num_misses = 0;
+  stats_.bytes_loaded = 0;
+  stats_.bytes_saved = 0;
+}
+
+bool ModelRegistry::MakeKey(const std::string &kind,
+                            const std::string &filename,
+                            const std::string &options,
+                            std::string *key, int64 *size) {
+  char canonical[PATH_MAX];
+  struct stat st;
+  if (realpath(filename.c_str(), canonical) == NULL
+      || stat(canonical, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+  std::ostringstream os;
+  os << kind << ':' << canonical << ':' << st.st_mtime << ':'
+     << st.st_size << ':' << options;
+  *key = os.str();
+  *size = st.st_size;
+  return true;
+}
+
+void *ModelRegistry::Lookup(const std::string &key, int64 size) {
+  g_mutex_lock(&lock_);
+  while (true) {
+    std::map<std::string, Entry>::iterator it = entries_.find(key);
+    if (it == entries_.end()) {
+      Entry entry;
+      entry.object = NULL;
+      entry.destroy = NULL;
+      entry.refcount = 1;
+      entry.size = size;
+      entries_[key] = entry;
+      stats_.num_misses++;
+      g_mutex_unlock(&lock_);
+      return NULL;
+    }
+    if (it->second.object != NULL) {
+      it->second.refcount++;
+      stats_.num_hits++;
+      stats_.bytes_saved += it->second.size;
+      void *object = it->second.object;
+      g_mutex_unlock(&lock_);
+      return object;
+    }
+    // another thread is loading it; if that fails, the entry disappears
+    // and we try to load it ourselves
+    g_cond_wait(&loaded_cond_, &lock_);
+  }
+}
+
+void ModelRegistry::Insert(const std::string &key, void *object,
+                           void (*destroy)(void *object)) {
+  g_mutex_lock(&lock_);
+  Entry &entry = entries_[key];
+  entry.object = object;
+  entry.destroy = destroy;
+  keys_[object] = key;
+  stats_.num_objects++;
+  stats_.bytes_loaded += entry.size;
+  g_cond_broadcast(&loaded_cond_);
+  g_mutex_unlock(&lock_);
+}
+
+void ModelRegistry::Abandon(const std::string &key) {
+  g_mutex_lock(&lock_);
+  entries_.erase(key);
+  g_cond_broadcast(&loaded_cond_);
+  g_mutex_unlock(&lock_);
+}
+
+void ModelRegistry::Ref(const void *object) {
+  if (object == NULL) {
+    return;
+  }
+  g_mutex_lock(&lock_);
+  std::map<const void*, std::string>::iterator key_it = keys_.find(object);
+  KALDI_ASSERT(key_it != keys_.end());
+  entries_[key_it->second].refcount++;
+  g_mutex_unlock(&lock_);
+}
+
+void ModelRegistry::Release(const void *object) {
+  if (object == NULL) {
+    return;
+  }
+  g_mutex_lock(&lock_);
+  std::map<const void*, std::string>::iterator key_it = keys_.find(object);
+  if (key_it == keys_.end()) {
+    g_mutex_unlock(&lock_);
+    KALDI_WARN << "Releasing an object that is not in the model registry";
+    return;
+  }
+  std::map<std::string, Entry>::iterator it = entries_.find(key_it->second);
+  KALDI_ASSERT(it != entries_.end());
+  if (--it->second.refcount > 0) {
+    g_mutex_unlock(&lock_);
+    return;
+  }
+  Entry entry = it->second;
+  entries_.erase(it);
+  keys_.erase(key_it);
+  stats_.num_objects--;
+  stats_.bytes_loaded -= entry.size;
+  g_mutex_unlock(&lock_);
+  // models can be big, don't keep the registry locked while freeing them
+  entry.destroy(entry.object);
+}
+
+ModelRegistry::Stats ModelRegistry::GetStats() {
+  g_mutex_lock(&lock_);
+  Stats stats = stats_;
+  g_mutex_unlock(&lock_);
+  return stats;
+}
+
+}  // namespace kaldi
@@ -0,0 +1,133 @@
+// gst-plugin/model-registry.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_MODEL_REGISTRY_H_
+#define KALDI_SRC_MODEL_REGISTRY_H_
+
+#include <map>
+#include <string>
+
+#include <glib.h>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+// Process-wide registry of read-only model objects (decoding graphs, acoustic
+// models, symbol tables, language models). Decoder elements that load the
+// same file with the same options get the same object, which is deleted
+// when the last element releases it. Files are identified by their canonical
+// path and modification time, so a file that has changed on disk is loaded
+// again. All methods are thread-safe.
+class ModelRegistry {
+ public:
+  struct Stats {
+    int32 num_objects;     // objects currently loaded
+    int64 num_hits;        // acquisitions served from an already loaded object
+    int64 num_misses;      // acquisitions that had to load the object
+    int64 bytes_loaded;    // total size of the files currently loaded
+    int64 bytes_saved;     // total size of the files whose loading was avoided
+  };
+
+  static ModelRegistry &Instance();
+
+  // Returns the object that 'load' creates from 'filename', sharing it with
+  // the other users that have acquired the same kind of object from the same
+  // file and with the same 'options'. If 'shared' is false, or 'filename' is
+  // not a regular file (e.g. a piped rspecifier), a private object is always
+  // loaded. Exceptions thrown by 'load' are passed on to the caller.
+  // Every acquired object must be released with Release().
+  template<class T, class Loader>
+  T *Acquire(const std::string &kind, const std::string &filename,
+             const std::string &options, bool shared, Loader load);
+
+  // Takes another reference to an acquired object. NULL is ignored.
+  void Ref(const void *object);
+
+  // Drops one reference to 'object', deleting it if it was the last one.
+  // NULL is ignored.
+  void Release(const void *object);
+
+  Stats GetStats();
+
+ private:
+  struct Entry {
+    void *object;  // NULL while it is being loaded
+    void (*destroy)(void *object);
+    int32 refcount;
+    int64 size;
+  };
+
+  ModelRegistry();
+
+  template<class T>
+  static void DestroyObject(void *object) {
+    delete static_cast<T*>(object);
+  }
+
+  // Builds the registry key; returns false if the file can't be shared
+  bool MakeKey(const std::string &kind, const std::string &filename,
+               const std::string &options, std::string *key, int64 *size);
+
+  // Looks up 'key' and takes a reference, waiting if the object is being
+  // loaded by another thread. If the key is unknown, inserts a placeholder
+  // that the caller must fill with Insert() or remove with Abandon().
+  void *Lookup(const std::string &key, int64 size);
+  void Insert(const std::string &key, void *object,
+              void (*destroy)(void *object));
+  void Abandon(const std::string &key);
+
+  GMutex lock_;
+  GCond loaded_cond_;
+  std::map<std::string, Entry> entries_;
+  std::map<const void*, std::string> keys_;
+  int64 num_private_;
+  Stats stats_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ModelRegistry);
+};
+
+template<class T, class Loader>
+T *ModelRegistry::Acquire(const std::string &kind, const std::string &filename,
+                          const std::string &options, bool shared,
+                          Loader load) {
+  std::string key;
+  int64 size = 0;
+  bool can_share = MakeKey(kind, filename, options, &key, &size);
+  if (!shared || !can_share) {
+    // registered under a unique key so that Release() works the same way
+    g_mutex_lock(&lock_);
+    key = "private:" + std::to_string(num_private_++);
+    g_mutex_unlock(&lock_);
+  }
+  void *object = Lookup(key, size);
+  if (object != NULL) {
+    return static_cast<T*>(object);
+  }
+  T *new_object;
+  try {
+    new_object = load();
+  } catch (...) {
+    Abandon(key);
+    throw;
+  }
+  Insert(key, new_object, &DestroyObject<T>);
+  return new_object;
+}
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_MODEL_REGISTRY_H_
@@ -0,0 +1,96 @@
+// gst-plugin/nnet2-segment-decoder.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./nnet2-segment-decoder.h"
+#include "lat/determinize-lattice-pruned.h"
+
+namespace kaldi {
+
+SingleUtteranceNnet2SegmentDecoder::SingleUtteranceNnet2SegmentDecoder(
+    const OnlineNnet2DecodingConfig &config,
+    const TransitionModel &tmodel,
+    const nnet2::AmNnet &model,
+    const fst::Fst<fst::StdArc> &fst,
+    OnlineNnet2FeaturePipeline *feature_pipeline) :
+    config_(config),
+    tmodel_(tmodel),
+    model_(model),
+    feature_pipeline_(feature_pipeline),
+    decodable_(new nnet2::DecodableNnet2Online(model, tmodel, config.decodable_opts,
+                                               feature_pipeline)),
+    segment_decodable_(decodable_.get()),
+    decoder_(fst, config.decoder_opts) {
+  decoder_.InitDecoding();
+}
+
+void SingleUtteranceNnet2SegmentDecoder::InitDecoding(int32 frame_offset) {
+  segment_decodable_.SetFrameOffset(frame_offset);
+  // the decoder keeps the memory it has allocated for tokens
+  decoder_.InitDecoding();
+}
+
+void SingleUtteranceNnet2SegmentDecoder::SetFeaturePipeline(
+    OnlineNnet2FeaturePipeline *feature_pipeline) {
+  // the nnet output cache belongs to the old features
+  decodable_.reset(new nnet2::DecodableNnet2Online(model_, tmodel_, config_.decodable_opts,
+                                                   feature_pipeline));
+  feature_pipeline_ = feature_pipeline;
+  segment_decodable_.SetDecodable(decodable_.get());
+  segment_decodable_.SetFrameOffset(0);
+}
+
+void SingleUtteranceNnet2SegmentDecoder::AdvanceDecoding() {
+  decoder_.AdvanceDecoding(&segment_decodable_);
+}
+
+void SingleUtteranceNnet2SegmentDecoder::FinalizeDecoding() {
+  decoder_.FinalizeDecoding();
+}
+
+int32 SingleUtteranceNnet2SegmentDecoder::NumFramesDecoded() const {
+  return decoder_.NumFramesDecoded();
+}
+
+void SingleUtteranceNnet2SegmentDecoder::GetLattice(bool end_of_utterance,
+                                                    CompactLattice *clat) const {
+  if (NumFramesDecoded() == 0) {
+    KALDI_ERR << "You cannot get a lattice if you decoded no frames.";
+  }
+  Lattice raw_lat;
+  decoder_.GetRawLattice(&raw_lat, end_of_utterance);
+
+  if (!config_.decoder_opts.determinize_lattice) {
+    KALDI_ERR << "--determinize-lattice=false option is not supported at the moment";
+  }
+  DeterminizeLatticePhonePrunedWrapper(tmodel_, &raw_lat,
+                                       config_.decoder_opts.lattice_beam, clat,
+                                       config_.decoder_opts.det_opts);
+}
+
+void SingleUtteranceNnet2SegmentDecoder::GetBestPath(bool end_of_utterance,
+                                                     Lattice *best_path) const {
+  decoder_.GetBestPath(best_path, end_of_utterance);
+}
+
+bool SingleUtteranceNnet2SegmentDecoder::EndpointDetected(
+    const OnlineEndpointConfig &config) {
+  return kaldi::EndpointDetected(config, tmodel_,
+                                 feature_pipeline_->FrameShiftInSeconds(),
+                                 decoder_);
+}
+
+}  // namespace kaldi
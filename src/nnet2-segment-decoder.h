@@ -0,0 +1,108 @@
+// gst-plugin/nnet2-segment-decoder.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_NNET2_SEGMENT_DECODER_H_
+#define KALDI_SRC_NNET2_SEGMENT_DECODER_H_
+
+#include <memory>
+
+#include "online2/online-nnet2-decoding.h"
+#include "online2/online-nnet2-feature-pipeline.h"
+#include "online2/online-endpoint.h"
+#include "nnet2/online-nnet2-decodable.h"
+#include "decoder/lattice-faster-online-decoder.h"
+
+namespace kaldi {
+
+// Like Kaldi's SingleUtteranceNnet2Decoder, but decodes one segment after
+// another, so the decoder's allocated token storage is reused instead of
+// being created for every segment. InitDecoding(frame_offset) starts a new
+// segment at frame_offset of the features, like SingleUtteranceNnet3Decoder.
+// The features can be replaced between segments with SetFeaturePipeline().
+class SingleUtteranceNnet2SegmentDecoder {
+ public:
+  SingleUtteranceNnet2SegmentDecoder(const OnlineNnet2DecodingConfig &config,
+                                     const TransitionModel &tmodel,
+                                     const nnet2::AmNnet &model,
+                                     const fst::Fst<fst::StdArc> &fst,
+                                     OnlineNnet2FeaturePipeline *feature_pipeline);
+
+  // Starts decoding a segment that begins at frame frame_offset
+  void InitDecoding(int32 frame_offset = 0);
+
+  // Decodes 'feature_pipeline' instead of the current features from the
+  // next InitDecoding() on; the frame offsets then count from its start
+  void SetFeaturePipeline(OnlineNnet2FeaturePipeline *feature_pipeline);
+
+  void AdvanceDecoding();
+
+  void FinalizeDecoding();
+
+  // Changes the search options from the next frame on
+  void SetDecoderOptions(const LatticeFasterDecoderConfig &decoder_opts) {
+    decoder_.SetOptions(decoder_opts);
+  }
+
+  // Frames decoded in the current segment
+  int32 NumFramesDecoded() const;
+
+  void GetLattice(bool end_of_utterance, CompactLattice *clat) const;
+
+  void GetBestPath(bool end_of_utterance, Lattice *best_path) const;
+
+  bool EndpointDetected(const OnlineEndpointConfig &config);
+
+  const LatticeFasterOnlineDecoder &Decoder() const { return decoder_; }
+
+ private:
+  // Presents the frames of the nnet output from frame_offset_ on as
+  // frames 0, 1, ... of the segment
+  class DecodableOffset : public DecodableInterface {
+   public:
+    explicit DecodableOffset(DecodableInterface *decodable) :
+        decodable_(decodable), frame_offset_(0) { }
+    void SetDecodable(DecodableInterface *decodable) { decodable_ = decodable; }
+    void SetFrameOffset(int32 frame_offset) { frame_offset_ = frame_offset; }
+    virtual BaseFloat LogLikelihood(int32 frame, int32 index) {
+      return decodable_->LogLikelihood(frame + frame_offset_, index);
+    }
+    virtual bool IsLastFrame(int32 frame) const {
+      return decodable_->IsLastFrame(frame + frame_offset_);
+    }
+    virtual int32 NumFramesReady() const {
+      return decodable_->NumFramesReady() - frame_offset_;
+    }
+    virtual int32 NumIndices() const { return decodable_->NumIndices(); }
+   private:
+    DecodableInterface *decodable_;
+    int32 frame_offset_;
+  };
+
+  const OnlineNnet2DecodingConfig &config_;
+  const TransitionModel &tmodel_;
+  const nnet2::AmNnet &model_;
+  OnlineNnet2FeaturePipeline *feature_pipeline_;
+  std::unique_ptr<nnet2::DecodableNnet2Online> decodable_;
+  DecodableOffset segment_decodable_;
+  LatticeFasterOnlineDecoder decoder_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(SingleUtteranceNnet2SegmentDecoder);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_NNET2_SEGMENT_DECODER_H_
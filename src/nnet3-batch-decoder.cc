@@ -0,0 +1,208 @@
+// gst-plugin/nnet3-batch-decoder.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include <glib.h>
+
+#include "./compute-budget.h"
+#include "./nnet3-batch-decoder.h"
+#include "lat/determinize-lattice-pruned.h"
+
+namespace kaldi {
+
+DecodableNnet3Batch::DecodableNnet3Batch(const TransitionModel &trans_model,
+                                         NnetBatchScorer *scorer,
+                                         OnlineFeatureInterface *input_features,
+                                         OnlineFeatureInterface *ivector_features) :
+    trans_model_(trans_model),
+    scorer_(scorer),
+    input_features_(input_features),
+    ivector_features_(ivector_features),
+    frame_offset_(0),
+    current_chunk_start_(0) {
+  KALDI_ASSERT(input_features_->Dim() == scorer_->InputDim());
+  KALDI_ASSERT((ivector_features_ != NULL ? ivector_features_->Dim() : 0)
+               == scorer_->IvectorDim());
+}
+
+void DecodableNnet3Batch::SetFrameOffset(int32 frame_offset) {
+  KALDI_ASSERT(frame_offset >= current_chunk_start_);
+  frame_offset_ = frame_offset;
+}
+
+int32 DecodableNnet3Batch::NumStreamFramesReady() const {
+  int32 sf = scorer_->FrameSubsamplingFactor();
+  int32 num_input_frames = input_features_->NumFramesReady();
+  if (num_input_frames == 0) {
+    return 0;
+  }
+  if (input_features_->IsLastFrame(num_input_frames - 1)) {
+    // the right context of the last frames is padded
+    return (num_input_frames + sf - 1) / sf;
+  }
+  int32 num_frames = 0;
+  if (num_input_frames > scorer_->RightContext()) {
+    num_frames = (num_input_frames - scorer_->RightContext() - 1) / sf + 1;
+  }
+  // only whole chunks, so that they can be batched with the other streams
+  int32 next_chunk_start = current_chunk_start_ + current_log_post_.NumRows();
+  if (num_frames <= next_chunk_start) {
+    return next_chunk_start;
+  }
+  int32 chunk_size = scorer_->ChunkSize();
+  return next_chunk_start + (num_frames - next_chunk_start) / chunk_size * chunk_size;
+}
+
+int32 DecodableNnet3Batch::NumFramesReady() const {
+  return NumStreamFramesReady() - frame_offset_;
+}
+
+bool DecodableNnet3Batch::IsLastFrame(int32 frame) const {
+  int32 num_input_frames = input_features_->NumFramesReady();
+  if (num_input_frames == 0 || !input_features_->IsLastFrame(num_input_frames - 1)) {
+    return false;
+  }
+  return frame + frame_offset_ == NumStreamFramesReady() - 1;
+}
+
+BaseFloat DecodableNnet3Batch::LogLikelihood(int32 frame, int32 index) {
+  int32 stream_frame = frame + frame_offset_;
+  KALDI_ASSERT(stream_frame >= current_chunk_start_);
+  if (stream_frame >= current_chunk_start_ + current_log_post_.NumRows()) {
+    ComputeChunk(current_chunk_start_ + current_log_post_.NumRows());
+  }
+  return current_log_post_(stream_frame - current_chunk_start_,
+                           trans_model_.TransitionIdToPdf(index));
+}
+
+void DecodableNnet3Batch::ComputeChunk(int32 chunk_start) {
+  int32 sf = scorer_->FrameSubsamplingFactor();
+  int32 left_context = scorer_->LeftContext(),
+      right_context = scorer_->RightContext();
+  int32 num_input_frames = input_features_->NumFramesReady();
+  int32 num_frames = std::min(scorer_->ChunkSize(),
+                              NumStreamFramesReady() - chunk_start);
+  KALDI_ASSERT(num_frames > 0);
+
+  nnet3::NnetInferenceTask task;
+  int32 first_input_frame = chunk_start * sf - left_context;
+  int32 num_task_input_frames = left_context + (num_frames - 1) * sf + right_context + 1;
+  Matrix<BaseFloat> input(num_task_input_frames, input_features_->Dim(), kUndefined);
+  for (int32 i = 0; i < num_task_input_frames; i++) {
+    // the context before the first and after the last frame repeats them
+    int32 t = std::max(0, std::min(num_input_frames - 1, first_input_frame + i));
+    SubVector<BaseFloat> row(input, i);
+    input_features_->GetFrame(t, &row);
+  }
+  task.input.Swap(&input);
+  if (ivector_features_ != NULL) {
+    // the i-vector of the last frame of the chunk, as in looped decoding
+    int32 t = std::min(num_input_frames - 1,
+                       first_input_frame + num_task_input_frames - 1);
+    t = std::max(0, std::min(t, ivector_features_->NumFramesReady() - 1));
+    Vector<BaseFloat> ivector(ivector_features_->Dim());
+    ivector_features_->GetFrame(t, &ivector);
+    task.ivector.Resize(ivector.Dim(), kUndefined);
+    task.ivector.CopyFromVec(ivector);
+  }
+  task.first_input_t = -left_context;
+  task.output_t_stride = sf;
+  task.num_output_frames = num_frames;
+  task.num_initial_unused_output_frames = 0;
+  task.num_used_output_frames = num_frames;
+  task.first_used_output_frame_index = chunk_start;
+  task.is_edge = false;
+  task.is_irregular = (num_frames != scorer_->ChunkSize());
+  // the oldest chunks first
+  task.priority = -1e-6 * g_get_monotonic_time();
+  task.output_to_cpu = true;
+
+  scorer_->Submit(&task);
+  {
+    // the scorer thread takes a slot for the minibatch, and it can only fill
+    // one if the streams that wait for it don't hold theirs
+    ComputeSlotRelease release;
+    task.semaphore.Wait();
+  }
+
+  current_log_post_.Swap(&task.output_cpu);
+  current_chunk_start_ = chunk_start;
+}
+
+SingleUtteranceNnet3BatchDecoder::SingleUtteranceNnet3BatchDecoder(
+    const LatticeFasterDecoderConfig &decoder_opts,
+    const TransitionModel &trans_model,
+    NnetBatchScorer *scorer,
+    const fst::Fst<fst::StdArc> &fst,
+    OnlineNnet2FeaturePipeline *feature_pipeline) :
+    decoder_opts_(decoder_opts),
+    trans_model_(trans_model),
+    output_frame_shift_(feature_pipeline->FrameShiftInSeconds()
+                        * scorer->FrameSubsamplingFactor()),
+    decodable_(trans_model, scorer, feature_pipeline->InputFeature(),
+               feature_pipeline->IvectorFeature()),
+    decoder_(fst, decoder_opts) {
+  decoder_.InitDecoding();
+}
+
+void SingleUtteranceNnet3BatchDecoder::InitDecoding(int32 frame_offset) {
+  decodable_.SetFrameOffset(frame_offset);
+  // the decoder keeps the memory it has allocated for tokens
+  decoder_.InitDecoding();
+}
+
+void SingleUtteranceNnet3BatchDecoder::AdvanceDecoding() {
+  decoder_.AdvanceDecoding(&decodable_);
+}
+
+void SingleUtteranceNnet3BatchDecoder::FinalizeDecoding() {
+  decoder_.FinalizeDecoding();
+}
+
+int32 SingleUtteranceNnet3BatchDecoder::NumFramesDecoded() const {
+  return decoder_.NumFramesDecoded();
+}
+
+void SingleUtteranceNnet3BatchDecoder::GetLattice(bool end_of_utterance,
+                                                  CompactLattice *clat) const {
+  if (NumFramesDecoded() == 0) {
+    KALDI_ERR << "You cannot get a lattice if you decoded no frames.";
+  }
+  Lattice raw_lat;
+  decoder_.GetRawLattice(&raw_lat, end_of_utterance);
+
+  if (!decoder_opts_.determinize_lattice) {
+    KALDI_ERR << "--determinize-lattice=false option is not supported at the moment";
+  }
+  DeterminizeLatticePhonePrunedWrapper(trans_model_, &raw_lat,
+                                       decoder_opts_.lattice_beam, clat,
+                                       decoder_opts_.det_opts);
+}
+
+void SingleUtteranceNnet3BatchDecoder::GetBestPath(bool end_of_utterance,
+                                                   Lattice *best_path) const {
+  decoder_.GetBestPath(best_path, end_of_utterance);
+}
+
+bool SingleUtteranceNnet3BatchDecoder::EndpointDetected(
+    const OnlineEndpointConfig &config) {
+  return kaldi::EndpointDetected(config, trans_model_, output_frame_shift_,
+                                 decoder_);
+}
+
+}  // namespace kaldi
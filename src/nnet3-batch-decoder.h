@@ -0,0 +1,114 @@
+// gst-plugin/nnet3-batch-decoder.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_NNET3_BATCH_DECODER_H_
+#define KALDI_SRC_NNET3_BATCH_DECODER_H_
+
+#include "online2/online-nnet2-feature-pipeline.h"
+#include "online2/online-endpoint.h"
+#include "decoder/lattice-faster-online-decoder.h"
+#include "itf/decodable-itf.h"
+#include "itf/online-feature-itf.h"
+#include "./nnet3-batch-scorer.h"
+
+namespace kaldi {
+
+// Computes the acoustic scores of a stream chunk by chunk with a shared
+// NnetBatchScorer. A chunk is submitted when the features of all of its
+// frames and their right context are ready (or the input has ended), and
+// LogLikelihood() waits until the scorer has evaluated it.
+class DecodableNnet3Batch : public DecodableInterface {
+ public:
+  DecodableNnet3Batch(const TransitionModel &trans_model,
+                      NnetBatchScorer *scorer,
+                      OnlineFeatureInterface *input_features,
+                      OnlineFeatureInterface *ivector_features);
+
+  // Frame 0 is output frame 'frame_offset' of the stream from now on
+  void SetFrameOffset(int32 frame_offset);
+
+  virtual BaseFloat LogLikelihood(int32 frame, int32 index);
+  virtual bool IsLastFrame(int32 frame) const;
+  virtual int32 NumFramesReady() const;
+  virtual int32 NumIndices() const { return trans_model_.NumTransitionIds(); }
+
+ private:
+  // Evaluates the chunk that starts at output frame 'chunk_start' of the stream
+  void ComputeChunk(int32 chunk_start);
+
+  // Output frames of the stream that can be computed
+  int32 NumStreamFramesReady() const;
+
+  const TransitionModel &trans_model_;
+  NnetBatchScorer *scorer_;
+  OnlineFeatureInterface *input_features_;
+  OnlineFeatureInterface *ivector_features_;
+  int32 frame_offset_;
+
+  // log-likelihoods of the output frames from current_chunk_start_ on
+  Matrix<BaseFloat> current_log_post_;
+  int32 current_chunk_start_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(DecodableNnet3Batch);
+};
+
+// Like SingleUtteranceNnet3Decoder (including InitDecoding(frame_offset) for
+// decoding one segment after another), but the acoustic model is evaluated
+// by a NnetBatchScorer together with the other streams that share it.
+class SingleUtteranceNnet3BatchDecoder {
+ public:
+  SingleUtteranceNnet3BatchDecoder(const LatticeFasterDecoderConfig &decoder_opts,
+                                   const TransitionModel &trans_model,
+                                   NnetBatchScorer *scorer,
+                                   const fst::Fst<fst::StdArc> &fst,
+                                   OnlineNnet2FeaturePipeline *feature_pipeline);
+
+  // Starts decoding a segment that begins at output frame frame_offset
+  void InitDecoding(int32 frame_offset = 0);
+
+  void AdvanceDecoding();
+
+  void FinalizeDecoding();
+
+  // Changes the search options from the next frame on
+  void SetDecoderOptions(const LatticeFasterDecoderConfig &decoder_opts) {
+    decoder_.SetOptions(decoder_opts);
+  }
+
+  int32 NumFramesDecoded() const;
+
+  void GetLattice(bool end_of_utterance, CompactLattice *clat) const;
+
+  void GetBestPath(bool end_of_utterance, Lattice *best_path) const;
+
+  bool EndpointDetected(const OnlineEndpointConfig &config);
+
+  const LatticeFasterOnlineDecoder &Decoder() const { return decoder_; }
+
+ private:
+  const LatticeFasterDecoderConfig &decoder_opts_;
+  const TransitionModel &trans_model_;
+  BaseFloat output_frame_shift_;  // in seconds
+  DecodableNnet3Batch decodable_;
+  LatticeFasterOnlineDecoder decoder_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(SingleUtteranceNnet3BatchDecoder);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_NNET3_BATCH_DECODER_H_
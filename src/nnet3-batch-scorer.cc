@@ -0,0 +1,117 @@
+// gst-plugin/nnet3-batch-scorer.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "./compute-budget.h"
+#include "./nnet3-batch-scorer.h"
+
+namespace kaldi {
+
+static nnet3::NnetBatchComputerOptions BatchComputerOptions(
+    const NnetBatchScorerConfig &config,
+    const nnet3::NnetBatchComputerOptions &opts) {
+  nnet3::NnetBatchComputerOptions batch_opts(opts);
+  batch_opts.minibatch_size = config.minibatch_size;
+  // streams start at different times, so first chunks aren't special
+  batch_opts.edge_minibatch_size = config.minibatch_size;
+  return batch_opts;
+}
+
+NnetBatchScorer::NnetBatchScorer(const NnetBatchScorerConfig &config,
+                                 const nnet3::NnetBatchComputerOptions &opts,
+                                 const nnet3::Nnet &nnet,
+                                 const VectorBase<BaseFloat> &priors) :
+    opts_(BatchComputerOptions(config, opts)),
+    nnet_(nnet),
+    input_dim_(nnet.InputDim("input")),
+    ivector_dim_(std::max<int32>(0, nnet.InputDim("ivector"))),
+    max_wait_(static_cast<gint64>(config.max_wait_ms * 1000)),
+    computer_(opts_, nnet_, priors),
+    num_pending_(0),
+    first_pending_time_(0),
+    stop_(false) {
+  nnet3::ComputeSimpleNnetContext(nnet_, &left_context_, &right_context_);
+  g_mutex_init(&lock_);
+  g_cond_init(&cond_);
+  thread_ = g_thread_new("nnet3-batch", Run, this);
+}
+
+NnetBatchScorer::~NnetBatchScorer() {
+  g_mutex_lock(&lock_);
+  stop_ = true;
+  g_cond_broadcast(&cond_);
+  g_mutex_unlock(&lock_);
+  g_thread_join(thread_);
+  g_mutex_clear(&lock_);
+  g_cond_clear(&cond_);
+}
+
+void NnetBatchScorer::Submit(nnet3::NnetInferenceTask *task) {
+  g_mutex_lock(&lock_);
+  computer_.AcceptTask(task);
+  if (num_pending_++ == 0) {
+    first_pending_time_ = g_get_monotonic_time();
+  }
+  g_cond_broadcast(&cond_);
+  g_mutex_unlock(&lock_);
+}
+
+bool NnetBatchScorer::Compute(bool allow_partial_minibatch) {
+  // a minibatch is a step of the compute budget, the streams whose chunks
+  // are in it don't hold a slot while they wait
+  double wait_secs = 0.0;
+  ComputeSlot slot(&wait_secs);
+  return computer_.Compute(allow_partial_minibatch);
+}
+
+gpointer NnetBatchScorer::Run(gpointer data) {
+  static_cast<NnetBatchScorer*>(data)->RunInternal();
+  return NULL;
+}
+
+void NnetBatchScorer::RunInternal() {
+  while (true) {
+    // full minibatches don't wait
+    while (Compute(false)) { }
+
+    g_mutex_lock(&lock_);
+    if (num_pending_ == 0) {
+      if (stop_) {
+        g_mutex_unlock(&lock_);
+        break;
+      }
+      g_cond_wait(&cond_, &lock_);
+      g_mutex_unlock(&lock_);
+      continue;
+    }
+    gint64 deadline = first_pending_time_ + max_wait_;
+    if (!stop_ && g_get_monotonic_time() < deadline) {
+      // woken up early by a new chunk, which may fill a minibatch
+      g_cond_wait_until(&cond_, &lock_, deadline);
+      g_mutex_unlock(&lock_);
+      continue;
+    }
+    // Chunks that are submitted from now on are counted again; if they are
+    // evaluated below, the next round just finds nothing to do
+    num_pending_ = 0;
+    g_mutex_unlock(&lock_);
+    while (Compute(true)) { }
+  }
+}
+
+}  // namespace kaldi
@@ -0,0 +1,115 @@
+// gst-plugin/nnet3-batch-scorer.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_NNET3_BATCH_SCORER_H_
+#define KALDI_SRC_NNET3_BATCH_SCORER_H_
+
+#include <glib.h>
+
+#include "nnet3/nnet-batch-compute.h"
+#include "nnet3/nnet-utils.h"
+#include "itf/options-itf.h"
+
+namespace kaldi {
+
+struct NnetBatchScorerConfig {
+  // chunks evaluated together, from any number of streams
+  int32 minibatch_size;
+  // how long a chunk waits for a full minibatch before it is evaluated in
+  // a partial one
+  BaseFloat max_wait_ms;
+
+  NnetBatchScorerConfig() :
+      minibatch_size(32),
+      max_wait_ms(10.0) { }
+
+  void Register(OptionsItf *opts) {
+    opts->Register("batch-minibatch-size", &minibatch_size,
+                   "Batch scoring: number of chunks (from all decoders sharing the model) "
+                   "evaluated in one neural network computation");
+    opts->Register("batch-max-wait-ms", &max_wait_ms,
+                   "Batch scoring: how long (in milliseconds) a chunk may wait for a full "
+                   "minibatch before it is evaluated with fewer chunks");
+  }
+};
+
+// Evaluates an nnet3 acoustic model for all the decoders that share it. The
+// decoders submit chunks of features with their context, and a background
+// thread stacks chunks of the same shape from many streams into one
+// computation (Kaldi's NnetBatchComputer). A chunk waits at most
+// max_wait_ms for a full minibatch, which trades a little latency for much
+// larger matrix multiplications.
+class NnetBatchScorer {
+ public:
+  // 'opts' gives the chunk size, frame subsampling factor and acoustic scale;
+  // its minibatch sizes are overridden by 'config'. The outputs are
+  // log-likelihoods: the log of 'priors' is subtracted if it is not empty.
+  NnetBatchScorer(const NnetBatchScorerConfig &config,
+                  const nnet3::NnetBatchComputerOptions &opts,
+                  const nnet3::Nnet &nnet,
+                  const VectorBase<BaseFloat> &priors);
+
+  // Evaluates the chunks that are still pending and stops the thread
+  ~NnetBatchScorer();
+
+  // Queues 'task' for evaluation. task->semaphore is signalled when
+  // task->output_cpu is ready; the task must stay alive until then.
+  void Submit(nnet3::NnetInferenceTask *task);
+
+  // Context of the neural network, in input frames
+  int32 LeftContext() const { return left_context_; }
+  int32 RightContext() const { return right_context_; }
+  // Output frames per regular chunk
+  int32 ChunkSize() const { return opts_.frames_per_chunk / opts_.frame_subsampling_factor; }
+  int32 FrameSubsamplingFactor() const { return opts_.frame_subsampling_factor; }
+  int32 InputDim() const { return input_dim_; }
+  int32 IvectorDim() const { return ivector_dim_; }
+
+ private:
+  static gpointer Run(gpointer data);
+  void RunInternal();
+  // Evaluates a minibatch, if there is one; see NnetBatchComputer::Compute()
+  bool Compute(bool allow_partial_minibatch);
+
+  nnet3::NnetBatchComputerOptions opts_;
+  // a private copy: the decodable info modifies the shared one for looped
+  // computation
+  nnet3::Nnet nnet_;
+  int32 left_context_;
+  int32 right_context_;
+  int32 input_dim_;
+  int32 ivector_dim_;
+  gint64 max_wait_;  // in microseconds
+  nnet3::NnetBatchComputer computer_;
+
+  // protected by lock_
+  GMutex lock_;
+  GCond cond_;
+  // chunks submitted since the last partial minibatch was evaluated; some of
+  // them may already have been evaluated in full minibatches
+  int32 num_pending_;
+  gint64 first_pending_time_;
+  bool stop_;
+
+  GThread *thread_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(NnetBatchScorer);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_NNET3_BATCH_SCORER_H_
@@ -0,0 +1,227 @@
+// gst-plugin/nnet3-int8-bench.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the int8 layers of a model written by nnet3-quantize-int8 with
+// the float layers they replace, which are in the same file: the time and
+// error of every layer on random input and, given features, the time and
+// output of the whole network. Not part of the plugin, build it with
+// "make nnet3-int8-bench".
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "nnet3/nnet-am-decodable-simple.h"
+#include "nnet3/nnet-utils.h"
+#include "util/common-utils.h"
+
+#include "./nnet3-int8.h"
+
+namespace kaldi {
+
+// Seconds per evaluation of 'component' on 'input'
+static double TimePropagate(const nnet3::Component &component,
+                            const CuMatrixBase<BaseFloat> &input,
+                            int32 num_repeats,
+                            CuMatrix<BaseFloat> *output) {
+  output->Resize(input.NumRows(), component.OutputDim());
+  Timer timer;
+  for (int32 r = 0; r < num_repeats; r++) {
+    void *memo = component.Propagate(NULL, input, output);
+    component.DeleteMemo(memo);
+  }
+  return timer.Elapsed() / num_repeats;
+}
+
+// Size of the difference relative to the size of 'reference'
+static BaseFloat RelativeError(const CuMatrixBase<BaseFloat> &reference,
+                               const CuMatrixBase<BaseFloat> &output) {
+  CuMatrix<BaseFloat> diff(output);
+  diff.AddMat(-1.0, reference);
+  return diff.FrobeniusNorm() / std::max<BaseFloat>(reference.FrobeniusNorm(), 1.0e-20);
+}
+
+// The log-likelihoods of all frames of an utterance
+static void ComputeOutput(const nnet3::NnetSimpleComputationOptions &opts,
+                          const nnet3::Nnet &nnet,
+                          const VectorBase<BaseFloat> &priors,
+                          const MatrixBase<BaseFloat> &features,
+                          const MatrixBase<BaseFloat> *online_ivectors,
+                          int32 online_ivector_period,
+                          nnet3::CachingOptimizingCompiler *compiler,
+                          Matrix<BaseFloat> *output) {
+  nnet3::DecodableNnetSimple decodable(opts, nnet, priors, features, compiler,
+                                       NULL, online_ivectors, online_ivector_period);
+  output->Resize(decodable.NumFrames(), decodable.OutputDim());
+  for (int32 t = 0; t < decodable.NumFrames(); t++) {
+    SubVector<BaseFloat> row(*output, t);
+    decodable.GetOutputForFrame(t, &row);
+  }
+}
+
+}  // namespace kaldi
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+    const char *usage =
+        "Compares the int8 layers of a model written by nnet3-quantize-int8 with the\n"
+        "float layers they replace: time and relative error of each layer on random\n"
+        "input and, if features are given, time of the whole network and how often\n"
+        "the best pdf of a frame is the same\n"
+        "\n"
+        "Usage: nnet3-int8-bench [options] <int8-model-in> [<features-rspecifier>]\n"
+        "e.g.: nnet3-int8-bench --online-ivectors=scp:ivectors.scp --online-ivector-period=10 \\\n"
+        "  final.int8.mdl scp:feats.scp\n";
+    ParseOptions po(usage);
+    nnet3::NnetSimpleComputationOptions opts;
+    int32 num_rows = 50;
+    int32 num_repeats = 20;
+    std::string online_ivector_rspecifier;
+    int32 online_ivector_period = 0;
+    opts.Register(&po);
+    po.Register("num-rows", &num_rows,
+                "Rows of the random input of each layer (about the frames of a chunk)");
+    po.Register("num-repeats", &num_repeats, "Number of times each layer is evaluated");
+    po.Register("online-ivectors", &online_ivector_rspecifier,
+                "Rspecifier of the online iVectors of the utterances, if the model uses them");
+    po.Register("online-ivector-period", &online_ivector_period,
+                "Number of frames between the online iVectors");
+    po.Read(argc, argv);
+    if (po.NumArgs() < 1 || po.NumArgs() > 2) {
+      po.PrintUsage();
+      return 1;
+    }
+
+    TransitionModel trans_model;
+    nnet3::AmNnetSimple am_nnet;
+    nnet3::Nnet float_nnet;
+    {
+      bool binary;
+      Input ki(po.GetArg(1), &binary);
+      if (!IsInt8Nnet3Model(ki.Stream(), binary)) {
+        KALDI_ERR << po.GetArg(1) << " is not a model written by nnet3-quantize-int8";
+      }
+      ReadInt8Nnet3Model(ki.Stream(), binary, &trans_model, &am_nnet, &float_nnet);
+    }
+    const nnet3::Nnet &int8_nnet = am_nnet.GetNnet();
+
+    std::cout << std::setw(24) << "component" << std::setw(14) << "dims"
+              << std::setw(12) << "float ms" << std::setw(12) << "int8 ms"
+              << std::setw(10) << "speedup" << std::setw(12) << "rel. error" << std::endl;
+    double float_total = 0.0, int8_total = 0.0;
+    for (int32 c = 0; c < int8_nnet.NumComponents(); c++) {
+      const nnet3::Component *int8_component = int8_nnet.GetComponent(c);
+      if (int8_component->Type() != "Int8AffineComponent") {
+        continue;
+      }
+      const nnet3::Component *float_component = float_nnet.GetComponent(c);
+      CuMatrix<BaseFloat> input(num_rows, float_component->InputDim());
+      input.SetRandn();
+      CuMatrix<BaseFloat> float_output, int8_output;
+      double float_secs = TimePropagate(*float_component, input, num_repeats, &float_output);
+      double int8_secs = TimePropagate(*int8_component, input, num_repeats, &int8_output);
+      float_total += float_secs;
+      int8_total += int8_secs;
+      std::ostringstream dims;
+      dims << float_component->InputDim() << "x" << float_component->OutputDim();
+      std::cout << std::setw(24) << int8_nnet.GetComponentName(c)
+                << std::setw(14) << dims.str()
+                << std::fixed << std::setprecision(3)
+                << std::setw(12) << float_secs * 1000.0
+                << std::setw(12) << int8_secs * 1000.0
+                << std::setprecision(1)
+                << std::setw(10) << float_secs / int8_secs
+                << std::setprecision(4)
+                << std::setw(12) << RelativeError(float_output, int8_output) << std::endl;
+    }
+    if (int8_total > 0.0) {
+      std::cout << std::setw(24) << "all int8 layers" << std::setw(14) << ""
+                << std::fixed << std::setprecision(3)
+                << std::setw(12) << float_total * 1000.0
+                << std::setw(12) << int8_total * 1000.0
+                << std::setprecision(1)
+                << std::setw(10) << float_total / int8_total << std::endl;
+    }
+    if (po.NumArgs() == 1) {
+      return 0;
+    }
+
+    // The whole network, as the decoder evaluates it
+    SetBatchnormTestMode(true, &float_nnet);
+    SetDropoutTestMode(true, &float_nnet);
+    SetBatchnormTestMode(true, &(am_nnet.GetNnet()));
+    SetDropoutTestMode(true, &(am_nnet.GetNnet()));
+    nnet3::CachingOptimizingCompiler float_compiler(float_nnet, opts.optimize_config);
+    nnet3::CachingOptimizingCompiler int8_compiler(int8_nnet, opts.optimize_config);
+    SequentialBaseFloatMatrixReader feature_reader(po.GetArg(2));
+    RandomAccessBaseFloatMatrixReader online_ivector_reader(online_ivector_rspecifier);
+    int64 num_frames = 0, num_same = 0;
+    int32 num_utterances = 0;
+    double float_secs = 0.0, int8_secs = 0.0, abs_diff = 0.0;
+    for (; !feature_reader.Done(); feature_reader.Next()) {
+      const std::string &utt = feature_reader.Key();
+      const Matrix<BaseFloat> &features = feature_reader.Value();
+      const Matrix<BaseFloat> *online_ivectors = NULL;
+      if (!online_ivector_rspecifier.empty()) {
+        if (!online_ivector_reader.HasKey(utt)) {
+          KALDI_WARN << "No online iVectors for utterance " << utt;
+          continue;
+        }
+        online_ivectors = &online_ivector_reader.Value(utt);
+      }
+      Matrix<BaseFloat> float_output, int8_output;
+      Timer float_timer;
+      ComputeOutput(opts, float_nnet, am_nnet.Priors(), features, online_ivectors,
+                    online_ivector_period, &float_compiler, &float_output);
+      float_secs += float_timer.Elapsed();
+      Timer int8_timer;
+      ComputeOutput(opts, int8_nnet, am_nnet.Priors(), features, online_ivectors,
+                    online_ivector_period, &int8_compiler, &int8_output);
+      int8_secs += int8_timer.Elapsed();
+      for (int32 t = 0; t < float_output.NumRows(); t++) {
+        int32 float_best, int8_best;
+        float_output.Row(t).Max(&float_best);
+        int8_output.Row(t).Max(&int8_best);
+        num_same += (float_best == int8_best);
+      }
+      num_frames += float_output.NumRows();
+      int8_output.AddMat(-1.0, float_output);
+      int8_output.ApplyPowAbs(1.0);
+      abs_diff += int8_output.Sum();
+      num_utterances++;
+    }
+    if (num_frames == 0) {
+      KALDI_ERR << "No frames were decoded";
+    }
+    std::cout << std::endl << num_utterances << " utterances, " << num_frames
+              << " output frames" << std::fixed << std::setprecision(3) << std::endl
+              << "float network: " << float_secs << " s, int8 network: " << int8_secs
+              << " s, speedup " << std::setprecision(2) << float_secs / int8_secs << std::endl
+              << "same best pdf: " << 100.0 * num_same / num_frames << "% of the frames, "
+              << "mean absolute difference of the log-likelihoods: " << std::setprecision(4)
+              << abs_diff / (num_frames * static_cast<double>(int8_nnet.OutputDim("output"))) << std::endl;
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -0,0 +1,424 @@
+// gst-plugin/nnet3-int8.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include "cudamatrix/cu-device.h"
+#include "nnet3/nnet-simple-component.h"
+
+#include "./nnet3-int8.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_X86_INT8_KERNELS 1
+#include <immintrin.h>
+// the VNNI intrinsics and CPU feature name need GCC 8 or clang 8
+#if (defined(__clang__) && __clang_major__ >= 8) || (!defined(__clang__) && __GNUC__ >= 8)
+#define HAVE_X86_VNNI_KERNEL 1
+#endif
+#endif
+
+namespace kaldi {
+
+// Weight rows are padded to a multiple of this many bytes, one AVX-512
+// register, and their number to a multiple of 4
+static const int32 kInt8RowAlign = 64;
+static const int32 kInt8RowsPerStep = 4;
+
+// Computes the dot products of the quantized input row 'x' with the 4
+// weight rows starting at 'w'. 'w_sums' are the sums of those rows.
+typedef void (*DotProducts4Func)(const int8 *x, const int8 *w, int32 stride,
+                                 const int32 *w_sums, int32 *dots);
+
+static void DotProducts4Scalar(const int8 *x, const int8 *w, int32 stride,
+                               const int32 *w_sums, int32 *dots) {
+  for (int32 k = 0; k < kInt8RowsPerStep; k++) {
+    const int8 *w_row = w + k * stride;
+    int32 sum = 0;
+    for (int32 i = 0; i < stride; i++) {
+      sum += static_cast<int32>(x[i]) * static_cast<int32>(w_row[i]);
+    }
+    dots[k] = sum;
+  }
+}
+
+#ifdef HAVE_X86_INT8_KERNELS
+
+__attribute__((target("avx2")))
+static inline int32 HorizontalSumAvx2(__m256i v) {
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+}
+
+// Widens to 16 bits and multiplies with vpmaddwd. vpmaddubsw would take
+// the bytes directly, but it saturates for |x| and |w| close to 127.
+__attribute__((target("avx2")))
+static void DotProducts4Avx2(const int8 *x, const int8 *w, int32 stride,
+                             const int32 *w_sums, int32 *dots) {
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  __m256i acc2 = _mm256_setzero_si256();
+  __m256i acc3 = _mm256_setzero_si256();
+  for (int32 i = 0; i < stride; i += 16) {
+    __m256i xv = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)));
+    __m256i w0 = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i)));
+    __m256i w1 = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + stride + i)));
+    __m256i w2 = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + 2 * stride + i)));
+    __m256i w3 = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + 3 * stride + i)));
+    acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(xv, w0));
+    acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(xv, w1));
+    acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(xv, w2));
+    acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(xv, w3));
+  }
+  dots[0] = HorizontalSumAvx2(acc0);
+  dots[1] = HorizontalSumAvx2(acc1);
+  dots[2] = HorizontalSumAvx2(acc2);
+  dots[3] = HorizontalSumAvx2(acc3);
+}
+
+#ifdef HAVE_X86_VNNI_KERNEL
+
+// Through memory: the 512-bit extract and reduce intrinsics trip
+// -Wuninitialized in the headers of GCC 12. This runs once per 4 outputs.
+__attribute__((target("avx512f")))
+static inline int32 HorizontalSumAvx512(__m512i v) {
+  int32 lanes[16];
+  _mm512_storeu_si512(lanes, v);
+  int32 sum = 0;
+  for (int32 i = 0; i < 16; i++) {
+    sum += lanes[i];
+  }
+  return sum;
+}
+
+// vpdpbusd multiplies unsigned by signed bytes, so the input is offset by
+// 128 (flipping the sign bit) and 128 times the row sums is subtracted
+__attribute__((target("avx512f,avx512vnni")))
+static void DotProducts4Vnni(const int8 *x, const int8 *w, int32 stride,
+                             const int32 *w_sums, int32 *dots) {
+  const __m512i offset = _mm512_set1_epi8(static_cast<char>(0x80));
+  __m512i acc0 = _mm512_setzero_si512();
+  __m512i acc1 = _mm512_setzero_si512();
+  __m512i acc2 = _mm512_setzero_si512();
+  __m512i acc3 = _mm512_setzero_si512();
+  for (int32 i = 0; i < stride; i += 64) {
+    __m512i xv = _mm512_xor_si512(_mm512_loadu_si512(x + i), offset);
+    acc0 = _mm512_dpbusd_epi32(acc0, xv, _mm512_loadu_si512(w + i));
+    acc1 = _mm512_dpbusd_epi32(acc1, xv, _mm512_loadu_si512(w + stride + i));
+    acc2 = _mm512_dpbusd_epi32(acc2, xv, _mm512_loadu_si512(w + 2 * stride + i));
+    acc3 = _mm512_dpbusd_epi32(acc3, xv, _mm512_loadu_si512(w + 3 * stride + i));
+  }
+  dots[0] = HorizontalSumAvx512(acc0) - 128 * w_sums[0];
+  dots[1] = HorizontalSumAvx512(acc1) - 128 * w_sums[1];
+  dots[2] = HorizontalSumAvx512(acc2) - 128 * w_sums[2];
+  dots[3] = HorizontalSumAvx512(acc3) - 128 * w_sums[3];
+}
+
+#endif  // HAVE_X86_VNNI_KERNEL
+#endif  // HAVE_X86_INT8_KERNELS
+
+static DotProducts4Func SelectDotProducts4() {
+#ifdef HAVE_X86_INT8_KERNELS
+  __builtin_cpu_init();
+#ifdef HAVE_X86_VNNI_KERNEL
+  if (__builtin_cpu_supports("avx512vnni")) {
+    return DotProducts4Vnni;
+  }
+#endif
+  if (__builtin_cpu_supports("avx2")) {
+    return DotProducts4Avx2;
+  }
+#endif
+  return DotProducts4Scalar;
+}
+
+// Symmetric quantization to [-127, 127]; the scale maps back to floats
+static BaseFloat Int8Scale(BaseFloat max_abs) {
+  return max_abs > 0.0 ? max_abs / 127.0 : 1.0;
+}
+
+static int8 QuantizeInt8(BaseFloat value, BaseFloat inv_scale) {
+  return static_cast<int8>(std::lrint(value * inv_scale));
+}
+
+static int32 RoundUp(int32 n, int32 multiple) {
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+Int8AffineComponent::Int8AffineComponent() :
+    input_dim_(0), output_dim_(0), stride_(0) {
+}
+
+Int8AffineComponent::Int8AffineComponent(const MatrixBase<BaseFloat> &linear_params,
+                                         const VectorBase<BaseFloat> *bias_params) :
+    input_dim_(linear_params.NumCols()),
+    output_dim_(linear_params.NumRows()),
+    stride_(0),
+    scales_(linear_params.NumRows()) {
+  std::vector<int8> weights(static_cast<size_t>(output_dim_) * input_dim_);
+  for (int32 o = 0; o < output_dim_; o++) {
+    const BaseFloat *row = linear_params.RowData(o);
+    BaseFloat max_abs = 0.0;
+    for (int32 i = 0; i < input_dim_; i++) {
+      max_abs = std::max(max_abs, std::abs(row[i]));
+    }
+    scales_(o) = Int8Scale(max_abs);
+    BaseFloat inv_scale = 1.0 / scales_(o);
+    for (int32 i = 0; i < input_dim_; i++) {
+      weights[static_cast<size_t>(o) * input_dim_ + i] = QuantizeInt8(row[i], inv_scale);
+    }
+  }
+  if (bias_params != NULL) {
+    KALDI_ASSERT(bias_params->Dim() == output_dim_);
+    bias_.Resize(output_dim_, kUndefined);
+    bias_.CopyFromVec(*bias_params);
+  }
+  SetWeights(weights);
+}
+
+void Int8AffineComponent::SetWeights(const std::vector<int8> &weights) {
+  KALDI_ASSERT(weights.size() == static_cast<size_t>(output_dim_) * input_dim_);
+  stride_ = RoundUp(input_dim_, kInt8RowAlign);
+  int32 num_rows = RoundUp(output_dim_, kInt8RowsPerStep);
+  weights_.assign(static_cast<size_t>(num_rows) * stride_, 0);
+  weight_sums_.assign(num_rows, 0);
+  for (int32 o = 0; o < output_dim_; o++) {
+    const int8 *row = &weights[static_cast<size_t>(o) * input_dim_];
+    std::copy(row, row + input_dim_, &weights_[static_cast<size_t>(o) * stride_]);
+    for (int32 i = 0; i < input_dim_; i++) {
+      weight_sums_[o] += row[i];
+    }
+  }
+}
+
+void Int8AffineComponent::InitFromConfig(ConfigLine *cfl) {
+  KALDI_ERR << "Int8AffineComponent can't be initialized from a config, "
+            << "make it with nnet3-quantize-int8";
+}
+
+void* Int8AffineComponent::Propagate(const nnet3::ComponentPrecomputedIndexes *indexes,
+                                     const CuMatrixBase<BaseFloat> &in,
+                                     CuMatrixBase<BaseFloat> *out) const {
+#if HAVE_CUDA == 1
+  if (CuDevice::Instantiate().Enabled()) {
+    KALDI_ERR << "Int8AffineComponent only runs on the CPU";
+  }
+#endif
+  // CPU features are only probed once
+  static const DotProducts4Func dot_products = SelectDotProducts4();
+  const MatrixBase<BaseFloat> &in_mat = in.Mat();
+  MatrixBase<BaseFloat> &out_mat = out->Mat();
+  int32 num_rows = in_mat.NumRows();
+
+  // Propagate() runs in many decoding threads at once on a shared network,
+  // so the quantized input is local
+  std::vector<int8> input(static_cast<size_t>(num_rows) * stride_, 0);
+  std::vector<BaseFloat> input_scales(num_rows);
+  for (int32 r = 0; r < num_rows; r++) {
+    const BaseFloat *row = in_mat.RowData(r);
+    BaseFloat max_abs = 0.0;
+    for (int32 i = 0; i < input_dim_; i++) {
+      max_abs = std::max(max_abs, std::abs(row[i]));
+    }
+    input_scales[r] = Int8Scale(max_abs);
+    BaseFloat inv_scale = 1.0 / input_scales[r];
+    int8 *input_row = &input[static_cast<size_t>(r) * stride_];
+    for (int32 i = 0; i < input_dim_; i++) {
+      input_row[i] = QuantizeInt8(row[i], inv_scale);
+    }
+  }
+
+  // 4 weight rows at a time, so that they stay in the L1 cache while all
+  // input rows are multiplied with them
+  int32 dots[kInt8RowsPerStep];
+  for (int32 o = 0; o < output_dim_; o += kInt8RowsPerStep) {
+    const int8 *w = &weights_[static_cast<size_t>(o) * stride_];
+    int32 num_outputs = std::min(kInt8RowsPerStep, output_dim_ - o);
+    for (int32 r = 0; r < num_rows; r++) {
+      dot_products(&input[static_cast<size_t>(r) * stride_], w, stride_,
+                   &weight_sums_[o], dots);
+      BaseFloat *out_row = out_mat.RowData(r) + o;
+      for (int32 k = 0; k < num_outputs; k++) {
+        out_row[k] = dots[k] * input_scales[r] * scales_(o + k);
+        if (bias_.Dim() != 0) {
+          out_row[k] += bias_(o + k);
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
+void Int8AffineComponent::Backprop(const std::string &debug_info,
+                                   const nnet3::ComponentPrecomputedIndexes *indexes,
+                                   const CuMatrixBase<BaseFloat> &in_value,
+                                   const CuMatrixBase<BaseFloat> &out_value,
+                                   const CuMatrixBase<BaseFloat> &out_deriv,
+                                   void *memo,
+                                   nnet3::Component *to_update,
+                                   CuMatrixBase<BaseFloat> *in_deriv) const {
+  KALDI_ERR << "Int8AffineComponent is for inference only, train the float model";
+}
+
+void Int8AffineComponent::Read(std::istream &is, bool binary) {
+  ExpectToken(is, binary, "<Int8AffineComponent>");
+  ExpectToken(is, binary, "<InputDim>");
+  ReadBasicType(is, binary, &input_dim_);
+  ExpectToken(is, binary, "<OutputDim>");
+  ReadBasicType(is, binary, &output_dim_);
+  ExpectToken(is, binary, "<Weights>");
+  std::vector<int8> weights;
+  ReadIntegerVector(is, binary, &weights);
+  if (input_dim_ <= 0 || output_dim_ <= 0
+      || weights.size() != static_cast<size_t>(output_dim_) * input_dim_) {
+    KALDI_ERR << "Bad dimensions of Int8AffineComponent: " << output_dim_
+              << " x " << input_dim_ << " with " << weights.size() << " weights";
+  }
+  ExpectToken(is, binary, "<Scales>");
+  scales_.Read(is, binary);
+  ExpectToken(is, binary, "<Bias>");
+  bias_.Read(is, binary);
+  ExpectToken(is, binary, "</Int8AffineComponent>");
+  if (scales_.Dim() != output_dim_ || (bias_.Dim() != 0 && bias_.Dim() != output_dim_)) {
+    KALDI_ERR << "Bad dimensions of Int8AffineComponent scales or bias";
+  }
+  SetWeights(weights);
+}
+
+void Int8AffineComponent::Write(std::ostream &os, bool binary) const {
+  std::vector<int8> weights(static_cast<size_t>(output_dim_) * input_dim_);
+  for (int32 o = 0; o < output_dim_; o++) {
+    const int8 *row = &weights_[static_cast<size_t>(o) * stride_];
+    std::copy(row, row + input_dim_, &weights[static_cast<size_t>(o) * input_dim_]);
+  }
+  WriteToken(os, binary, "<Int8AffineComponent>");
+  WriteToken(os, binary, "<InputDim>");
+  WriteBasicType(os, binary, input_dim_);
+  WriteToken(os, binary, "<OutputDim>");
+  WriteBasicType(os, binary, output_dim_);
+  WriteToken(os, binary, "<Weights>");
+  WriteIntegerVector(os, binary, weights);
+  WriteToken(os, binary, "<Scales>");
+  scales_.Write(os, binary);
+  WriteToken(os, binary, "<Bias>");
+  bias_.Write(os, binary);
+  WriteToken(os, binary, "</Int8AffineComponent>");
+}
+
+// Returns NULL if 'component' is not an affine or linear layer
+static Int8AffineComponent *QuantizeComponent(const nnet3::Component *component) {
+  const nnet3::AffineComponent *affine =
+      dynamic_cast<const nnet3::AffineComponent*>(component);
+  if (affine != NULL) {
+    Matrix<BaseFloat> linear_params(affine->LinearParams());
+    Vector<BaseFloat> bias_params(affine->BiasParams());
+    return new Int8AffineComponent(linear_params, &bias_params);
+  }
+  const nnet3::LinearComponent *linear =
+      dynamic_cast<const nnet3::LinearComponent*>(component);
+  if (linear != NULL) {
+    Matrix<BaseFloat> params(linear->Params());
+    return new Int8AffineComponent(params, NULL);
+  }
+  return NULL;
+}
+
+void GetInt8QuantizableComponents(const nnet3::Nnet &nnet,
+                                  std::vector<std::string> *names) {
+  names->clear();
+  for (int32 c = 0; c < nnet.NumComponents(); c++) {
+    const nnet3::Component *component = nnet.GetComponent(c);
+    if (dynamic_cast<const nnet3::AffineComponent*>(component) != NULL
+        || dynamic_cast<const nnet3::LinearComponent*>(component) != NULL) {
+      names->push_back(nnet.GetComponentName(c));
+    }
+  }
+}
+
+void WriteInt8Nnet3Model(std::ostream &os, bool binary,
+                         const TransitionModel &trans_model,
+                         const nnet3::AmNnetSimple &am_nnet,
+                         const std::vector<std::string> &names) {
+  const nnet3::Nnet &nnet = am_nnet.GetNnet();
+  WriteToken(os, binary, "<Int8Nnet3>");
+  trans_model.Write(os, binary);
+  am_nnet.Write(os, binary);
+  WriteToken(os, binary, "<NumComponents>");
+  WriteBasicType(os, binary, static_cast<int32>(names.size()));
+  for (size_t i = 0; i < names.size(); i++) {
+    int32 c = nnet.GetComponentIndex(names[i]);
+    if (c == -1) {
+      KALDI_ERR << "No component named " << names[i];
+    }
+    std::unique_ptr<Int8AffineComponent> quantized(QuantizeComponent(nnet.GetComponent(c)));
+    if (!quantized) {
+      KALDI_ERR << "Component " << names[i] << " is not an affine or linear layer";
+    }
+    WriteToken(os, binary, "<ComponentName>");
+    WriteToken(os, binary, names[i]);
+    quantized->Write(os, binary);
+  }
+  WriteToken(os, binary, "</Int8Nnet3>");
+}
+
+bool IsInt8Nnet3Model(std::istream &is, bool binary) {
+  // "<Int8Nnet3>" and not "<TransitionModel>"
+  return PeekToken(is, binary) == 'I';
+}
+
+void ReadInt8Nnet3Model(std::istream &is, bool binary,
+                        TransitionModel *trans_model,
+                        nnet3::AmNnetSimple *am_nnet,
+                        nnet3::Nnet *float_nnet) {
+  ExpectToken(is, binary, "<Int8Nnet3>");
+  trans_model->Read(is, binary);
+  am_nnet->Read(is, binary);
+  nnet3::Nnet &nnet = am_nnet->GetNnet();
+  if (float_nnet != NULL) {
+    *float_nnet = nnet;
+  }
+  ExpectToken(is, binary, "<NumComponents>");
+  int32 num_components;
+  ReadBasicType(is, binary, &num_components);
+  for (int32 i = 0; i < num_components; i++) {
+    ExpectToken(is, binary, "<ComponentName>");
+    std::string name;
+    ReadToken(is, binary, &name);
+    int32 c = nnet.GetComponentIndex(name);
+    if (c == -1) {
+      KALDI_ERR << "No component named " << name << " for its int8 version";
+    }
+    std::unique_ptr<Int8AffineComponent> quantized(new Int8AffineComponent());
+    quantized->Read(is, binary);
+    if (quantized->InputDim() != nnet.GetComponent(c)->InputDim()
+        || quantized->OutputDim() != nnet.GetComponent(c)->OutputDim()) {
+      KALDI_ERR << "The int8 version of " << name << " has other dimensions";
+    }
+    nnet.SetComponent(c, quantized.release());
+  }
+  ExpectToken(is, binary, "</Int8Nnet3>");
+}
+
+}  // namespace kaldi
@@ -0,0 +1,116 @@
+// gst-plugin/nnet3-int8.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_NNET3_INT8_H_
+#define KALDI_SRC_NNET3_INT8_H_
+
+#include <string>
+#include <vector>
+
+#include "hmm/transition-model.h"
+#include "nnet3/am-nnet-simple.h"
+#include "nnet3/nnet-component-itf.h"
+#include "nnet3/nnet-nnet.h"
+
+namespace kaldi {
+
+// An affine (or linear) nnet3 layer with int8 weights, for CPU inference.
+// Every output row of the weights has its own scale. The input is quantized
+// row by row when the layer is evaluated, and the products are summed in
+// 32-bit integers: with AVX-512 VNNI when the CPU has it, else with AVX2,
+// else in plain C++. Nnet3 builds components from a fixed list of types,
+// so this one can't be read by Nnet::Read; ReadInt8Nnet3Model puts it in
+// place of the float layer after the network is read.
+class Int8AffineComponent : public nnet3::Component {
+ public:
+  Int8AffineComponent();
+  // 'bias_params' is NULL for a LinearComponent
+  Int8AffineComponent(const MatrixBase<BaseFloat> &linear_params,
+                      const VectorBase<BaseFloat> *bias_params);
+
+  virtual std::string Type() const { return "Int8AffineComponent"; }
+  virtual int32 Properties() const {
+    return nnet3::kSimpleComponent | nnet3::kBackpropNeedsInput | nnet3::kBackpropAdds;
+  }
+  virtual int32 InputDim() const { return input_dim_; }
+  virtual int32 OutputDim() const { return output_dim_; }
+
+  // Only made by quantizing a float layer, not from a config
+  virtual void InitFromConfig(ConfigLine *cfl);
+
+  virtual void* Propagate(const nnet3::ComponentPrecomputedIndexes *indexes,
+                          const CuMatrixBase<BaseFloat> &in,
+                          CuMatrixBase<BaseFloat> *out) const;
+  // Inference only: fails
+  virtual void Backprop(const std::string &debug_info,
+                        const nnet3::ComponentPrecomputedIndexes *indexes,
+                        const CuMatrixBase<BaseFloat> &in_value,
+                        const CuMatrixBase<BaseFloat> &out_value,
+                        const CuMatrixBase<BaseFloat> &out_deriv,
+                        void *memo,
+                        nnet3::Component *to_update,
+                        CuMatrixBase<BaseFloat> *in_deriv) const;
+
+  virtual nnet3::Component* Copy() const { return new Int8AffineComponent(*this); }
+  virtual void Read(std::istream &is, bool binary);
+  virtual void Write(std::ostream &os, bool binary) const;
+
+ private:
+  // Sets the padded weights from 'weights' (output_dim_ rows of input_dim_)
+  void SetWeights(const std::vector<int8> &weights);
+
+  int32 input_dim_;
+  int32 output_dim_;
+  // Row length of weights_, input_dim_ rounded up so that the kernels
+  // need no tail loops. The number of rows is rounded up to a multiple of 4.
+  int32 stride_;
+  std::vector<int8> weights_;
+  // Sums of the rows of weights_, for the VNNI kernel
+  std::vector<int32> weight_sums_;
+  Vector<BaseFloat> scales_;
+  // empty for a LinearComponent
+  Vector<BaseFloat> bias_;
+};
+
+// Names of the components of 'nnet' that can be quantized: AffineComponent
+// and its subclasses, and LinearComponent
+void GetInt8QuantizableComponents(const nnet3::Nnet &nnet,
+                                  std::vector<std::string> *names);
+
+// Writes an int8 model: 'trans_model' and 'am_nnet', followed by int8
+// copies of the components in 'names'. The float network stays in the file
+// because it gives the structure of the network and the priors.
+void WriteInt8Nnet3Model(std::ostream &os, bool binary,
+                         const TransitionModel &trans_model,
+                         const nnet3::AmNnetSimple &am_nnet,
+                         const std::vector<std::string> &names);
+
+// True if 'is' is at the start of a model written by WriteInt8Nnet3Model.
+// Ordinary models start with the transition model.
+bool IsInt8Nnet3Model(std::istream &is, bool binary);
+
+// Reads a model written by WriteInt8Nnet3Model. The int8 components replace
+// the float ones in 'am_nnet'. If 'float_nnet' is not NULL, it gets the
+// network as it was before they were replaced.
+void ReadInt8Nnet3Model(std::istream &is, bool binary,
+                        TransitionModel *trans_model,
+                        nnet3::AmNnetSimple *am_nnet,
+                        nnet3::Nnet *float_nnet = NULL);
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_NNET3_INT8_H_
@@ -0,0 +1,101 @@
+// gst-plugin/nnet3-quantize-int8.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+// Offline converter of nnet3 acoustic models to the int8 models that the
+// decoder's 'model' property accepts. Not part of the plugin, build it with
+// "make nnet3-quantize-int8".
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "nnet3/nnet-utils.h"
+#include "util/common-utils.h"
+
+#include "./nnet3-int8.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+    const char *usage =
+        "Converts an nnet3 acoustic model to one whose affine and linear layers have\n"
+        "int8 weights, for decoding on the CPU. The decoder element recognizes the\n"
+        "converted model when it is set as its 'model'.\n"
+        "\n"
+        "Usage: nnet3-quantize-int8 [options] <model-in> <model-out>\n"
+        "e.g.: nnet3-quantize-int8 final.mdl final.int8.mdl\n";
+    ParseOptions po(usage);
+    bool binary_write = true;
+    bool collapse_model = true;
+    std::string exclude;
+    po.Register("binary", &binary_write, "Write output in binary mode");
+    po.Register("collapse-model", &collapse_model,
+                "Fold batchnorm, dropout and fixed scale components into the affine "
+                "layers before quantizing them, as nnet3-am-copy --prepare-for-test does");
+    po.Register("exclude", &exclude,
+                "Comma-separated names of components that stay in float, "
+                "e.g. output.affine");
+    po.Read(argc, argv);
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      return 1;
+    }
+    std::string model_rxfilename = po.GetArg(1),
+        model_wxfilename = po.GetArg(2);
+
+    TransitionModel trans_model;
+    nnet3::AmNnetSimple am_nnet;
+    {
+      bool binary;
+      Input ki(model_rxfilename, &binary);
+      trans_model.Read(ki.Stream(), binary);
+      am_nnet.Read(ki.Stream(), binary);
+    }
+    nnet3::Nnet &nnet = am_nnet.GetNnet();
+    if (collapse_model) {
+      nnet3::SetBatchnormTestMode(true, &nnet);
+      nnet3::SetDropoutTestMode(true, &nnet);
+      nnet3::CollapseModel(nnet3::CollapseModelConfig(), &nnet);
+    }
+
+    std::vector<std::string> names, excluded;
+    GetInt8QuantizableComponents(nnet, &names);
+    SplitStringToVector(exclude, ",", true, &excluded);
+    for (size_t i = 0; i < excluded.size(); i++) {
+      std::vector<std::string>::iterator it =
+          std::find(names.begin(), names.end(), excluded[i]);
+      if (it == names.end()) {
+        KALDI_WARN << "No affine or linear component named " << excluded[i];
+      } else {
+        names.erase(it);
+      }
+    }
+    if (names.empty()) {
+      KALDI_WARN << "No component of " << model_rxfilename << " is quantized";
+    }
+
+    Output ko(model_wxfilename, binary_write);
+    WriteInt8Nnet3Model(ko.Stream(), binary_write, trans_model, am_nnet, names);
+    KALDI_LOG << "Quantized " << names.size() << " components of "
+              << model_rxfilename << " to int8, wrote " << model_wxfilename;
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -0,0 +1,533 @@
+// gst-plugin/nnet3-threaded-decoder.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <limits>
+
+#include "./nnet3-threaded-decoder.h"
+#include "lat/determinize-lattice-pruned.h"
+
+namespace kaldi {
+
+SingleUtteranceNnet3DecoderThreaded::SingleUtteranceNnet3DecoderThreaded(
+    const OnlineNnet3DecodingThreadedConfig &config,
+    const LatticeFasterDecoderConfig &decoder_opts,
+    const OnlineSilenceWeightingConfig &silence_weighting_config,
+    const TransitionModel &trans_model,
+    const nnet3::DecodableNnetSimpleLoopedInfo &info,
+    const fst::Fst<fst::StdArc> &fst,
+    const OnlineNnet2FeaturePipelineInfo &feature_info,
+    const OnlineIvectorExtractorAdaptationState &adaptation_state,
+    const OnlineCmvnState &cmvn_state) :
+    config_(config),
+    decoder_opts_(decoder_opts),
+    trans_model_(trans_model),
+    output_frame_shift_(feature_info.FrameShiftInSeconds()
+                        * info.opts.frame_subsampling_factor),
+    sample_rate_(0.0),
+    feature_pipeline_(feature_info),
+    decodable_nnet_(NULL),
+    num_frames_computed_(0),
+    decodable_(trans_model),
+    decoder_(fst, decoder_opts),
+    silence_weighting_(trans_model, silence_weighting_config,
+                       info.opts.frame_subsampling_factor),
+    num_samples_pending_(0),
+    num_samples_received_(0),
+    input_finished_(false),
+    abort_(false),
+    num_frames_ready_(0),
+    num_frames_decoded_(0),
+    nnet_finished_(false),
+    nnet_waiting_(false),
+    processed_waveform_offset_(0) {
+  decodable_nnet_ = new nnet3::DecodableNnetLoopedOnline(
+      info, feature_pipeline_.InputFeature(), feature_pipeline_.IvectorFeature());
+  pdf_indices_.resize(info.output_dim);
+  for (int32 pdf = 0; pdf < info.output_dim; pdf++) {
+    pdf_indices_[pdf] = pdf + 1;
+  }
+  Start(adaptation_state, cmvn_state);
+}
+
+SingleUtteranceNnet3DecoderThreaded::SingleUtteranceNnet3DecoderThreaded(
+    const OnlineNnet3DecodingThreadedConfig &config,
+    const LatticeFasterDecoderConfig &decoder_opts,
+    const OnlineSilenceWeightingConfig &silence_weighting_config,
+    const TransitionModel &trans_model,
+    const nnet2::AmNnet &am_nnet,
+    const nnet2::DecodableNnet2OnlineOptions &decodable_opts,
+    const fst::Fst<fst::StdArc> &fst,
+    const OnlineNnet2FeaturePipelineInfo &feature_info,
+    const OnlineIvectorExtractorAdaptationState &adaptation_state,
+    const OnlineCmvnState &cmvn_state) :
+    config_(config),
+    decoder_opts_(decoder_opts),
+    trans_model_(trans_model),
+    output_frame_shift_(feature_info.FrameShiftInSeconds()),
+    sample_rate_(0.0),
+    feature_pipeline_(feature_info),
+    decodable_nnet_(NULL),
+    nnet2_decodable_opts_(decodable_opts),
+    num_frames_computed_(0),
+    decodable_(trans_model),
+    decoder_(fst, decoder_opts),
+    silence_weighting_(trans_model, silence_weighting_config, 1),
+    num_samples_pending_(0),
+    num_samples_received_(0),
+    input_finished_(false),
+    abort_(false),
+    num_frames_ready_(0),
+    num_frames_decoded_(0),
+    nnet_finished_(false),
+    nnet_waiting_(false),
+    processed_waveform_offset_(0) {
+  decodable_nnet_ = new nnet2::DecodableNnet2Online(am_nnet, trans_model,
+                                                    nnet2_decodable_opts_,
+                                                    &feature_pipeline_);
+  // DecodableNnet2Online is indexed by transition-id, any one of a pdf
+  // gives its log-likelihood
+  pdf_indices_.resize(trans_model.NumPdfs(), 0);
+  for (int32 tid = 1; tid <= trans_model.NumTransitionIds(); tid++) {
+    int32 pdf = trans_model.TransitionIdToPdf(tid);
+    if (pdf_indices_[pdf] == 0) {
+      pdf_indices_[pdf] = tid;
+    }
+  }
+  Start(adaptation_state, cmvn_state);
+}
+
+void SingleUtteranceNnet3DecoderThreaded::Start(
+    const OnlineIvectorExtractorAdaptationState &adaptation_state,
+    const OnlineCmvnState &cmvn_state) {
+  feature_pipeline_.SetAdaptationState(adaptation_state);
+  feature_pipeline_.SetCmvnState(cmvn_state);
+  decoder_.InitDecoding();
+  g_mutex_init(&decodable_lock_);
+  g_mutex_init(&decoder_lock_);
+  g_mutex_init(&silence_weighting_lock_);
+  g_mutex_init(&lock_);
+  g_cond_init(&cond_);
+  nnet_thread_ = g_thread_new("nnet3-nnet", RunNnetEvaluation, this);
+  search_thread_ = g_thread_new("nnet3-search", RunDecoderSearch, this);
+}
+
+SingleUtteranceNnet3DecoderThreaded::~SingleUtteranceNnet3DecoderThreaded() {
+  if (nnet_thread_ != NULL) {
+    TerminateDecoding();
+    Wait();
+  }
+  for (size_t i = 0; i < input_waveform_.size(); i++) {
+    delete input_waveform_[i];
+  }
+  for (size_t i = 0; i < processed_waveform_.size(); i++) {
+    delete processed_waveform_[i];
+  }
+  delete decodable_nnet_;
+  g_mutex_clear(&decodable_lock_);
+  g_mutex_clear(&decoder_lock_);
+  g_mutex_clear(&silence_weighting_lock_);
+  g_mutex_clear(&lock_);
+  g_cond_clear(&cond_);
+}
+
+void SingleUtteranceNnet3DecoderThreaded::AcceptWaveform(
+    BaseFloat samp_freq, const VectorBase<BaseFloat> &wave_part) {
+  if (wave_part.Dim() == 0) {
+    return;
+  }
+  int64 max_pending = static_cast<int64>(config_.max_pending_audio_secs * samp_freq);
+  g_mutex_lock(&lock_);
+  KALDI_ASSERT(!input_finished_);
+  sample_rate_ = samp_freq;
+  while (!abort_ && num_samples_pending_ > 0
+         && num_samples_pending_ + wave_part.Dim() > max_pending) {
+    g_cond_wait(&cond_, &lock_);
+  }
+  input_waveform_.push_back(new Vector<BaseFloat>(wave_part));
+  num_samples_pending_ += wave_part.Dim();
+  num_samples_received_ += wave_part.Dim();
+  g_cond_broadcast(&cond_);
+  g_mutex_unlock(&lock_);
+}
+
+int32 SingleUtteranceNnet3DecoderThreaded::NumWaveformPiecesPending() {
+  g_mutex_lock(&lock_);
+  int32 num_pieces = input_waveform_.size();
+  g_mutex_unlock(&lock_);
+  return num_pieces;
+}
+
+void SingleUtteranceNnet3DecoderThreaded::InputFinished() {
+  g_mutex_lock(&lock_);
+  input_finished_ = true;
+  g_cond_broadcast(&cond_);
+  g_mutex_unlock(&lock_);
+}
+
+void SingleUtteranceNnet3DecoderThreaded::TerminateDecoding() {
+  g_mutex_lock(&lock_);
+  abort_ = true;
+  g_cond_broadcast(&cond_);
+  g_mutex_unlock(&lock_);
+}
+
+void SingleUtteranceNnet3DecoderThreaded::Wait() {
+  if (nnet_thread_ == NULL) {
+    return;
+  }
+  g_thread_join(nnet_thread_);
+  g_thread_join(search_thread_);
+  nnet_thread_ = NULL;
+  search_thread_ = NULL;
+}
+
+void SingleUtteranceNnet3DecoderThreaded::FinalizeDecoding() {
+  KALDI_ASSERT(nnet_thread_ == NULL);
+  decoder_.FinalizeDecoding();
+}
+
+int32 SingleUtteranceNnet3DecoderThreaded::NumFramesReceivedApprox() {
+  g_mutex_lock(&lock_);
+  int32 num_frames = NumFramesReceivedApproxLocked();
+  g_mutex_unlock(&lock_);
+  return num_frames;
+}
+
+int32 SingleUtteranceNnet3DecoderThreaded::NumFramesReceivedApproxLocked() const {
+  if (sample_rate_ <= 0) {
+    return 0;
+  }
+  return static_cast<int32>(num_samples_received_
+                            / (sample_rate_ * output_frame_shift_));
+}
+
+int32 SingleUtteranceNnet3DecoderThreaded::WaitForDecoder(int32 max_lag) {
+  g_mutex_lock(&lock_);
+  int32 lag = NumFramesReceivedApproxLocked() - num_frames_decoded_;
+  // the search thread signals every time it has decoded a batch. The
+  // decoder is idle when the nnet thread waits for audio and everything it
+  // computed is decoded; nnet_waiting_ is still set right after
+  // AcceptWaveform() until the nnet thread wakes up, so the queued audio
+  // has to be empty too.
+  while (lag > max_lag && !abort_ && !nnet_finished_
+         && !(nnet_waiting_ && input_waveform_.empty()
+              && num_frames_decoded_ >= num_frames_ready_)) {
+    g_cond_wait(&cond_, &lock_);
+    lag = NumFramesReceivedApproxLocked() - num_frames_decoded_;
+  }
+  g_mutex_unlock(&lock_);
+  return std::max(lag, 0);
+}
+
+int32 SingleUtteranceNnet3DecoderThreaded::NumFramesDecoded() {
+  g_mutex_lock(&lock_);
+  int32 num_frames = num_frames_decoded_;
+  g_mutex_unlock(&lock_);
+  return num_frames;
+}
+
+void SingleUtteranceNnet3DecoderThreaded::GetLattice(
+    bool end_of_utterance, CompactLattice *clat,
+    BaseFloat *final_relative_cost) {
+  clat->DeleteStates();
+  Lattice raw_lat;
+  g_mutex_lock(&decoder_lock_);
+  if (final_relative_cost != NULL) {
+    *final_relative_cost = decoder_.FinalRelativeCost();
+  }
+  if (decoder_.NumFramesDecoded() == 0) {
+    g_mutex_unlock(&decoder_lock_);
+    KALDI_WARN << "You cannot get a lattice if you decoded no frames.";
+    return;
+  }
+  decoder_.GetRawLattice(&raw_lat, end_of_utterance);
+  g_mutex_unlock(&decoder_lock_);
+
+  if (!decoder_opts_.determinize_lattice) {
+    KALDI_ERR << "--determinize-lattice=false option is not supported at the moment";
+  }
+  DeterminizeLatticePhonePrunedWrapper(trans_model_, &raw_lat,
+                                       decoder_opts_.lattice_beam, clat,
+                                       decoder_opts_.det_opts);
+}
+
+void SingleUtteranceNnet3DecoderThreaded::GetBestPath(
+    bool end_of_utterance, Lattice *best_path,
+    BaseFloat *final_relative_cost) {
+  g_mutex_lock(&decoder_lock_);
+  if (decoder_.NumFramesDecoded() == 0) {
+    // It's possible that this if-statement will be reached, if this function
+    // is called before any frames have been decoded.
+    best_path->DeleteStates();
+    best_path->SetStart(best_path->AddState());
+    best_path->SetFinal(best_path->Start(), LatticeWeight::One());
+    if (final_relative_cost != NULL) {
+      *final_relative_cost = std::numeric_limits<BaseFloat>::infinity();
+    }
+  } else {
+    decoder_.GetBestPath(best_path, end_of_utterance);
+    if (final_relative_cost != NULL) {
+      *final_relative_cost = decoder_.FinalRelativeCost();
+    }
+  }
+  g_mutex_unlock(&decoder_lock_);
+}
+
+bool SingleUtteranceNnet3DecoderThreaded::EndpointDetected(
+    const OnlineEndpointConfig &config) {
+  g_mutex_lock(&decoder_lock_);
+  bool ans = kaldi::EndpointDetected(config, trans_model_,
+                                     output_frame_shift_, decoder_);
+  g_mutex_unlock(&decoder_lock_);
+  return ans;
+}
+
+void SingleUtteranceNnet3DecoderThreaded::GetAdaptationState(
+    OnlineIvectorExtractorAdaptationState *adaptation_state) {
+  KALDI_ASSERT(nnet_thread_ == NULL);
+  feature_pipeline_.GetAdaptationState(adaptation_state);
+}
+
+void SingleUtteranceNnet3DecoderThreaded::GetCmvnState(
+    OnlineCmvnState *cmvn_state) {
+  KALDI_ASSERT(nnet_thread_ == NULL);
+  feature_pipeline_.GetCmvnState(cmvn_state);
+}
+
+void SingleUtteranceNnet3DecoderThreaded::GetRemainingWaveform(
+    Vector<BaseFloat> *waveform) {
+  KALDI_ASSERT(nnet_thread_ == NULL);
+  int64 num_samples_decoded = static_cast<int64>(
+      num_frames_decoded_ * output_frame_shift_ * sample_rate_);
+  int64 num_samples_stored = 0;
+  for (size_t i = 0; i < processed_waveform_.size(); i++) {
+    num_samples_stored += processed_waveform_[i]->Dim();
+  }
+  for (size_t i = 0; i < input_waveform_.size(); i++) {
+    num_samples_stored += input_waveform_[i]->Dim();
+  }
+  // the undecoded audio starts in the stored audio, unless nothing was
+  // decoded at all
+  int64 skip = std::max<int64>(0, num_samples_decoded - processed_waveform_offset_);
+  skip = std::min(skip, num_samples_stored);
+  waveform->Resize(num_samples_stored - skip, kUndefined);
+
+  int64 pos = 0;  // position in the stored audio
+  int32 dim = 0;  // samples written to waveform
+  for (int32 q = 0; q < 2; q++) {
+    const std::deque<Vector<BaseFloat>* > &pieces =
+        (q == 0 ? processed_waveform_ : input_waveform_);
+    for (size_t i = 0; i < pieces.size(); i++) {
+      const Vector<BaseFloat> &piece = *(pieces[i]);
+      int32 start = static_cast<int32>(std::max<int64>(0, std::min<int64>(skip - pos, piece.Dim())));
+      if (start < piece.Dim()) {
+        waveform->Range(dim, piece.Dim() - start).CopyFromVec(
+            piece.Range(start, piece.Dim() - start));
+        dim += piece.Dim() - start;
+      }
+      pos += piece.Dim();
+    }
+  }
+  KALDI_ASSERT(dim == waveform->Dim());
+}
+
+gpointer SingleUtteranceNnet3DecoderThreaded::RunNnetEvaluation(gpointer data) {
+  SingleUtteranceNnet3DecoderThreaded *me =
+      static_cast<SingleUtteranceNnet3DecoderThreaded*>(data);
+  try {
+    me->RunNnetEvaluationInternal();
+  } catch (const std::exception &e) {
+    KALDI_WARN << "Error in the nnet thread: " << e.what();
+    me->TerminateDecoding();
+  }
+  return NULL;
+}
+
+gpointer SingleUtteranceNnet3DecoderThreaded::RunDecoderSearch(gpointer data) {
+  SingleUtteranceNnet3DecoderThreaded *me =
+      static_cast<SingleUtteranceNnet3DecoderThreaded*>(data);
+  try {
+    me->RunDecoderSearchInternal();
+  } catch (const std::exception &e) {
+    KALDI_WARN << "Error in the search thread: " << e.what();
+    me->TerminateDecoding();
+  }
+  return NULL;
+}
+
+void SingleUtteranceNnet3DecoderThreaded::PruneProcessedWaveform() {
+  g_mutex_lock(&lock_);
+  int64 num_samples_decoded = static_cast<int64>(
+      num_frames_decoded_ * output_frame_shift_ * sample_rate_);
+  g_mutex_unlock(&lock_);
+  while (!processed_waveform_.empty()
+         && processed_waveform_offset_ + processed_waveform_.front()->Dim()
+            <= num_samples_decoded) {
+    processed_waveform_offset_ += processed_waveform_.front()->Dim();
+    delete processed_waveform_.front();
+    processed_waveform_.pop_front();
+  }
+}
+
+bool SingleUtteranceNnet3DecoderThreaded::ComputeNnetOutput() {
+  int32 num_frames_ready = decodable_nnet_->NumFramesReady();
+  while (num_frames_computed_ < num_frames_ready) {
+    // wait until the search has caught up
+    g_mutex_lock(&lock_);
+    while (!abort_ && num_frames_computed_ - num_frames_decoded_
+                      >= config_.max_pending_nnet_frames) {
+      g_cond_wait(&cond_, &lock_);
+    }
+    bool abort = abort_;
+    int32 num_frames_decoded = num_frames_decoded_;
+    g_mutex_unlock(&lock_);
+    if (abort) {
+      return false;
+    }
+
+    int32 num_frames = std::min(num_frames_ready - num_frames_computed_,
+                                config_.max_pending_nnet_frames);
+    int32 output_dim = pdf_indices_.size();
+    Matrix<BaseFloat> loglikes(num_frames, output_dim, kUndefined);
+    for (int32 t = 0; t < num_frames; t++) {
+      BaseFloat *row = loglikes.RowData(t);
+      for (int32 j = 0; j < output_dim; j++) {
+        row[j] = decodable_nnet_->LogLikelihood(num_frames_computed_ + t,
+                                                pdf_indices_[j]);
+      }
+    }
+
+    g_mutex_lock(&decodable_lock_);
+    // frames that the search is done with don't need to be kept
+    int32 frames_to_discard = std::max(0, std::min(
+        num_frames_decoded - decodable_.FirstAvailableFrame(),
+        decodable_.NumFramesReady() - decodable_.FirstAvailableFrame()));
+    decodable_.AcceptLoglikes(&loglikes, frames_to_discard);
+    g_mutex_unlock(&decodable_lock_);
+
+    num_frames_computed_ += num_frames;
+    g_mutex_lock(&lock_);
+    num_frames_ready_ = num_frames_computed_;
+    g_cond_broadcast(&cond_);
+    g_mutex_unlock(&lock_);
+  }
+  return true;
+}
+
+void SingleUtteranceNnet3DecoderThreaded::RunNnetEvaluationInternal() {
+  std::vector<std::pair<int32, BaseFloat> > delta_weights;
+  while (true) {
+    Vector<BaseFloat> *wave_part = NULL;
+    g_mutex_lock(&lock_);
+    if (!abort_ && input_waveform_.empty() && !input_finished_) {
+      nnet_waiting_ = true;
+      // a caller in WaitForDecoder() may be waiting for this
+      g_cond_broadcast(&cond_);
+      while (!abort_ && input_waveform_.empty() && !input_finished_) {
+        g_cond_wait(&cond_, &lock_);
+      }
+      nnet_waiting_ = false;
+    }
+    if (abort_) {
+      g_mutex_unlock(&lock_);
+      return;
+    }
+    if (!input_waveform_.empty()) {
+      wave_part = input_waveform_.front();
+      input_waveform_.pop_front();
+      num_samples_pending_ -= wave_part->Dim();
+      // there is room for more audio
+      g_cond_broadcast(&cond_);
+    }
+    bool input_finished = input_finished_ && input_waveform_.empty();
+    BaseFloat sample_rate = sample_rate_;
+    g_mutex_unlock(&lock_);
+
+    if (wave_part != NULL) {
+      feature_pipeline_.AcceptWaveform(sample_rate, *wave_part);
+      processed_waveform_.push_back(wave_part);
+      PruneProcessedWaveform();
+    }
+    if (input_finished) {
+      feature_pipeline_.InputFinished();
+    }
+
+    if (silence_weighting_.Active()
+        && feature_pipeline_.IvectorFeature() != NULL) {
+      g_mutex_lock(&silence_weighting_lock_);
+      silence_weighting_.GetDeltaWeights(feature_pipeline_.NumFramesReady(), 0,
+                                         &delta_weights);
+      g_mutex_unlock(&silence_weighting_lock_);
+      feature_pipeline_.UpdateFrameWeights(delta_weights);
+    }
+
+    if (!ComputeNnetOutput()) {
+      return;
+    }
+
+    if (input_finished) {
+      g_mutex_lock(&decodable_lock_);
+      decodable_.InputIsFinished();
+      g_mutex_unlock(&decodable_lock_);
+      g_mutex_lock(&lock_);
+      nnet_finished_ = true;
+      g_cond_broadcast(&cond_);
+      g_mutex_unlock(&lock_);
+      return;
+    }
+  }
+}
+
+void SingleUtteranceNnet3DecoderThreaded::RunDecoderSearchInternal() {
+  while (true) {
+    g_mutex_lock(&lock_);
+    while (!abort_ && !nnet_finished_ && num_frames_decoded_ >= num_frames_ready_) {
+      g_cond_wait(&cond_, &lock_);
+    }
+    bool finished = abort_
+        || (nnet_finished_ && num_frames_decoded_ >= num_frames_ready_);
+    g_mutex_unlock(&lock_);
+    if (finished) {
+      return;
+    }
+
+    g_mutex_lock(&decodable_lock_);
+    g_mutex_lock(&decoder_lock_);
+    decoder_.AdvanceDecoding(&decodable_, config_.search_batch_size);
+    int32 num_frames_decoded = decoder_.NumFramesDecoded();
+    g_mutex_unlock(&decoder_lock_);
+    g_mutex_unlock(&decodable_lock_);
+
+    if (silence_weighting_.Active()) {
+      g_mutex_lock(&silence_weighting_lock_);
+      // this doesn't trace back all the way, so it's fast
+      g_mutex_lock(&decoder_lock_);
+      silence_weighting_.ComputeCurrentTraceback(decoder_);
+      g_mutex_unlock(&decoder_lock_);
+      g_mutex_unlock(&silence_weighting_lock_);
+    }
+
+    g_mutex_lock(&lock_);
+    num_frames_decoded_ = num_frames_decoded;
+    // there is room for more nnet output
+    g_cond_broadcast(&cond_);
+    g_mutex_unlock(&lock_);
+  }
+}
+
+}  // namespace kaldi
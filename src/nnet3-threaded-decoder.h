@@ -0,0 +1,219 @@
+// gst-plugin/nnet3-threaded-decoder.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_NNET3_THREADED_DECODER_H_
+#define KALDI_SRC_NNET3_THREADED_DECODER_H_
+
+#include <deque>
+#include <vector>
+
+#include <glib.h>
+
+#include "online2/online-nnet2-feature-pipeline.h"
+#include "online2/online-endpoint.h"
+#include "online2/online-ivector-feature.h"
+#include "nnet3/decodable-online-looped.h"
+#include "nnet2/am-nnet.h"
+#include "nnet2/online-nnet2-decodable.h"
+#include "decoder/decodable-matrix.h"
+#include "decoder/lattice-faster-online-decoder.h"
+#include "itf/options-itf.h"
+
+namespace kaldi {
+
+struct OnlineNnet3DecodingThreadedConfig {
+  // audio that has been passed to the decoder but not converted to features
+  // yet; AcceptWaveform() blocks when there is more
+  BaseFloat max_pending_audio_secs;
+  // nnet outputs that have been computed but not searched yet; the nnet
+  // thread waits when there are more
+  int32 max_pending_nnet_frames;
+  // frames decoded at a time, the decoder is locked meanwhile
+  int32 search_batch_size;
+
+  OnlineNnet3DecodingThreadedConfig() :
+      max_pending_audio_secs(2.0),
+      max_pending_nnet_frames(100),
+      search_batch_size(2) { }
+
+  void Register(OptionsItf *opts) {
+    opts->Register("max-pending-audio-secs", &max_pending_audio_secs,
+                   "Threaded decoding: maximum amount of audio (in seconds) "
+                   "waiting for feature extraction");
+    opts->Register("max-pending-nnet-frames", &max_pending_nnet_frames,
+                   "Threaded decoding: maximum number of (subsampled) frames of "
+                   "neural network output waiting for the search");
+    opts->Register("search-batch-size", &search_batch_size,
+                   "Threaded decoding: number of frames decoded at a time");
+  }
+};
+
+// Decodes an utterance with an nnet3 model in two background threads: one
+// extracts features and evaluates the neural network, the other runs the
+// lattice search. The calling thread only passes in audio and asks for
+// results. The stages are connected by bounded queues, so a fast producer
+// can't run away from a slow consumer. The interface follows Kaldi's
+// SingleUtteranceNnet2DecoderThreaded. It also decodes with nnet2 models,
+// unlike Kaldi's decoder it then notifies WaitForDecoder() of the progress.
+class SingleUtteranceNnet3DecoderThreaded {
+ public:
+  SingleUtteranceNnet3DecoderThreaded(
+      const OnlineNnet3DecodingThreadedConfig &config,
+      const LatticeFasterDecoderConfig &decoder_opts,
+      const OnlineSilenceWeightingConfig &silence_weighting_config,
+      const TransitionModel &trans_model,
+      const nnet3::DecodableNnetSimpleLoopedInfo &info,
+      const fst::Fst<fst::StdArc> &fst,
+      const OnlineNnet2FeaturePipelineInfo &feature_info,
+      const OnlineIvectorExtractorAdaptationState &adaptation_state,
+      const OnlineCmvnState &cmvn_state);
+
+  // With an nnet2 model, which has no frame subsampling
+  SingleUtteranceNnet3DecoderThreaded(
+      const OnlineNnet3DecodingThreadedConfig &config,
+      const LatticeFasterDecoderConfig &decoder_opts,
+      const OnlineSilenceWeightingConfig &silence_weighting_config,
+      const TransitionModel &trans_model,
+      const nnet2::AmNnet &am_nnet,
+      const nnet2::DecodableNnet2OnlineOptions &decodable_opts,
+      const fst::Fst<fst::StdArc> &fst,
+      const OnlineNnet2FeaturePipelineInfo &feature_info,
+      const OnlineIvectorExtractorAdaptationState &adaptation_state,
+      const OnlineCmvnState &cmvn_state);
+
+  // Waits for the threads, so they are terminated if still running
+  ~SingleUtteranceNnet3DecoderThreaded();
+
+  // Queues audio for decoding; blocks while too much audio is pending
+  void AcceptWaveform(BaseFloat samp_freq,
+                      const VectorBase<BaseFloat> &wave_part);
+
+  int32 NumWaveformPiecesPending();
+
+  // No more audio will be passed in; the threads finish the utterance
+  void InputFinished();
+
+  // Stops decoding as soon as possible, e.g. after an endpoint
+  void TerminateDecoding();
+
+  // Waits until the threads have finished, after InputFinished() or
+  // TerminateDecoding()
+  void Wait();
+
+  // Finalizes the search, call after Wait()
+  void FinalizeDecoding();
+
+  // Approximate number of (subsampled) frames in the audio received so far
+  int32 NumFramesReceivedApprox();
+
+  int32 NumFramesDecoded();
+
+  // Blocks until at most max_lag of the frames received so far are not
+  // decoded yet, or until decoding can't advance without more audio (the
+  // last few frames need right context). Returns the remaining lag.
+  int32 WaitForDecoder(int32 max_lag);
+
+  void GetLattice(bool end_of_utterance, CompactLattice *clat,
+                  BaseFloat *final_relative_cost);
+
+  void GetBestPath(bool end_of_utterance, Lattice *best_path,
+                   BaseFloat *final_relative_cost);
+
+  bool EndpointDetected(const OnlineEndpointConfig &config);
+
+  // Call after Wait()
+  void GetAdaptationState(OnlineIvectorExtractorAdaptationState *adaptation_state);
+  void GetCmvnState(OnlineCmvnState *cmvn_state);
+
+  // Returns the audio after the last decoded frame, call after Wait()
+  void GetRemainingWaveform(Vector<BaseFloat> *waveform);
+
+ private:
+  // Sets the states and starts the threads, at the end of the constructors
+  void Start(const OnlineIvectorExtractorAdaptationState &adaptation_state,
+             const OnlineCmvnState &cmvn_state);
+
+  static gpointer RunNnetEvaluation(gpointer data);
+  static gpointer RunDecoderSearch(gpointer data);
+  void RunNnetEvaluationInternal();
+  void RunDecoderSearchInternal();
+
+  // Computes the nnet output for the frames that have enough features and
+  // passes it to the search. Returns false if terminated.
+  bool ComputeNnetOutput();
+
+  int32 NumFramesReceivedApproxLocked() const;
+
+  // Drops processed audio that is before the last decoded frame
+  void PruneProcessedWaveform();
+
+  const OnlineNnet3DecodingThreadedConfig &config_;
+  const LatticeFasterDecoderConfig &decoder_opts_;
+  const TransitionModel &trans_model_;
+  BaseFloat output_frame_shift_;  // in seconds
+  BaseFloat sample_rate_;
+
+  // used only by the nnet thread (and by the caller after Wait())
+  OnlineNnet2FeaturePipeline feature_pipeline_;
+  // nnet3's DecodableNnetLoopedOnline or nnet2's DecodableNnet2Online
+  DecodableInterface *decodable_nnet_;
+  // the index in decodable_nnet_ of every pdf: the pdf plus one for nnet3,
+  // a transition-id of the pdf for nnet2
+  std::vector<int32> pdf_indices_;
+  // DecodableNnet2Online keeps a reference to its options
+  nnet2::DecodableNnet2OnlineOptions nnet2_decodable_opts_;
+  int32 num_frames_computed_;
+
+  // nnet outputs waiting for the search, protected by decodable_lock_
+  DecodableMatrixMappedOffset decodable_;
+  GMutex decodable_lock_;
+
+  LatticeFasterOnlineDecoder decoder_;
+  GMutex decoder_lock_;
+
+  OnlineSilenceWeighting silence_weighting_;
+  GMutex silence_weighting_lock_;
+
+  // protected by lock_
+  GMutex lock_;
+  GCond cond_;
+  std::deque<Vector<BaseFloat>* > input_waveform_;
+  int64 num_samples_pending_;
+  int64 num_samples_received_;
+  bool input_finished_;
+  bool abort_;
+  int32 num_frames_ready_;   // passed to the search
+  int32 num_frames_decoded_;
+  bool nnet_finished_;
+  // the nnet thread has processed all audio and is waiting for more
+  bool nnet_waiting_;
+
+  // Audio that has been converted to features but may not have been decoded
+  // yet, starting at sample processed_waveform_offset_ of the utterance.
+  // Only used by the nnet thread, and by the caller after Wait().
+  std::deque<Vector<BaseFloat>* > processed_waveform_;
+  int64 processed_waveform_offset_;
+
+  GThread *nnet_thread_;
+  GThread *search_thread_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(SingleUtteranceNnet3DecoderThreaded);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_NNET3_THREADED_DECODER_H_
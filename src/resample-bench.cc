@@ -0,0 +1,134 @@
+// gst-plugin/resample-bench.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+// Times the built-in resampler (LinearResample with the filters of the
+// resample-quality presets) on synthetic audio from 8 kHz and 48 kHz to
+// 16 kHz, in chunks like the decoder reads them. To compare with
+// audioresample, time the same conversion in a pipeline (on one line), e.g.
+//   gst-launch-1.0 audiotestsrc wave=white-noise samplesperbuffer=2400 num-buffers=1200
+//     ! audio/x-raw,format=F32LE,rate=48000,channels=1
+//     ! audioresample quality=4 ! audio/x-raw,rate=16000 ! fakesink
+// Not part of the plugin, build it with "make resample-bench".
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "feat/resample.h"
+#include "util/parse-options.h"
+
+#include "./gst-audio-source.h"
+
+namespace kaldi {
+
+// Resamples 'input' in chunks of 'chunk_size' samples, returns the number
+// of output samples
+static int32 ResampleInChunks(LinearResample *resampler,
+                              const Vector<BaseFloat> &input,
+                              int32 chunk_size) {
+  int32 num_output_samples = 0;
+  Vector<BaseFloat> output;
+  for (int32 pos = 0; pos < input.Dim(); pos += chunk_size) {
+    int32 size = std::min(chunk_size, input.Dim() - pos);
+    bool flush = (pos + size == input.Dim());
+    resampler->Resample(input.Range(pos, size), flush, &output);
+    num_output_samples += output.Dim();
+  }
+  return num_output_samples;
+}
+
+}  // namespace kaldi
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+    const char *usage =
+        "Times the built-in resampler at each resample-quality preset, from 8 kHz and\n"
+        "48 kHz to 16 kHz. Times are per second of audio.\n"
+        "\n"
+        "Usage: resample-bench [options]\n";
+    ParseOptions po(usage);
+    BaseFloat audio_secs = 60.0;
+    BaseFloat chunk_length_in_secs = 0.05;
+    int32 num_repeats = 5;
+    int32 seed = 0;
+    po.Register("audio-secs", &audio_secs, "Length of the audio that is resampled");
+    po.Register("chunk-length", &chunk_length_in_secs,
+                "Length of the audio that is resampled at once, in seconds");
+    po.Register("num-repeats", &num_repeats, "Number of times the audio is resampled");
+    po.Register("seed", &seed, "Seed of the random audio");
+    po.Read(argc, argv);
+    if (po.NumArgs() != 0 || num_repeats <= 0) {
+      po.PrintUsage();
+      return 1;
+    }
+    srand(seed);
+
+    const int32 output_rate = 16000;
+    const int32 input_rates[] = { 8000, 48000 };
+    const ResampleQuality qualities[] = { kResampleQualityFast,
+                                          kResampleQualityMedium,
+                                          kResampleQualityHigh };
+    const char *quality_names[] = { "0 (fast)", "1 (medium)", "2 (high)" };
+    std::cout << std::setw(13) << "input rate" << std::setw(12) << "quality"
+              << std::setw(11) << "num-zeros" << std::setw(12) << "cutoff Hz"
+              << std::setw(8) << "ms/s" << std::setw(15) << "x real time"
+              << std::endl;
+    for (size_t r = 0; r < sizeof(input_rates) / sizeof(input_rates[0]); r++) {
+      int32 input_rate = input_rates[r];
+      Vector<BaseFloat> input(static_cast<int32>(input_rate * audio_secs));
+      for (int32 i = 0; i < input.Dim(); i++) {
+        input(i) = RandGauss() * 3000.0;
+      }
+      int32 chunk_size =
+          std::max(1, static_cast<int32>(input_rate * chunk_length_in_secs));
+
+      for (size_t q = 0; q < sizeof(qualities) / sizeof(qualities[0]); q++) {
+        BaseFloat filter_cutoff;
+        int32 num_zeros;
+        GetResampleFilter(qualities[q], input_rate, output_rate,
+                          &filter_cutoff, &num_zeros);
+        double secs = 0.0;
+        for (int32 n = 0; n < num_repeats; n++) {
+          // a new resampler every time, so that the setup is timed too
+          Timer timer;
+          LinearResample resampler(input_rate, output_rate, filter_cutoff,
+                                   num_zeros);
+          int32 num_output_samples = ResampleInChunks(&resampler, input, chunk_size);
+          secs += timer.Elapsed() / num_repeats;
+          KALDI_ASSERT(std::abs(num_output_samples - output_rate * audio_secs) <= 1);
+        }
+        std::cout << std::setw(13) << input_rate << std::setw(12) << quality_names[q]
+                  << std::setw(11) << num_zeros
+                  << std::fixed << std::setprecision(0)
+                  << std::setw(12) << filter_cutoff
+                  << std::setprecision(3)
+                  << std::setw(8) << secs * 1000.0 / audio_secs
+                  << std::setprecision(0)
+                  << std::setw(15) << audio_secs / secs << std::endl;
+      }
+    }
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -0,0 +1,270 @@
+// gst-plugin/result-writer.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "./result-writer.h"
+
+namespace kaldi {
+
+// Length of the UTF-8 sequence that starts with 'byte', 0 if it can't
+// start one; the same checks as Jansson's utf8_check_first()
+static int32 Utf8SequenceLength(unsigned char byte) {
+  if (byte < 0x80) return 1;
+  if (byte < 0xC2) return 0;  // continuation byte or overlong
+  if (byte < 0xE0) return 2;
+  if (byte < 0xF0) return 3;
+  if (byte < 0xF5) return 4;
+  return 0;
+}
+
+// Decodes the sequence at 's' of 'length' bytes, false if it is invalid,
+// overlong or a surrogate, like Jansson's utf8_check_full()
+static bool Utf8Decode(const unsigned char *s, int32 length, int32 *codepoint) {
+  int32 value = s[0] & (0xFF >> (length + 1));
+  if (length == 1) {
+    value = s[0];
+  }
+  for (int32 i = 1; i < length; i++) {
+    if ((s[i] & 0xC0) != 0x80) {
+      return false;
+    }
+    value = (value << 6) | (s[i] & 0x3F);
+  }
+  if (value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)
+      || (length == 2 && value < 0x80) || (length == 3 && value < 0x800)
+      || (length == 4 && value < 0x10000)) {
+    return false;
+  }
+  *codepoint = value;
+  return true;
+}
+
+static bool IsUtf8(const char *value) {
+  const unsigned char *s = reinterpret_cast<const unsigned char*>(value);
+  while (*s != '\0') {
+    int32 length = Utf8SequenceLength(*s), codepoint;
+    if (length == 0 || strnlen(reinterpret_cast<const char*>(s), length) < size_t(length)
+        || !Utf8Decode(s, length, &codepoint)) {
+      return false;
+    }
+    s += length;
+  }
+  return true;
+}
+
+ResultWriter::ResultWriter(ResultFormat format) {
+  Reset(format);
+}
+
+void ResultWriter::Reset(ResultFormat format) {
+  format_ = format;
+  data_.clear();
+  empty_.clear();
+  pending_key_ = NULL;
+}
+
+void ResultWriter::BeginValue() {
+  if (format_ == kResultFormatJson) {
+    if (!empty_.empty()) {
+      if (!empty_.back()) {
+        data_ += ", ";
+      }
+      empty_.back() = false;
+    }
+    if (pending_key_ != NULL) {
+      WriteJsonString(pending_key_);
+      data_ += ": ";
+    }
+  } else if (pending_key_ != NULL) {
+    size_t length = strlen(pending_key_);
+    WriteCborHead(3, length);
+    data_.append(pending_key_, length);
+  }
+  pending_key_ = NULL;
+}
+
+void ResultWriter::BeginObject() {
+  BeginValue();
+  data_ += (format_ == kResultFormatJson ? '{' : '\xBF');
+  empty_.push_back(true);
+}
+
+void ResultWriter::EndObject() {
+  data_ += (format_ == kResultFormatJson ? '}' : '\xFF');
+  empty_.pop_back();
+}
+
+void ResultWriter::BeginArray() {
+  BeginValue();
+  data_ += (format_ == kResultFormatJson ? '[' : '\x9F');
+  empty_.push_back(true);
+}
+
+void ResultWriter::EndArray() {
+  data_ += (format_ == kResultFormatJson ? ']' : '\xFF');
+  empty_.pop_back();
+}
+
+void ResultWriter::Key(const char *key) {
+  pending_key_ = key;
+}
+
+void ResultWriter::String(const char *value) {
+  if (value == NULL || !IsUtf8(value)) {
+    DropValue();
+    return;
+  }
+  BeginValue();
+  if (format_ == kResultFormatJson) {
+    WriteJsonString(value);
+  } else {
+    size_t length = strlen(value);
+    WriteCborHead(3, length);
+    data_.append(value, length);
+  }
+}
+
+void ResultWriter::Real(double value) {
+  if (!isfinite(value)) {
+    DropValue();
+    return;
+  }
+  BeginValue();
+  if (format_ == kResultFormatJson) {
+    // like Jansson's jsonp_dtostr() with the default precision
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.17g", value);
+    // a decimal comma from the locale
+    char *comma = strchr(buffer, ',');
+    if (comma != NULL) {
+      *comma = '.';
+    }
+    std::string number(buffer);
+    // so that it is read back as a real
+    if (number.find_first_of(".e") == std::string::npos) {
+      number += ".0";
+    }
+    // no '+' or leading zeros in the exponent
+    size_t e = number.find('e');
+    if (e != std::string::npos) {
+      size_t start = e + 1;
+      size_t end = start + 1;
+      if (number[start] == '-') {
+        start++;
+      }
+      while (end < number.size() && number[end] == '0') {
+        end++;
+      }
+      number.erase(start, end - start);
+    }
+    data_ += number;
+  } else {
+    float single = static_cast<float>(value);
+    uint64 bits;
+    if (static_cast<double>(single) == value) {
+      uint32 single_bits;
+      memcpy(&single_bits, &single, sizeof(single_bits));
+      data_ += '\xFA';
+      bits = uint64(single_bits) << 32;
+      for (int32 i = 0; i < 4; i++, bits <<= 8) {
+        data_ += static_cast<char>(bits >> 56);
+      }
+    } else {
+      memcpy(&bits, &value, sizeof(bits));
+      data_ += '\xFB';
+      for (int32 i = 0; i < 8; i++, bits <<= 8) {
+        data_ += static_cast<char>(bits >> 56);
+      }
+    }
+  }
+}
+
+void ResultWriter::Integer(int64 value) {
+  BeginValue();
+  if (format_ == kResultFormatJson) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(value));
+    data_ += buffer;
+  } else if (value >= 0) {
+    WriteCborHead(0, value);
+  } else {
+    WriteCborHead(1, -1 - value);
+  }
+}
+
+void ResultWriter::Bool(bool value) {
+  BeginValue();
+  if (format_ == kResultFormatJson) {
+    data_ += (value ? "true" : "false");
+  } else {
+    data_ += (value ? '\xF5' : '\xF4');
+  }
+}
+
+void ResultWriter::WriteJsonString(const char *value) {
+  data_ += '"';
+  for (const char *c = value; *c != '\0'; c++) {
+    switch (*c) {
+      case '\\': data_ += "\\\\"; break;
+      case '"': data_ += "\\\""; break;
+      case '\b': data_ += "\\b"; break;
+      case '\f': data_ += "\\f"; break;
+      case '\n': data_ += "\\n"; break;
+      case '\r': data_ += "\\r"; break;
+      case '\t': data_ += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(*c) < 0x20) {
+          char escape[8];
+          snprintf(escape, sizeof(escape), "\\u%04X", static_cast<unsigned char>(*c));
+          data_ += escape;
+        } else {
+          // non-ASCII is written as it is
+          data_ += *c;
+        }
+    }
+  }
+  data_ += '"';
+}
+
+void ResultWriter::WriteCborHead(int32 major_type, uint64 value) {
+  char type = static_cast<char>(major_type << 5);
+  int32 num_bytes;
+  if (value < 24) {
+    data_ += static_cast<char>(type | value);
+    return;
+  } else if (value <= 0xFF) {
+    data_ += static_cast<char>(type | 24);
+    num_bytes = 1;
+  } else if (value <= 0xFFFF) {
+    data_ += static_cast<char>(type | 25);
+    num_bytes = 2;
+  } else if (value <= 0xFFFFFFFFULL) {
+    data_ += static_cast<char>(type | 26);
+    num_bytes = 4;
+  } else {
+    data_ += static_cast<char>(type | 27);
+    num_bytes = 8;
+  }
+  for (int32 i = num_bytes - 1; i >= 0; i--) {
+    data_ += static_cast<char>(value >> (8 * i));
+  }
+}
+
+}  // namespace kaldi
@@ -0,0 +1,78 @@
+// gst-plugin/result-writer.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_RESULT_WRITER_H_
+#define KALDI_SRC_RESULT_WRITER_H_
+
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+enum ResultFormat {
+  kResultFormatJson = 0,  // text, as Jansson's json_dumps(root, 0) writes it
+  kResultFormatCbor = 1   // binary, RFC 7049
+};
+
+// Writes a result document in one pass into a buffer that keeps its memory
+// between documents. Values follow each other like the calls: Key() names
+// the next value of an object. Like Jansson, a value that can't be
+// represented (a real that is not finite, a string that is not UTF-8) is
+// left out, together with its key. Containers are written with indefinite
+// length in CBOR, so nothing has to be counted in advance.
+class ResultWriter {
+ public:
+  explicit ResultWriter(ResultFormat format = kResultFormatJson);
+
+  // Starts a new document, reusing the buffer
+  void Reset(ResultFormat format);
+
+  void BeginObject();
+  void EndObject();
+  void BeginArray();
+  void EndArray();
+
+  // 'key' must stay valid until the value is written
+  void Key(const char *key);
+
+  void String(const char *value);
+  void Real(double value);
+  void Integer(int64 value);
+  void Bool(bool value);
+
+  // The document; not NUL-terminated in CBOR
+  const std::string &Data() const { return data_; }
+
+ private:
+  // Writes what goes before a value: the separator and the pending key
+  void BeginValue();
+  void DropValue() { pending_key_ = NULL; }
+  void WriteJsonString(const char *value);
+  void WriteCborHead(int32 major_type, uint64 value);
+
+  ResultFormat format_;
+  std::string data_;
+  // for each open container, whether it is still empty
+  std::vector<bool> empty_;
+  const char *pending_key_;
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_RESULT_WRITER_H_
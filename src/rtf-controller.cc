@@ -0,0 +1,87 @@
+// gst-plugin/rtf-controller.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "./rtf-controller.h"
+
+namespace kaldi {
+
+// weight of the newest chunk in the smoothed real-time factor
+static const BaseFloat kRtfSmoothing = 0.2;
+// seconds of audio to decode after a change before the next one
+static const BaseFloat kMinAudioBetweenChanges = 1.0;
+// the search is widened when the real-time factor is below this part of the
+// target, so that it doesn't oscillate around the target
+static const BaseFloat kRelaxThreshold = 0.7;
+// an unlimited max-active is narrowed starting from this
+static const int32 kMaxActiveStart = 20000;
+
+RtfController::RtfController(const RtfControlConfig &config,
+                             BaseFloat max_beam, int32 max_max_active) :
+    config_(config),
+    max_beam_(max_beam),
+    max_max_active_(max_max_active),
+    beam_(max_beam),
+    max_active_(max_max_active),
+    rtf_(-1.0),
+    audio_since_change_(0.0) {
+}
+
+bool RtfController::Update(BaseFloat audio_secs, double compute_secs) {
+  if (audio_secs <= 0.0) {
+    return false;
+  }
+  BaseFloat rtf = compute_secs / audio_secs;
+  if (rtf_ < 0.0) {
+    rtf_ = rtf;
+  } else {
+    rtf_ = kRtfSmoothing * rtf + (1.0 - kRtfSmoothing) * rtf_;
+  }
+  audio_since_change_ += audio_secs;
+  if (audio_since_change_ < kMinAudioBetweenChanges) {
+    return false;
+  }
+
+  BaseFloat beam = beam_;
+  int32 max_active = max_active_;
+  if (rtf_ > config_.target_rtf) {
+    beam = std::max(config_.min_beam, beam_ - config_.beam_step);
+    max_active = std::max(config_.min_max_active,
+                          static_cast<int32>(std::min(max_active_, kMaxActiveStart) * 0.8));
+  } else if (rtf_ < kRelaxThreshold * config_.target_rtf) {
+    beam = std::min(max_beam_, beam_ + config_.beam_step);
+    if (max_active_ >= kMaxActiveStart
+        || static_cast<int64>(max_active_) * 5 / 4 >= max_max_active_) {
+      max_active = max_max_active_;
+    } else {
+      max_active = max_active_ * 5 / 4;
+    }
+  }
+  // never above the configured values
+  beam = std::min(beam, max_beam_);
+  max_active = std::min(max_active, max_max_active_);
+  if (beam == beam_ && max_active == max_active_) {
+    return false;
+  }
+  beam_ = beam;
+  max_active_ = max_active;
+  audio_since_change_ = 0.0;
+  return true;
+}
+
+}  // namespace kaldi
@@ -0,0 +1,86 @@
+// gst-plugin/rtf-controller.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_RTF_CONTROLLER_H_
+#define KALDI_SRC_RTF_CONTROLLER_H_
+
+#include "base/kaldi-common.h"
+#include "itf/options-itf.h"
+
+namespace kaldi {
+
+struct RtfControlConfig {
+  // real-time factor to hold, 0 disables the controller
+  BaseFloat target_rtf;
+  // the search is never narrowed beyond these; the configured beam and
+  // max-active are the upper bounds
+  BaseFloat min_beam;
+  int32 min_max_active;
+  BaseFloat beam_step;
+
+  RtfControlConfig() :
+      target_rtf(0.0),
+      min_beam(8.0),
+      min_max_active(1000),
+      beam_step(1.0) { }
+
+  void Register(OptionsItf *opts) {
+    opts->Register("rtf-target", &target_rtf,
+                   "Real-time factor (decoding time / audio time) to hold by narrowing "
+                   "the beam and max-active when decoding is slower (0 disables)");
+    opts->Register("rtf-min-beam", &min_beam,
+                   "Real-time factor control: smallest beam to use");
+    opts->Register("rtf-min-max-active", &min_max_active,
+                   "Real-time factor control: smallest max-active to use");
+    opts->Register("rtf-beam-step", &beam_step,
+                   "Real-time factor control: how much the beam is changed at a time");
+  }
+};
+
+// Closed-loop control of the search width: compares the time spent decoding
+// each chunk to the duration of the chunk, and narrows the beam and
+// max-active when the smoothed real-time factor is above the target, or
+// widens them back towards the configured values when it is well below.
+class RtfController {
+ public:
+  RtfController(const RtfControlConfig &config, BaseFloat max_beam,
+                int32 max_max_active);
+
+  // Records that 'audio_secs' of audio took 'compute_secs' to decode.
+  // Returns true if Beam() or MaxActive() changed.
+  bool Update(BaseFloat audio_secs, double compute_secs);
+
+  // smoothed real-time factor
+  BaseFloat Rtf() const { return rtf_; }
+  BaseFloat Beam() const { return beam_; }
+  int32 MaxActive() const { return max_active_; }
+
+ private:
+  const RtfControlConfig &config_;
+  BaseFloat max_beam_;
+  int32 max_max_active_;
+  BaseFloat beam_;
+  int32 max_active_;
+  BaseFloat rtf_;
+  // audio decoded since the last change, so that the effect of a change is
+  // measured before the next one
+  BaseFloat audio_since_change_;
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_RTF_CONTROLLER_H_
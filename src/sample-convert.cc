@@ -0,0 +1,201 @@
+// gst-plugin/sample-convert.cc
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+
+#include "./sample-convert.h"
+
+// The vectorized converters read little-endian samples directly and write
+// single precision floats, so they are only used on x86 with float BaseFloat
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) \
+    && !KALDI_DOUBLEPRECISION
+#define HAVE_X86_SAMPLE_CONVERT 1
+#include <immintrin.h>
+#endif
+
+namespace kaldi {
+
+static const float kS32Scale = 1.0f / 65536.0f;
+static const float kF32Scale = 32768.0f;
+
+typedef void (*ConvertFunc)(const guint8 *src, size_t num_samples,
+                            BaseFloat *dst);
+
+static void ConvertS16Scalar(const guint8 *src, size_t num_samples,
+                             BaseFloat *dst) {
+  for (size_t i = 0; i < num_samples; i++) {
+    dst[i] = static_cast<BaseFloat>(
+        static_cast<int16>(GST_READ_UINT16_LE(src + 2 * i)));
+  }
+}
+
+static void ConvertS32Scalar(const guint8 *src, size_t num_samples,
+                             BaseFloat *dst) {
+  for (size_t i = 0; i < num_samples; i++) {
+    dst[i] = static_cast<BaseFloat>(
+        static_cast<int32>(GST_READ_UINT32_LE(src + 4 * i))) * kS32Scale;
+  }
+}
+
+static void ConvertF32Scalar(const guint8 *src, size_t num_samples,
+                             BaseFloat *dst) {
+  for (size_t i = 0; i < num_samples; i++) {
+    dst[i] = static_cast<BaseFloat>(GST_READ_FLOAT_LE(src + 4 * i)) * kF32Scale;
+  }
+}
+
+#ifdef HAVE_X86_SAMPLE_CONVERT
+
+static void ConvertS16Sse2(const guint8 *src, size_t num_samples,
+                           BaseFloat *dst) {
+  size_t i = 0;
+  for (; i + 8 <= num_samples; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+    // sign-extend by unpacking each sample into the high half of a 32-bit lane
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    _mm_storeu_ps(dst + i, _mm_cvtepi32_ps(lo));
+    _mm_storeu_ps(dst + i + 4, _mm_cvtepi32_ps(hi));
+  }
+  ConvertS16Scalar(src + 2 * i, num_samples - i, dst + i);
+}
+
+static void ConvertS32Sse2(const guint8 *src, size_t num_samples,
+                           BaseFloat *dst) {
+  const __m128 scale = _mm_set1_ps(kS32Scale);
+  size_t i = 0;
+  for (; i + 4 <= num_samples; i += 4) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * i));
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+  }
+  ConvertS32Scalar(src + 4 * i, num_samples - i, dst + i);
+}
+
+static void ConvertF32Sse2(const guint8 *src, size_t num_samples,
+                           BaseFloat *dst) {
+  const __m128 scale = _mm_set1_ps(kF32Scale);
+  size_t i = 0;
+  for (; i + 4 <= num_samples; i += 4) {
+    __m128 x = _mm_loadu_ps(reinterpret_cast<const float*>(src + 4 * i));
+    _mm_storeu_ps(dst + i, _mm_mul_ps(x, scale));
+  }
+  ConvertF32Scalar(src + 4 * i, num_samples - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void ConvertS16Avx2(const guint8 *src, size_t num_samples,
+                           BaseFloat *dst) {
+  size_t i = 0;
+  for (; i + 16 <= num_samples; i += 16) {
+    __m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+    __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16));
+    _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x0)));
+    _mm256_storeu_ps(dst + i + 8, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x1)));
+  }
+  ConvertS16Sse2(src + 2 * i, num_samples - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void ConvertS32Avx2(const guint8 *src, size_t num_samples,
+                           BaseFloat *dst) {
+  const __m256 scale = _mm256_set1_ps(kS32Scale);
+  size_t i = 0;
+  for (; i + 8 <= num_samples; i += 8) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * i));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+  }
+  ConvertS32Sse2(src + 4 * i, num_samples - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void ConvertF32Avx2(const guint8 *src, size_t num_samples,
+                           BaseFloat *dst) {
+  const __m256 scale = _mm256_set1_ps(kF32Scale);
+  size_t i = 0;
+  for (; i + 8 <= num_samples; i += 8) {
+    __m256 x = _mm256_loadu_ps(reinterpret_cast<const float*>(src + 4 * i));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(x, scale));
+  }
+  ConvertF32Sse2(src + 4 * i, num_samples - i, dst + i);
+}
+
+#endif  // HAVE_X86_SAMPLE_CONVERT
+
+struct SampleConverters {
+  ConvertFunc s16;
+  ConvertFunc s32;
+  ConvertFunc f32;
+};
+
+static SampleConverters SelectSampleConverters() {
+  SampleConverters converters;
+  converters.s16 = ConvertS16Scalar;
+  converters.s32 = ConvertS32Scalar;
+  converters.f32 = ConvertF32Scalar;
+#ifdef HAVE_X86_SAMPLE_CONVERT
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    converters.s16 = ConvertS16Avx2;
+    converters.s32 = ConvertS32Avx2;
+    converters.f32 = ConvertF32Avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    converters.s16 = ConvertS16Sse2;
+    converters.s32 = ConvertS32Sse2;
+    converters.f32 = ConvertF32Sse2;
+  }
+#endif
+  return converters;
+}
+
+size_t SampleWidth(SampleFormat format) {
+  return format == kSampleFormatS16LE ? 2 : 4;
+}
+
+bool SampleFormatFromString(const gchar *str, SampleFormat *format) {
+  if (str == NULL) {
+    return false;
+  }
+  if (strcmp(str, "S16LE") == 0) {
+    *format = kSampleFormatS16LE;
+  } else if (strcmp(str, "S32LE") == 0) {
+    *format = kSampleFormatS32LE;
+  } else if (strcmp(str, "F32LE") == 0) {
+    *format = kSampleFormatF32LE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void ConvertSamples(SampleFormat format, const guint8 *src,
+                    size_t num_samples, BaseFloat *dst) {
+  // CPU features are only probed once
+  static const SampleConverters converters = SelectSampleConverters();
+  switch (format) {
+    case kSampleFormatS16LE:
+      converters.s16(src, num_samples, dst);
+      break;
+    case kSampleFormatS32LE:
+      converters.s32(src, num_samples, dst);
+      break;
+    case kSampleFormatF32LE:
+      converters.f32(src, num_samples, dst);
+      break;
+  }
+}
+
+}  // namespace kaldi
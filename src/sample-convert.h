@@ -0,0 +1,52 @@
+// gst-plugin/sample-convert.h
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_SAMPLE_CONVERT_H_
+#define KALDI_SRC_SAMPLE_CONVERT_H_
+
+#include <matrix/kaldi-vector.h>
+#include <gst/gst.h>
+
+namespace kaldi {
+
+// Raw audio formats accepted on the sink pad (mono, little-endian)
+enum SampleFormat {
+  kSampleFormatS16LE = 0,
+  kSampleFormatS32LE = 1,
+  kSampleFormatF32LE = 2
+};
+
+// Width of the widest supported sample format, in bytes
+const size_t kMaxSampleWidth = 4;
+
+// Width of one sample in bytes
+size_t SampleWidth(SampleFormat format);
+
+// Parses a GStreamer format string ("S16LE", "S32LE", "F32LE"),
+// returns false if the format is not supported
+bool SampleFormatFromString(const gchar *str, SampleFormat *format);
+
+// Converts num_samples raw samples to floats in the 16-bit integer range
+// that Kaldi feature extraction expects. S32LE is scaled down by 2^16,
+// F32LE (nominally in [-1, 1]) is scaled up by 2^15. Uses SSE2 or AVX2 when
+// the CPU supports it; 'src' does not need to be aligned.
+void ConvertSamples(SampleFormat format, const guint8 *src,
+                    size_t num_samples, BaseFloat *dst);
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_SAMPLE_CONVERT_H_